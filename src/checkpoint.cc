@@ -0,0 +1,150 @@
+// o3 RISC simulator
+//
+// checkpoints
+// - file writer
+// - mapped reader
+// - frame compression
+//
+// Lukas Heine 2021
+
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkpoint.hh"
+
+namespace ckpt
+{
+
+static u64 page_align(u64 x)
+{
+    return (x + PAGE_SIZE - 1) & PAGE_MASK;
+}
+
+void Writer::write(const string& path, Header hdr)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if(!file) throw CheckpointException();
+
+    hdr.magic     = magic;
+    hdr.version   = version;
+    hdr.sections  = sec_max;
+    hdr.page_size = PAGE_SIZE;
+
+    std::array<string, sec_max>  data;
+    std::array<Section, sec_max> table;
+    u64 offs = page_align(sizeof(Header) + sizeof(table));
+    for(u32 i = 0; i < sec_max; i++)
+    {
+        data[i]  = secs[i].str();
+        table[i] = { i, 0, offs, data[i].size() };
+        offs     = page_align(offs + data[i].size());
+    }
+
+    put(file, hdr);
+    put(file, table);
+
+    u64 pos = sizeof(Header) + sizeof(table);
+    for(u32 i = 0; i < sec_max; i++)
+    {
+        file << string(table[i].offset - pos, '\0') << data[i];
+        pos = table[i].offset + table[i].size;
+    }
+
+    if(!file) throw CheckpointException();
+}
+
+Reader::Reader(const string& path) : base(nullptr), len(0), table(nullptr)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) throw CheckpointException();
+
+    struct stat sb;
+    if(fstat(fd, &sb) || ((size_t)sb.st_size < sizeof(Header)))
+    {
+        close(fd);
+        throw CheckpointException();
+    }
+
+    len = sb.st_size;
+    void* p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED) throw CheckpointException();
+    base = (const u8*)p;
+
+    const Header& h = header();
+    if((h.magic != magic) || (h.version != version) || (h.page_size != PAGE_SIZE) || (h.sections > sec_max) ||
+        (sizeof(Header) + h.sections * sizeof(Section) > len))
+    {
+        munmap((void*)base, len);
+        throw CheckpointException();
+    }
+
+    table = (const Section*)(base + sizeof(Header));
+    for(u32 i = 0; i < h.sections; i++)
+        if((table[i].offset > len) || (table[i].size > len - table[i].offset))
+        {
+            munmap((void*)base, len);
+            throw CheckpointException();
+        }
+}
+
+Reader::~Reader()
+{
+    munmap((void*)base, len);
+}
+
+std::string_view Reader::section(u8 id) const
+{
+    for(u32 i = 0; i < header().sections; i++)
+        if(table[i].id == id) return std::string_view((const char*)base + table[i].offset, table[i].size);
+    return std::string_view();
+}
+
+std::istringstream Reader::stream(u8 id) const
+{
+    return std::istringstream(string(section(id)));
+}
+
+vector<u8> rle_encode(const u8* data, size_t len)
+{
+    vector<u8> out;
+    for(size_t i = 0; i < len;)
+    {
+        u16 zeros = 0, lits = 0;
+        while((i + zeros < len) && !data[i + zeros] && (zeros < UINT16_MAX)) zeros++;
+
+        // single zero bytes are cheaper as literals
+        size_t l = i + zeros;
+        while((l + lits < len) && (lits < UINT16_MAX) && (data[l + lits] || ((l + lits + 1 < len) && data[l + lits + 1])))
+            lits++;
+
+        out.insert(out.end(), { (u8)zeros, (u8)(zeros >> 8), (u8)lits, (u8)(lits >> 8) });
+        out.insert(out.end(), data + l, data + l + lits);
+        i = l + lits;
+    }
+    return out;
+}
+
+u8 rle_decode(const u8* in, size_t inlen, u8* out, size_t len)
+{
+    size_t i = 0, o = 0;
+    for(;i + 4 <= inlen;)
+    {
+        u16 zeros = in[i] | (in[i + 1] << 8);
+        u16 lits  = in[i + 2] | (in[i + 3] << 8);
+        i += 4;
+
+        if((o + zeros + lits > len) || (i + lits > inlen)) return 1;
+        std::memset(out + o, 0, zeros);
+        std::memcpy(out + o + zeros, in + i, lits);
+        o += zeros + lits;
+        i += lits;
+    }
+    return (i != inlen) || (o != len);
+}
+
+} // ckpt
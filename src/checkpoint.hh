@@ -0,0 +1,148 @@
+// o3 RISC simulator
+//
+// checkpoints
+// - binary file layout
+// - section writer / reader
+// - stream helpers
+//
+// Lukas Heine 2021
+
+#ifndef SIM_CHECKPOINT_H
+#define SIM_CHECKPOINT_H
+
+#include <array>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <string_view>
+#include <type_traits>
+
+#include "types.hh"
+#include "util.hh"
+#include "conf.hh"
+
+struct CheckpointException : public SimulatorException
+{
+    const char* what () const throw ()
+    {   return "invalid or incompatible checkpoint."; }
+}; // CheckpointException
+
+// Header | Section[sec_max] | section data
+// sections start at PAGE_SIZE boundaries, raw frames inside sec_pages as well, so a mapped file is used in place
+namespace ckpt
+{
+    const u32 magic   = 0x4b43334f; // "O3CK"
+    const u32 version = 2;
+
+    typedef enum
+    {
+        sec_state,      // SimulatorState counters
+        sec_arf,        // ArchRegFile
+        sec_pagetable,  // PageRecord[]
+        sec_frames,     // FrameRecord[]
+        sec_pages,      // frame contents
+        sec_bp,         // branch predictor tables
+        sec_ras,        // return address stack
+        sec_max,
+    } section_id;
+
+    typedef enum
+    {
+        enc_clean,      // not written since the workload was mapped, no data
+        enc_zero,       // all zero, no data
+        enc_raw,        // bytes_used bytes
+        enc_rle,        // zero run length encoded, see rle_encode
+    } frame_encoding;
+
+    struct Header
+    {
+        u32  magic;
+        u32  version;
+        u32  sections;
+        u32  page_size;
+        u8   frontend;  // frontends
+        u8   pad[7];
+        char bp[48];    // predictor name, has to match on restore
+    }; // Header
+
+    struct Section
+    {
+        u32 id;
+        u32 pad;
+        u64 offset;     // from file start
+        u64 size;
+    }; // Section
+
+    struct PageRecord
+    {
+        u64 vaddr;
+        u64 frameno;
+        u8  present;
+        i8  pl;
+        u8  rwx;
+        u8  pad[5];
+    }; // PageRecord
+
+    struct FrameRecord
+    {
+        u64 paddr;
+        u64 bytes_used;
+        u64 offset;     // into sec_pages
+        u32 size;       // encoded bytes
+        i8  pl;
+        u8  rwx;
+        u8  enc;        // frame_encoding
+        u8  pad;
+    }; // FrameRecord
+
+    template<class T>
+    void put(std::ostream& os, const T& val)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        os.write((const char*)&val, sizeof(T));
+    }
+
+    template<class T>
+    void get(std::istream& is, T& val)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if(!is.read((char*)&val, sizeof(T))) throw CheckpointException();
+    }
+
+    // sections are collected in memory, write lays them out
+    class Writer
+    {
+        public:
+        std::stringstream& section(u8 id) { return secs.at(id); };
+        void               write(const string& path, Header hdr);
+
+        private:
+        std::array<std::stringstream, sec_max> secs;
+    }; // Writer
+
+    // checkpoint file mapped read only
+    class Reader
+    {
+        public:
+        Reader(const string& path);
+        ~Reader();
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        const Header&      header() const { return *(const Header*)base; };
+        std::string_view   section(u8 id) const;  // empty if missing
+        std::istringstream stream(u8 id) const;
+
+        private:
+        const u8*      base;
+        size_t         len;
+        const Section* table;
+    }; // Reader
+
+    // [u16 zeros][u16 literal bytes][literals] until len bytes are covered
+    vector<u8> rle_encode(const u8* data, size_t len);
+    // 1 if in does not decode to exactly len bytes
+    u8         rle_decode(const u8* in, size_t inlen, u8* out, size_t len);
+} // ckpt
+
+#endif // SIM_CHECKPOINT_H
@@ -17,6 +17,10 @@ static_assert((__x86_64__));
 #define MAX_CYCLES      UINT64_MAX          // max cycles before halt, debug use
 #define UQUEUE_SIZE     128                 // number of uops in the uQueue
 #define SILENT_HALT     1                   // stop execution without exception if control runs into unmapped addrs
+#ifndef COUNT_ALLOCS
+#define COUNT_ALLOCS    0                   // count heap allocations made while simulating, x64 decode has to make none (make allocs)
+#endif
+#define ALLOC_WARMUP    10000               // cycles before allocations count, lazy setup happens here
 
 // memory config
 #define ADDR_SIZE       64                  // don't change this
@@ -40,6 +44,21 @@ static_assert((__x86_64__));
 #define STACK_START     0x100000
 #define STACK_SIZE      16384
 
+// sampled simulation
+#define SP_INTERVAL     1000000             // default instructions per interval
+#define SP_DIMS         15                  // BBVs are projected to this many dimensions before clustering
+#define SP_RUNS         5                   // k-means restarts, the clustering with the lowest error is kept
+#define SP_ITERS        100                 // max k-means iterations per run
+#define SM_UNIT         1000                // default measured instructions per window
+#define SM_WARM         2000                // default detailed warming before every window
+#define SM_ERROR        0.03                // default target relative error of the CPI
+#define SM_Z            3.0                 // confidence interval in standard deviations, 3: 99.7%
+
+// commit traces
+#define TRACE_FRAME     1048576             // encoded bytes per frame, one fills while the other is written
+#define TRACE_LZ_BITS   14                  // hash table size of the built-in codec
+#define TRACE_ZSTD_LEVEL 3
+
 
 // logging
 #define LOG_SIM_INIT    1                   // log parameters
@@ -0,0 +1,183 @@
+// o3 RISC simulator
+//
+// runtime configuration
+// - presets
+// - config file parser
+//
+// Lukas Heine 2021
+
+#include <algorithm>
+#include <fstream>
+
+#include "config.hh"
+#include "util.hh"
+
+namespace config
+{
+
+// parameter name -> field, sections match the config structs
+struct ParamInfo
+{
+    const char* name;
+    u32* (*field)(SimConfig& cfg);
+};
+
+#define PARAM(sect, f) { #sect "." #f, [](SimConfig& cfg) -> u32* { return &cfg.sect.f; } }
+
+static const ParamInfo params[] =
+{
+    PARAM(core, decode_width),   PARAM(core, decode_latency), PARAM(core, id_ra_size),
+    PARAM(core, alloc_width),    PARAM(core, alloc_latency),  PARAM(core, rob_size),
+    PARAM(core, issue_width),    PARAM(core, issue_latency),  PARAM(core, issue_depth),
+    PARAM(core, wb_latency),     PARAM(core, commit_width),   PARAM(core, br_checkpoints),
+    PARAM(core, br_miss_penalty),PARAM(core, load_width),     PARAM(core, lq_size),
+    PARAM(core, gp_rnreg),       PARAM(core, fp_rnreg),       PARAM(core, vr_rnreg),
+    PARAM(fe,   fetch_width),    PARAM(fe,   fetch_latency),  PARAM(fe,   uqueue_size),
+    PARAM(fe,   iqueue_size),    PARAM(fe,   ftq_size),       PARAM(fe,   ftq_block_mops),
+    PARAM(fe,   msrom_width),    PARAM(fe,   msrom_penalty),  PARAM(fe,   lsd_width),
+    PARAM(fe,   replay_width),   PARAM(fe,   replay_penalty),
+    PARAM(mem,  ld_latency),     PARAM(mem,  st_latency),
+};
+
+#undef PARAM
+
+u8 match(const CoreConfig& core)
+{
+    for(u8 i = 0; i < preset_runtime; i++)
+        if(core == core_presets[i]) return i;
+    return preset_runtime;
+}
+
+SimConfig preset(const string& name)
+{
+    for(u8 i = 0; i < preset_runtime; i++)
+        if(name == preset_names[i])
+        {
+            SimConfig cfg;
+            cfg.core = core_presets[i];
+            return cfg;
+        }
+
+    throw ConfigException("Unknown preset ", name, ".");
+}
+
+// "alu,agu,ld" -> fu mask
+static u8 parse_fus(const string& val, u16& mask)
+{
+    mask = 0;
+    std::stringstream ss(val);
+    for(string fu; std::getline(ss, fu, ',');)
+    {
+        fu.erase(0, fu.find_first_not_of(" \t"));
+        fu.erase(fu.find_last_not_of(" \t") + 1);
+
+        u8 t = fu_any;
+        for(u8 i = fu_ctrl; i <= fu_mul; i++)
+            if(fu == fu_type_str[i]) t = i;
+        if(t == fu_any) return 1;
+
+        mask |= FU(t);
+    }
+    return 0;
+}
+
+u8 set(SimConfig& cfg, const string& key, const string& val)
+{
+    // flags
+    if(key == "core.move_elim" || key == "core.zero_idiom" || key == "fe.lsd_enable")
+    {
+        if(val != "0" && val != "1") return 1;
+        u8& f = (key == "core.move_elim") ? cfg.core.move_elim :
+               ((key == "core.zero_idiom") ? cfg.core.zero_idiom : cfg.fe.lsd_enable);
+        f = (val == "1");
+        return 0;
+    }
+
+    // core.portN = fu,fu,..
+    if(key.starts_with("core.port") && key.size() == 10 && key[9] >= '0' && key[9] < '0' + RS_PORTS)
+        return parse_fus(val, cfg.core.ports[key[9] - '0']);
+
+    for(const ParamInfo& p : params)
+        if(key == p.name)
+        {
+            char* end = nullptr;
+            u64 v = strtoull(val.c_str(), &end, 0);
+            if(val.empty() || *end || v > UINT32_MAX) return 1;
+
+            *p.field(cfg) = v;
+            return 0;
+        }
+
+    return 1;
+}
+
+void load(SimConfig& cfg, const string& path)
+{
+    std::ifstream file(path);
+    if(!file) throw ConfigException("Config file ", path, " could not be opened.");
+
+    u32 ln = 0;
+    for(string line; std::getline(file, line);)
+    {
+        ln++;
+        line = line.substr(0, line.find('#'));
+        line.erase(std::remove_if(line.begin(), line.end(), ::isspace), line.end());
+        if(line.empty()) continue;
+
+        size_t eq = line.find('=');
+        if(eq == string::npos || set(cfg, line.substr(0, eq), line.substr(eq + 1)))
+            throw ConfigException(path, ":", ln, ": invalid parameter \"", line, "\".");
+    }
+}
+
+void validate(const SimConfig& cfg)
+{
+    const CoreConfig&     c = cfg.core;
+    const FrontendConfig& f = cfg.fe;
+
+    auto check = [](bool ok, const char* what) { if(!ok) throw ConfigException("Invalid config: ", what, "."); };
+
+    check(c.decode_width && c.alloc_width && c.issue_width && c.commit_width && c.load_width, "widths have to be > 0");
+    check(c.rob_size && c.lq_size && c.id_ra_size && c.issue_depth, "queue sizes have to be > 0");
+    check(c.br_checkpoints >= 1 && c.br_checkpoints < 256, "1 <= core.br_checkpoints < 256");
+    check(c.gp_rnreg > REGCLS_0_CNT && c.gp_rnreg <= RNREG_MAX, "gp archregs < core.gp_rnreg <= 256");
+    check(c.fp_rnreg > REGCLS_1_CNT && c.fp_rnreg <= RNREG_MAX, "fp archregs < core.fp_rnreg <= 256");
+    check(c.vr_rnreg > REGCLS_2_CNT && c.vr_rnreg <= RNREG_MAX, "vr archregs < core.vr_rnreg <= 256");
+
+    check(f.fetch_width && f.uqueue_size && f.ftq_size && f.ftq_block_mops && f.lsd_width && f.replay_width,
+        "frontend sizes have to be > 0");
+    check(f.iqueue_size > X64_FETCH_BYTES, "fe.iqueue_size > X64_FETCH_BYTES");
+    check(f.uqueue_size > X64_MAX_UOPS, "fe.uqueue_size > X64_MAX_UOPS");
+    check(f.msrom_width >= 1 && f.msrom_width <= X64_CMPLX_UOPS, "1 <= fe.msrom_width <= X64_CMPLX_UOPS");
+}
+
+std::stringstream readable(const SimConfig& cfg)
+{
+    std::stringstream ss;
+    SimConfig tmp = cfg; // fields are looked up through non-const accessors
+
+    for(const ParamInfo& p : params)
+        ss << "        " << str_w<24> << p.name << dec_u<0> << *p.field(tmp) << "\n";
+
+    ss << "        " << str_w<24> << "core.move_elim"  << +cfg.core.move_elim  << "\n";
+    ss << "        " << str_w<24> << "core.zero_idiom" << +cfg.core.zero_idiom << "\n";
+    ss << "        " << str_w<24> << "fe.lsd_enable"   << +cfg.fe.lsd_enable   << "\n";
+
+    for(u8 i = 0; i < RS_PORTS; i++)
+    {
+        ss << "        core.port" << +i << "               ";
+        for(u8 t = fu_ctrl, first = 1; t <= fu_mul; t++)
+            if(cfg.core.ports[i] & FU(t))
+            {
+                ss << (first ? "" : ",") << fu_type_str[t];
+                first = 0;
+            }
+        ss << "\n";
+    }
+
+    ss << "        preset                  " << ((match(cfg.core) == preset_runtime) ? "none" :
+        preset_names[match(cfg.core)]) << "\n";
+    return ss;
+}
+
+} // config
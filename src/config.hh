@@ -0,0 +1,162 @@
+// o3 RISC simulator
+//
+// runtime configuration
+// - core, frontend and memory parameters
+// - named presets
+// - config files and overrides
+//
+// Lukas Heine 2021
+
+#ifndef SIM_CONFIG_H
+#define SIM_CONFIG_H
+
+#include <array>
+
+#include "types.hh"
+#include "util.hh"
+#include "conf.hh"
+#include "core/uops.hh"
+
+// fu_type -> port mask bit
+#define FU(t)           (1 << (t))
+
+// defaults are taken from cconf.hh
+struct CoreConfig
+{
+    u32 decode_width    = DECODE_WIDTH;
+    u32 decode_latency  = DECODE_LATENCY;
+    u32 id_ra_size      = ID_RA_SIZE;
+    u32 alloc_width     = ALLOC_WIDTH;
+    u32 alloc_latency   = ALLOC_LATENCY;
+    u32 rob_size        = ROB_SIZE;
+    u32 issue_width     = ISSUE_WIDTH;
+    u32 issue_latency   = ISSUE_LATENCY;
+    u32 issue_depth     = ISSUE_DEPTH;
+    u32 wb_latency      = WB_LATENCY;
+    u32 commit_width    = COMMIT_WIDTH;
+    u32 br_checkpoints  = BR_CHECKPOINTS;
+    u32 br_miss_penalty = BR_MISS_PENALTY;
+    u32 load_width      = LOAD_WIDTH;
+    u32 lq_size         = LQUEUE_SIZE;
+    u32 gp_rnreg        = REGCLS_0_RNREG;   // physical registers in use, <= RNREG_MAX
+    u32 fp_rnreg        = REGCLS_1_RNREG;
+    u32 vr_rnreg        = REGCLS_2_RNREG;
+    u8  move_elim       = ALLOC_MOVE_ELIM;
+    u8  zero_idiom      = ALLOC_ZERO_IDIOM;
+
+    // FUs attached to each RS port (FU(fu_type) mask), port count is fixed by the uop port masks
+    std::array<u16, RS_PORTS> ports =
+    {
+        FU(fu_alu) | FU(fu_div) | FU(fu_brch) | FU(fu_ctrl),
+        FU(fu_alu) | FU(fu_mul),
+        FU(fu_alu) | FU(fu_agu),
+        FU(fu_alu) | FU(fu_brch) | FU(fu_ctrl),
+        FU(fu_agu) | FU(fu_ld),
+        FU(fu_agu) | FU(fu_ld),
+        FU(fu_st),
+        FU(fu_agu),
+    };
+
+    bool operator==(const CoreConfig&) const = default;
+}; // CoreConfig
+
+// defaults are taken from fconf.hh/conf.hh
+struct FrontendConfig
+{
+    u32 fetch_width     = FETCH_WIDTH;      // RISC only
+    u32 fetch_latency   = FETCH_LATENCY;
+    u32 uqueue_size     = UQUEUE_SIZE;
+    u32 iqueue_size     = IQUEUE_SIZE;      // x64 only
+    u32 ftq_size        = FTQ_SIZE;
+    u32 ftq_block_mops  = FTQ_BLOCK_MOPS;
+    u32 msrom_width     = X64_MSROM_WIDTH;
+    u32 msrom_penalty   = X64_MSROM_PENALTY;
+    u32 lsd_width       = LSD_WIDTH;
+    u8  lsd_enable      = LSD_ENABLE;
+    u32 replay_width    = REPLAY_WIDTH;     // trace replay only
+    u32 replay_penalty  = REPLAY_PENALTY;   // ..
+
+    bool operator==(const FrontendConfig&) const = default;
+}; // FrontendConfig
+
+struct MemConfig
+{
+    u32 ld_latency      = MM_LD_LATENCY;
+    u32 st_latency      = MM_ST_LATENCY;
+
+    bool operator==(const MemConfig&) const = default;
+}; // MemConfig
+
+struct SimConfig
+{
+    CoreConfig      core;
+    FrontendConfig  fe;
+    MemConfig       mem;
+}; // SimConfig
+
+// unknown keys or values, parameters that don't fit the simulator, unreadable config or grid files
+struct ConfigException : public MessageException
+{
+    using MessageException::MessageException;
+}; // ConfigException
+
+namespace config
+{
+    // presets get their own specialization of the core pipeline, everything else runs with runtime parameters
+    typedef enum
+    {
+        preset_default,
+        preset_small,
+        preset_wide,
+        preset_runtime,
+    } preset_id;
+
+    constexpr CoreConfig small_core()
+    {
+        CoreConfig c;
+        c.decode_width = c.alloc_width = c.commit_width = 4;
+        c.id_ra_size   = 4;
+        c.issue_width  = 6;
+        c.issue_depth  = 48;
+        c.rob_size     = c.lq_size = 128;
+        c.gp_rnreg     = 128;
+        c.load_width   = 2;
+        c.br_checkpoints = 8;
+        return c;
+    }
+
+    constexpr CoreConfig wide_core()
+    {
+        CoreConfig c;
+        c.decode_width = c.alloc_width = c.commit_width = 8;
+        c.id_ra_size   = 8;
+        c.issue_width  = 10;
+        c.issue_depth  = 160;
+        c.rob_size     = c.lq_size = 352;
+        c.gp_rnreg     = 255;
+        c.fp_rnreg     = 128;
+        c.vr_rnreg     = 192;
+        c.br_checkpoints = 32;
+        return c;
+    }
+
+    inline constexpr std::array<const char*, preset_runtime> preset_names = { "default", "small", "wide" };
+    inline constexpr std::array<CoreConfig, preset_runtime>  core_presets = { CoreConfig(), small_core(), wide_core() };
+
+    // preset with these core parameters, preset_runtime if there is none
+    u8          match(const CoreConfig& core);
+
+    // start from a named preset, throws on unknown names
+    SimConfig   preset(const string& name);
+
+    // "key = value" lines, '#' starts a comment
+    void        load(SimConfig& cfg, const string& path);
+    // single "key=value" override, returns 1 on unknown keys or values
+    u8          set(SimConfig& cfg, const string& key, const string& val);
+    // throws if parameters don't fit the compiled structures
+    void        validate(const SimConfig& cfg);
+
+    std::stringstream readable(const SimConfig& cfg);
+} // config
+
+#endif // SIM_CONFIG_H
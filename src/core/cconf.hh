@@ -7,6 +7,7 @@
 #ifndef SIM_CCONF_H
 #define SIM_CCONF_H
 
+// defaults for CoreConfig (config.hh), pipeline widths and sizes can be changed at runtime
 // widths and sizes should match if a 'true' latch behavior (in = out) is expected
 #define DECODE_WIDTH    6                   // instructions decoded each cycle
 #define DECODE_LATENCY  1                   // amount of cycles until instruction gets placed into uqueue
@@ -15,6 +16,8 @@
 #define ALLOC_WIDTH     6                   // alloc'd each cycle
 #define ALLOC_LATENCY   1                   // latency before uop gets added to ROB
 #define ROB_SIZE        224                 // uops in ROB
+#define ALLOC_MOVE_ELIM 1                   // eliminate full width register moves at rename
+#define ALLOC_ZERO_IDIOM 1                  // execute zeroing idioms (xor/sub r, r, set r, 0) at rename
 
 #define ISSUE_WIDTH     8                   // issued each cycle
 #define ISSUE_LATENCY   0                   // latency before uop is ready to execute
@@ -24,6 +27,10 @@
 
 #define COMMIT_WIDTH    6                   // max commits per cycle
 
+#define BR_CHECKPOINTS  16                  // rename map checkpoints for in flight branches
+#define BR_RESOLVE_EXEC 1                   // resolve branches at execute (0: at commit)
+#define BR_MISS_PENALTY 3                   // cycles until fetch restarts after a mispredict
+
 // functional units
 #define RS_PORTS        8                   // ports from which uops are issued
 
@@ -51,6 +58,8 @@
 #define REGCLS_2_CNT    32
 #define REGCLS_2_RNREG  128
 
+#define RNREG_MAX       256                 // physical register capacity per class (uop.regs is u8)
+
 // condition registers
 #define CCREG_SIZE      8                   // rflags
 #define CCREG_CNT       32                  // condition regs are not renamed
@@ -69,9 +78,11 @@
 static_assert(COMMIT_MACRO == 0);           // still needs work
 static_assert(FAST_EXCEPT  == 1);           // no handlers yet
 
+static_assert(BR_CHECKPOINTS >= 1 && BR_CHECKPOINTS < 256);
 static_assert(REGCLS_0_SIZE  >= 2);
 static_assert(REGCLS_0_RNREG >= REGCLS_0_CNT, "Too few physical registers.");
 static_assert(REGCLS_1_RNREG >= REGCLS_1_CNT, "Too few physical registers.");
 static_assert(REGCLS_2_RNREG >= REGCLS_2_CNT, "Too few physical registers.");
+static_assert(REGCLS_0_RNREG <= RNREG_MAX && REGCLS_1_RNREG <= RNREG_MAX && REGCLS_2_RNREG <= RNREG_MAX);
 
 #endif
\ No newline at end of file
@@ -10,46 +10,62 @@
 //
 // Lukas Heine 2021
 
+#include <algorithm>
+
 #include "core.hh"
 #include "cconf.hh"
 
 #include "uops.hh"
+#include "../simpoint.hh"
+#include "../trace.hh"
 
 Core::Core(LatchQueue<uop>* uqueue, Simulator::SimulatorState& state, MemoryManager& mmu,
-    Frontend& fe) : uqueue(uqueue), state(state), mmu(mmu), fe(fe)
+    Frontend& fe, const CoreConfig& cfg) : cfg(cfg), preset(config::match(cfg)), uqueue(uqueue), state(state),
+    mmu(mmu), fe(fe), rs(cfg), chk(cfg.br_checkpoints)
+{
+    init_rename();
+
+    id_ra = new LatchQueue<uop>(cfg.id_ra_size + cfg.decode_width);
+    rob   = new LatchQueue<ROBEntry>(2 * (cfg.rob_size + cfg.alloc_width));
+    ldq   = new LatchQueue<ROBEntry*>(cfg.lq_size + cfg.alloc_width);
+
+    next_inactive = 0;
+
+    util::log(LOG_CORE_INIT, "Core initialized with:");
+    util::log(LOG_CORE_INIT, "        Decode width: ", dec_u<0>, cfg.decode_width);
+    util::log(LOG_CORE_INIT, "        Alloc  width: ", dec_u<0>, cfg.alloc_width);
+    util::log(LOG_CORE_INIT, "        Issue  width: ", dec_u<0>, cfg.issue_width);
+    util::log(LOG_CORE_INIT, "        Commit width: ", dec_u<0>, cfg.commit_width);
+    util::log(LOG_CORE_INIT, "        ROB size:     ", dec_u<0>, cfg.rob_size);
+    util::log(LOG_CORE_INIT, "        Preset:       ", ((preset == config::preset_runtime) ? "none" :
+        config::preset_names[preset]));
+    util::log(LOG_CORE_INIT, "");
+}
+
+// nothing renamed, all physical registers (except r0) are available
+void Core::init_rename()
 {
     RenameTable trt = { 
         {0}, {0}, {0}, // forward lookup (allocated)
         {0}, {0}, {0}, // forward lookup (commited)
         {0}, {0}, {0}, // reverse lookup
+        {0}, {0}, {0}, // alias counts
         std::deque<u8>(), std::deque<u8>(), std::deque<u8>(), std::deque<u8>(), std::deque<u8>(),
     };
     rrt = trt;
 
-    // init free lists, all physical registers (except r0) are available
-    for(u16 i = 1; i < REGCLS_0_RNREG; i++) rrt.gp_freelist.push_back(i);
-    for(u16 i = 1; i < REGCLS_1_RNREG; i++) rrt.fp_freelist.push_back(i);
-    for(u16 i = 1; i < REGCLS_2_RNREG; i++) rrt.vr_freelist.push_back(i);
-    for(u16 i = 1; i < CCREG_CNT;      i++) rrt.cc_freelist.push_back(i);
-
-    id_ra = new LatchQueue<uop>(ID_RA_SIZE + DECODE_WIDTH);
-    rob   = new LatchQueue<ROBEntry>(ROB_SIZE + ALLOC_WIDTH);
-    ldq   = new LatchQueue<ROBEntry*>(LQUEUE_SIZE + ALLOC_WIDTH);
-
-    next_inactive = 0;
+    // init free lists
+    for(u16 i = 1; i < cfg.gp_rnreg; i++) rrt.gp_freelist.push_back(i);
+    for(u16 i = 1; i < cfg.fp_rnreg; i++) rrt.fp_freelist.push_back(i);
+    for(u16 i = 1; i < cfg.vr_rnreg; i++) rrt.vr_freelist.push_back(i);
+    for(u16 i = 1; i < CCREG_CNT;    i++) rrt.cc_freelist.push_back(i);
 
-    util::log(LOG_CORE_INIT, "Core initialized with:");
-    util::log(LOG_CORE_INIT, "        Decode width: ", dec_u<0>, DECODE_WIDTH);
-    util::log(LOG_CORE_INIT, "        Alloc  width: ", dec_u<0>, ALLOC_WIDTH);
-    util::log(LOG_CORE_INIT, "        Issue  width: ", dec_u<0>, ISSUE_WIDTH);
-    util::log(LOG_CORE_INIT, "        Commit width: ", dec_u<0>, COMMIT_WIDTH);
-    util::log(LOG_CORE_INIT, "");
+    chk_freelist.clear();
+    for(u16 i = 0; i < cfg.br_checkpoints; i++) chk_freelist.push_back(i);
 }
 
 Core::~Core()
 {
-    delete state.arf;
-
     delete id_ra;
     delete rob;
     delete ldq;
@@ -57,6 +73,18 @@ Core::~Core()
 
 // one complete backend cycle
 u32 Core::cycle()
+{
+    switch(preset)
+    {
+        case config::preset_default: return run_cycle<config::preset_default>();
+        case config::preset_small:   return run_cycle<config::preset_small>();
+        case config::preset_wide:    return run_cycle<config::preset_wide>();
+        default:                     return run_cycle<config::preset_runtime>();
+    }
+}
+
+template<u8 P>
+u32 Core::run_cycle()
 {
     mmu.refresh();
 
@@ -70,11 +98,11 @@ u32 Core::cycle()
     // util::log(LOG_STATE_PRE, "Functional Units:\n", rs);
     util::log(LOG_STATE_PRE, "ROB:\n", rob_readable(8).str());
 
-    decode();
-    alloc();
-    issue();
-    execute();
-    commit();
+    decode<P>();
+    alloc<P>();
+    issue<P>();
+    execute<P>();
+    commit<P>();
 
     // util::log(LOG_STATE_POST, "Functional Units:\n", rs);
     util::log(LOG_STATE_POST, "ROB:\n", rob_readable(8).str());
@@ -88,38 +116,58 @@ u32 Core::cycle()
 
 // clear latches, iterators and statuses
 u8 Core::flush()
+{
+    clear_pipeline();
+    state.flushes++;
+
+    return 0;
+}
+
+// same as flush, but not counted, mode switches go through here via sync_arf
+u8 Core::clear_pipeline()
 {
     std::deque<u8>* cur_freelist = nullptr;
+    u8*             cur_refs     = nullptr;
 
     // free all allocated physical registers
     for(u16 i = 0; i < rob->size(); i++)
     {
-        switch(getOpPrefix(rob->at(UINT64_MAX, i).op))
+        ROBEntry& re = rob->at(UINT64_MAX, i);
+
+        switch(getOpPrefix(re.op))
         {
             default:
             case 0x0: // control
             case 0x1: // alu
                 cur_freelist = &rrt.gp_freelist;
+                cur_refs     = rrt.gp_refs;
                 break;
             case 0x2: // fpu
                 cur_freelist = &rrt.fp_freelist;
+                cur_refs     = rrt.fp_refs;
                 break;
             case 0x3: // vec int
             case 0x4: // vec float
                 cur_freelist = &rrt.vr_freelist;
+                cur_refs     = rrt.vr_refs;
                 break;
         }
         // todo make a commit free list instead of searching ROB
-        if(rob->at(UINT64_MAX, i).op.regs[r_rd])
-            cur_freelist->push_back(rob->at(UINT64_MAX, i).op.regs[r_rd]);
+        if(re.op.regs[r_rd])
+            free_preg(cur_freelist, cur_refs, re.op.regs[r_rd]);
+        if(re.elim_rc)
+            free_preg(cur_freelist, cur_refs, re.op.regs[r_rc]);
     }
 
     // reset rename tables to commited state
     // this might be a problem when resetting late? idk needs to be tested, might need to copy register contents
     std::memcpy(rrt.gp, rrt.gc, REGCLS_0_CNT);
-    std::memcpy(rrt.fp, rrt.fc, REGCLS_0_CNT);
-    std::memcpy(rrt.vr, rrt.vc, REGCLS_0_CNT);
+    std::memcpy(rrt.fp, rrt.fc, REGCLS_1_CNT);
+    std::memcpy(rrt.vr, rrt.vc, REGCLS_2_CNT);
 
+    // no branch is in flight anymore
+    chk_freelist.clear();
+    for(u16 i = 0; i < cfg.br_checkpoints; i++) chk_freelist.push_back(i);
 
     // or reset to last commited condition?
     rrt.cc_freelist.clear();
@@ -129,7 +177,9 @@ u8 Core::flush()
     uqueue->clear();
     id_ra->clear();
     rob->clear();
+    rob_fused = 0;
     ldq->clear();
+    tr_ops.clear();
 
     // reset instruction trace
     state.in_flight.erase((state.in_flight.begin() + 1), state.in_flight.end());
@@ -151,16 +201,129 @@ u8 Core::flush()
     }
 
     fe.flush();
+    fe.bp->flush();
+    if(fe.ras) fe.ras->recover(state.commited_macro);
 
-    state.flushes++;
+    return 0;
+}
+
+// drop the pipeline and all renamed registers, the ARF is the only copy of the architectural state afterwards
+u8 Core::sync_arf()
+{
+    clear_pipeline();
+    init_rename();
+
+    // condition register 0 is never allocated, uops read it until the first cc is set
+    prf.cc[0] = state.arf->cc;
 
     return 0;
 }
 
-// 'decode' DECODE_WIDTH uops from uQ into pipeline latch
+// functional mode: no ROB, RS or latches, uops of one macro op are executed in order on the ARF
+// - stops after insts macro ops, at pc or when the next macro op can't be decoded (left to fetch)
+// - branches train the predictor and RAS as if they committed, there are no cycles and no mispredicts
+// - prof sees every retired macro op
+// - uncommitted ops of a detailed run are dropped on entry and refetched afterwards, nothing is drained twice
+// returns the executed macro ops
+u64 Core::fast_forward(u64 insts, u64 pc, simpoint::Profiler* prof)
+{
+    mmu.drain();
+    sync_arf();
+
+    vector<uop> uops;
+    u64         rip = state.in_flight.front();
+    u64         n   = 0;
+
+    for(; (n < insts) && (rip != pc); n++)
+    {
+        u64 seq_no = state.commited_macro + state.ff_macro;
+        u64 seq    = 0;
+        u64 pred   = 0;
+
+        uops.clear();
+        if(fe.decode_at(rip, seq_no, uops, seq, pred)) break;
+
+        u64 next   = seq;
+        u64 target = 0;
+        u8  branch = 0;
+        u8  taken  = 0;
+        u8  kind   = bk_direct;
+
+        for(uop& op : uops)
+        {
+            ROBEntry re   = zero_re;
+            re.op         = op;
+            re.mref.vaddr = seq; // rip-relative operands
+
+            switch(getOpClassId(re.op))
+            {
+                default:
+                case regs_gp: run_functional<REGCLS_0_SIZE>(re, state.arf->gp, prf.gp); break;
+                case regs_fp: run_functional<REGCLS_1_SIZE>(re, state.arf->fp, prf.fp); break;
+                case regs_vr: run_functional<REGCLS_2_SIZE>(re, state.arf->vr, prf.vr); break;
+            }
+
+            if(re.except)
+            {
+                util::log(LOG_CORE_PIPE1, "FF__:   Exception ", getExceptNum(re.except), " ",
+                    exception_str[getExceptNum(re.except)], " at v.", hex_u<64>, rip, ".");
+                state.active    = 0;
+                state.exception = re.except;
+                break;
+            }
+
+            if(is_branch(re.op) && (re.mref.mode == MM::mr_branch))
+            {
+                branch = 1;
+                target = re.mref.vaddr;
+                taken  = (re.mref.size != UINT64_MAX);
+                kind   = is_indirect(re.op) ? bk_indirect : bk_direct;
+                if(taken) next = target;
+            }
+
+            state.ff_micro++;
+        }
+
+        state.arf->cc = prf.cc[0];
+        if(state.exception) break;
+
+        // same training as at commit, a wrong prediction is repaired right away
+        if(branch)
+        {
+            if(next != pred) fe.bp->recover(1, next, taken);
+            fe.bp->update(rip, target, taken, kind);
+        }
+        if(fe.ras)
+        {
+            fe.ras->verify(seq_no, next);
+            fe.ras->retire(seq_no + 1);
+        }
+
+        util::log(LOG_CORE_PIPE2, "FF__:   v.", hex_u<64>, rip, " -> v.", hex_u<64>, next);
+        if(prof) prof->retire(rip, branch);
+
+        state.ff_macro++;
+        rip = next;
+    }
+
+    // fetch resumes at the reached rip
+    state.arf->ip.write<u64>(rip);
+    state.in_flight = { rip };
+    state.seq_addrs.clear();
+    sync_arf();
+    fe.set_fetchaddr(rip);
+    if(!state.exception) state.active = fe_active | core_active;
+
+    return n;
+}
+
+// 'decode' decode_width uops from uQ into pipeline latch
 // > check #UD and look up opcode mnemonics
+template<u8 P>
 u32 Core::decode()
 {
+    const CoreConfig& c = params<P>();
+
     if(!id_ra->ready(state.cycle)) // latency condition not met
     {
         util::log(LOG_CORE_PIPE1, "ID__:   Decode busy.\n");
@@ -179,9 +342,9 @@ u32 Core::decode()
     u16*         cur_ctrl;
 
     // iterate decode slots
-    for(u32 slot = 0; slot < DECODE_WIDTH; slot++)
+    for(u32 slot = 0; slot < c.decode_width; slot++)
     {
-        if(id_ra->size() >= ID_RA_SIZE + DECODE_WIDTH)
+        if(id_ra->size() >= c.id_ra_size + c.decode_width)
         {
             util::log(LOG_CORE_PIPE1, "ID__: * ID/RA latch is full. Not decoding any instructions.");
             break;
@@ -199,11 +362,11 @@ u32 Core::decode()
             cur_info =  uopmap.at(cur_op.opcode);
             cur_ctrl =  &cur_op.control;
 
-            // invalid control bits set
-            if( (*cur_ctrl | cur_info.ctrl_mask) != cur_info.ctrl_mask )
+            // invalid control bits set, fusion is set by the frontend
+            if( ((*cur_ctrl & ~fuse_next) | cur_info.ctrl_mask) != cur_info.ctrl_mask )
             { // always do this? shouldn't change anything
                 util::log(LOG_CORE_PIPE2, "ID.", dec_u<0>, slot, ": * Invalid control bits detected, bits merged with mask.");
-                *cur_ctrl &= cur_info.ctrl_mask;
+                *cur_ctrl &= (cur_info.ctrl_mask | fuse_next);
             }
 
             // rc is either source or destination
@@ -257,16 +420,53 @@ u32 Core::decode()
         }
 
         // no need to catch exceptions here since size is already checked
-        id_ra->push_back((state.cycle + DECODE_LATENCY), cur_op);
+        id_ra->push_back((state.cycle + c.decode_latency), cur_op);
     }
 
     util::log(5, "");
     return 1;
 }
 
+// uops which can be handled by renaming alone, gp only
+// - full width moves: destinations are mapped to the source pregs
+// - xor/sub r, r: result is zero, no matter the source (32 bit results are zero extended)
+// - set r, 0: same for an immediate zero
+static u8 eliminable(uop& op, u8 move_elim, u8 zero_idiom)
+{
+    if(getOpClassId(op) != regs_gp) return elim_none;
+
+    u16 ctrl = op.control;
+    u8  opsz = getOpSize(op);
+
+    // resize doesn't matter for 64 bit operations, copy2 always copies entire registers
+    if(move_elim && op.regs[r_rd] && !(ctrl & (set_cond | use_cond | rd_extend)))
+    {
+        if((op.opcode == uop_move) && (opsz == 8) && (ctrl & use_rb) && !(ctrl & rc_dest))
+            return elim_move;
+
+        if(((op.opcode == uop_copy2) || ((op.opcode == uop_xchg) && (opsz == 8))) &&
+           ((ctrl & (use_ra | use_rb | rc_dest)) == (use_ra | use_rb | rc_dest)) && op.regs[r_rc])
+            return elim_move;
+    }
+
+    if(zero_idiom && op.regs[r_rd] && ((op.opcode == uop_xor) || (op.opcode == uop_sub)) &&
+       ((ctrl & (use_ra | use_rb | use_rc | use_imm | rc_dest | use_cond)) == (use_ra | use_rb)) &&
+       (op.regs[r_ra] == op.regs[r_rb]) && (opsz >= 4))
+        return elim_zero;
+
+    if(zero_idiom && op.regs[r_rd] && (op.opcode == uop_set) && !op.imm &&
+       !(ctrl & (use_ra | use_rb | use_rc | rc_dest | use_cond | set_cond)) && (opsz >= 4))
+        return elim_zero;
+
+    return elim_none;
+}
+
 // rename registers and allocate/fill ROB entries
+template<u8 P>
 u32 Core::alloc()
 {
+    const CoreConfig& c = params<P>();
+
     if(next_inactive & ra_active) state.active &= ~ra_active;
     if( !(state.active & ra_active) )
     {
@@ -280,9 +480,10 @@ u32 Core::alloc()
         return 1;
     }
 
-    for(u32 slot = 0; slot < ALLOC_WIDTH; slot++)
+    // both uops of a fused pair go through the same slot
+    for(u32 slot = 0, pairs = 0; slot < c.alloc_width + pairs; slot++)
     {
-        if(rob->size() >= ROB_SIZE + ALLOC_WIDTH)
+        if(rob->size() - rob_fused >= c.rob_size + c.alloc_width)
         {
             util::log(LOG_CORE_PIPE1, "RA__: * No available ROB slots. Not allocating RRT/ROB entries.");
             break;
@@ -303,6 +504,7 @@ u32 Core::alloc()
             std::deque<u8>* cur_freelist = nullptr;
             u8*             cur_rrt      = nullptr;
             u8*             cur_trr      = nullptr;
+            u8*             cur_refs     = nullptr;
             void*           cur_prf      = nullptr; 
             void*           cur_arf      = nullptr;
             size_t          cur_regsz    = 0;
@@ -315,6 +517,7 @@ u32 Core::alloc()
                     cur_freelist = &rrt.gp_freelist;
                     cur_rrt   = rrt.gp;
                     cur_trr   = rrt.pg;
+                    cur_refs  = rrt.gp_refs;
                     cur_prf   = prf.gp;
                     cur_arf   = state.arf->gp;
                     cur_regsz = REGCLS_0_SIZE;
@@ -323,6 +526,7 @@ u32 Core::alloc()
                     cur_freelist = &rrt.fp_freelist;
                     cur_rrt   = rrt.fp;
                     cur_trr   = rrt.pf;
+                    cur_refs  = rrt.fp_refs;
                     cur_prf   = prf.fp;
                     cur_arf   = state.arf->fp;
                     cur_regsz = REGCLS_1_SIZE;
@@ -332,6 +536,7 @@ u32 Core::alloc()
                     cur_freelist = &rrt.vr_freelist;
                     cur_rrt   = rrt.vr;
                     cur_trr   = rrt.rv;
+                    cur_refs  = rrt.vr_refs;
                     cur_prf   = prf.vr;
                     cur_arf   = state.arf->vr;
                     cur_regsz = REGCLS_2_SIZE;
@@ -367,14 +572,23 @@ u32 Core::alloc()
                 cur_op_peek->control &= ~use_cond; // discard condition dependence
             }
 
-            if(is_load(*cur_op_peek) && ldq->size() >= LQUEUE_SIZE + ALLOC_WIDTH)
+            if(is_load(*cur_op_peek) && ldq->size() >= c.lq_size + c.alloc_width)
             {
                 util::log(LOG_CORE_PIPE1, "RA.", dec_u<0>, slot, ": * LoadQ is full. Pipeline stalled.");
                 break;
             }
 
+            // branches ending a macro op can be resolved at execute, those need a map checkpoint
+            if(BR_RESOLVE_EXEC && is_branch(*cur_op_peek) && (cur_op_peek->control & mop_last) &&
+                chk_freelist.empty())
+            {
+                util::log(LOG_CORE_PIPE1, "RA.", dec_u<0>, slot, ": * No rename checkpoint available. Pipeline stalled.");
+                break;
+            }
+
             // resources available, take uop from latch
             uop cur_op = id_ra->get_front(state.cycle);
+            if(tracer) [[unlikely]] tr_ops.push_back(cur_op);
 
             // actual renaming
             // - rename sources according to forward rrt to carry over true dependences
@@ -384,6 +598,14 @@ u32 Core::alloc()
             u8 rc = (cur_op.control & rc_dest) ? cur_op.regs[r_rc] : 0;
             u8 rd = cur_op.regs[r_rd];
 
+            // moves don't need a destination, zeroing idioms don't depend on their sources
+            u8 elim = eliminable(cur_op, c.move_elim, c.zero_idiom);
+            if(elim == elim_zero)
+            {
+                cur_op.control &= ~(use_ra | use_rb);
+                cur_op.regs[r_ra] = cur_op.regs[r_rb] = 0;
+            }
+
             u8 ccu = (cur_op.control & use_cond) ? rrt.cc_lastused.back() : 0;
             if(ccu) util::log(LOG_CORE_PIPE2, "RA.", dec_u<0>, slot, ":     Condition register ", dec_u<0>, +ccu, " used.");
             u8 ccs = (cur_op.control & set_cond) ? rrt.cc_freelist.front() : 0;
@@ -393,12 +615,13 @@ u32 Core::alloc()
                 rrt.cc_freelist.pop_front();
                 util::log(LOG_CORE_PIPE2, "RA.", dec_u<0>, slot, ":     Condition register ", dec_u<0>, +ccs, " set.");
             }
-            u8 phregc = (rc ? cur_freelist->front() : 0);
-            if(rc) cur_freelist->pop_front();
-            u8 phregd = (rd ? cur_freelist->front() : 0);
-            if(rd) cur_freelist->pop_front();
+            u8 phregc = ((rc && (elim != elim_move)) ? cur_freelist->front() : 0);
+            if(phregc) cur_freelist->pop_front();
+            u8 phregd = ((rd && (elim != elim_move)) ? cur_freelist->front() : 0);
+            if(phregd) cur_freelist->pop_front();
 
             // check source registers
+            u8 ld_mask = 0;
             for(u8 sreg = 0; sreg < 3; sreg++)
                 // not r0 and register is actually used
                 if(cur_op.regs[sreg] && (cur_op.control & (use_ra << sreg)))
@@ -427,13 +650,25 @@ u32 Core::alloc()
                             " renamed to p", dec_u<0>, +loadreg, ".");
                         cur_op.regs[sreg] = loadreg;
                         cur_freelist->pop_front();
+                        ld_mask |= (use_ra << sreg);
                     }
                 }
 
+            // rd <- rb, rc <- ra: destinations share the renamed sources
+            if(elim == elim_move)
+            {
+                phregd = cur_op.regs[r_rb];
+                phregc = rc ? cur_op.regs[r_ra] : 0;
+                cur_refs[phregd]++;
+                if(phregc) cur_refs[phregc]++;
+                util::log(LOG_CORE_PIPE2, "RA.", dec_u<0>, slot, ":     Move eliminated.");
+                state.moves_eliminated++;
+            }
+
             if(rc)
             {
                 cur_rrt[rc] = phregc;
-                cur_trr[phregc] = rc;
+                if(elim != elim_move) cur_trr[phregc] = rc;
                 util::log(LOG_CORE_PIPE2, "RA.", dec_u<0>, slot, ":     Dst r", dec_u<0>, +cur_op.regs[2], " renamed to p", dec_u<0>,
                      +phregc, ".");
                 cur_op.regs[r_rc] = phregc;
@@ -443,17 +678,53 @@ u32 Core::alloc()
             if(rd)
             {
                 cur_rrt[rd] = phregd;
-                cur_trr[phregd] = rd;
+                if(elim != elim_move) cur_trr[phregd] = rd;
                 util::log(LOG_CORE_PIPE2, "RA.", dec_u<0>, slot, ":     Dst r", dec_u<0>, +cur_op.regs[3], " renamed to p", dec_u<0>,
                     +phregd, ".");
                 cur_op.regs[r_rd] = phregd;
             }
+
+            if(elim == elim_zero)
+            {
+                std::memset((void*)((uptr)cur_prf + cur_regsz * phregd), 0, cur_regsz);
+                if(ccs)
+                {   // same flags as the executed uop
+                    u64 acc   = 0;
+                    u64 flags = 0;
+                    if(cur_op.opcode == uop_xor) asm("xor %[acc], %[acc];" getx64flags
+                        : [acc]"+r"(acc), [ccs]"=rm"(flags));
+                    else asm("sub %[acc], %[acc];" getx64flags
+                        : [acc]"+r"(acc), [ccs]"=rm"(flags));
+                    set_cc(ccs, flags);
+                }
+                util::log(LOG_CORE_PIPE2, "RA.", dec_u<0>, slot, ":     Zeroing idiom executed.");
+                state.zero_idioms++;
+            }
             
             MM::MemoryRef mref = MM::zero_mref;
+            u8            chkpt = 0;
+            u64           pred  = 0;
 
             if(is_branch(cur_op))
+            {
                 mref.mode  = MM::mr_branch;
 
+                // save the alloc maps including this uop, younger uops are discarded on mispredict
+                if(BR_RESOLVE_EXEC && (cur_op.control & mop_last))
+                {
+                    chkpt = chk_freelist.front() + 1;
+                    chk_freelist.pop_front();
+                    std::memcpy(chk[chkpt - 1].gp, rrt.gp, REGCLS_0_CNT);
+                    std::memcpy(chk[chkpt - 1].fp, rrt.fp, REGCLS_1_CNT);
+                    std::memcpy(chk[chkpt - 1].vr, rrt.vr, REGCLS_2_CNT);
+                    util::log(LOG_CORE_PIPE2, "RA.", dec_u<0>, slot, ":     Rename checkpoint ", +(chkpt - 1), " saved.");
+                }
+
+                // next rip the frontend continued at
+                if(state.in_flight.size() > seq_at_alloc + 1)
+                    pred = state.in_flight.at(seq_at_alloc + 1);
+            }
+
             // always add the sequential RIP here in case we need it for rip-relative calculations (only disp32)
             mref.vaddr = state.seq_addrs.empty() ? 0 : state.seq_addrs.at(seq_at_alloc);
 
@@ -463,8 +734,17 @@ u32 Core::alloc()
                 seq_at_alloc++;
             }
 
-            ROBEntry re = { mref, cur_op, commit_unavail, exec_waiting, ex_NONE, ccu, ccs};
-            rob->push_back((state.cycle + ALLOC_LATENCY), re);
+            // eliminated uops are done once they reach the ROB
+            ROBEntry re = { mref, cur_op, (elim ? (state.cycle + c.alloc_latency) : (u64)commit_unavail),
+                ex_NONE, (elim ? exec_running : exec_waiting), ccu, ccs, chkpt, ld_mask,
+                (u8)((elim == elim_move) ? rc : 0), (u8)((elim == elim_move) ? rd : 0),
+                (u8)!!(cur_op.control & fuse_next), pred, state.cycle };
+            rob->push_back((state.cycle + c.alloc_latency), re);
+            if(re.fused)
+            {
+                rob_fused++;
+                pairs++;
+            }
             
             util::log(LOG_CORE_PIPE1, "RA.", dec_u<0>, slot,":   Sent ", cur_op, " to ROB.");
 
@@ -498,8 +778,11 @@ u32 Core::alloc()
 
 // issue uops from ROB to available RS ports
 // one port can issue to one attached FU each cycle
+template<u8 P>
 u32 Core::issue()
 {
+    const CoreConfig& c = params<P>();
+
     // shut down backend since the ROB is empty and not expecting more uops
     if(next_inactive & is_active) state.active &= ~is_active & ~ex_active & ~co_active;
     if( !(state.active & is_active) )
@@ -523,7 +806,7 @@ u32 Core::issue()
     // - check condition dependences
     // - issue to available port and disable it for this cycle (plus latency)
 
-    for(u32 slot = 0; slot < ISSUE_WIDTH; slot++)
+    for(u32 slot = 0; slot < c.issue_width; slot++)
     {
         ROBEntry* cur_re   = nullptr; // scanned ROBEntry
         RSPort* issue_port = nullptr; // issue ready port
@@ -581,7 +864,7 @@ u32 Core::issue()
         {
             util::log(LOG_CORE_PIPE2, "IS.", dec_u<0>, slot, ":   Checking uops from RE ", check_next, ".");
             u16 i = 0;
-            for(i = check_next; i <= rob->size() && i <= ISSUE_DEPTH; i++)
+            for(i = check_next; i <= rob->size() && i <= c.issue_depth; i++)
             {
                 check_next = i + 1; // don't check this uop again in another issue slot
                 cur_re     = &rob->at(state.cycle, i);
@@ -600,7 +883,7 @@ u32 Core::issue()
             util::log(LOG_CORE_PIPE1, "IS.", dec_u<0>, slot, ":   Trying to issue uop ", *cur_op);
 
             // we checked all issue slots
-            if(i == ISSUE_DEPTH)
+            if(i == c.issue_depth)
             {
                 util::log(LOG_CORE_PIPE1, "IS.", dec_u<0>, slot, ": * Scheduler entries exhausted.");
                 break; // no uop in range can be issued
@@ -626,8 +909,8 @@ u32 Core::issue()
                 ", uop issued.");
 
             // FU and dependences are now checked, issue uops
-            issue_port->busy = ISSUE_LATENCY ? ISSUE_LATENCY : 1; // enforce RS port latency
-            issue_fu->cycle  = state.cycle + ISSUE_LATENCY;       // earliest cycle for execution start
+            issue_port->busy = c.issue_latency ? c.issue_latency : 1; // enforce RS port latency
+            issue_fu->cycle  = state.cycle + c.issue_latency;         // earliest cycle for execution start
             issue_fu->re     = cur_re;
             cur_re->in_exec  = exec_running;
             issued++;
@@ -660,8 +943,11 @@ u32 Core::issue()
 }
 
 // execute uops on all allocated FUs
+template<u8 P>
 u32 Core::execute()
 {
+    const CoreConfig& c = params<P>();
+
     if(next_inactive & ex_active) state.active &= ~ex_active;
     if( !(state.active & ex_active) )
     {
@@ -686,7 +972,7 @@ u32 Core::execute()
 
     mmu.refresh();
 
-    for(u32 slot = 0; slot < LOAD_WIDTH; slot++)
+    for(u32 slot = 0; slot < c.load_width; slot++)
     {
         try
         {
@@ -752,6 +1038,8 @@ u32 Core::execute()
                         case regs_fp: run_uop<REGCLS_1_SIZE>(*fu.re, prf.fp); break;
                         case regs_vr: run_uop<REGCLS_2_SIZE>(*fu.re, prf.vr); break;
                     }
+                    // branch unit knows the outcome now, redirect fetch instead of waiting for commit
+                    if(BR_RESOLVE_EXEC && is_branch(fu.re->op)) resolve(*fu.re);
                     fu.re = nullptr;
                     fu.cycle = 0;
                 }
@@ -766,8 +1054,11 @@ u32 Core::execute()
 }
 
 // commit core state to arf in order
+template<u8 P>
 u32 Core::commit()
 {
+    const CoreConfig& c = params<P>();
+
     if(next_inactive & co_active) state.active &= ~co_active;
     if( !(state.active & co_active) )
     {
@@ -787,15 +1078,18 @@ u32 Core::commit()
     u8*             cur_rrt      = nullptr; // allocd
     u8*             cur_rct      = nullptr; // commited
     u8*             cur_trr      = nullptr; // reverse
+    u8*             cur_refs     = nullptr; // alias counts
     void*           cur_pregc    = nullptr; // raw pointer to register content
     void*           cur_aregc    = nullptr;
     void*           cur_pregd    = nullptr;
     void*           cur_aregd    = nullptr;
     size_t          cur_regsz    = 0;
+    u8              cur_regcls   = regs_gp;
 
     // util::log(LOG_CORE_BUF, "ROB:\n", rob_readable(8).str());
 
-    for(u32 slot = 0; slot < COMMIT_WIDTH; slot++)
+    // both uops of a fused pair retire in the same slot
+    for(u32 slot = 0, pairs = 0; slot < c.commit_width + pairs; slot++)
     {
         try
         {   
@@ -821,6 +1115,24 @@ u32 Core::commit()
             {
                 cur_re = rob->get_front(state.cycle);
                 cur_op = &cur_re.op;
+                if(cur_re.fused)
+                {
+                    rob_fused--;
+                    pairs++;
+                }
+
+                // the ROB copy is renamed and may be changed by execute, replay needs the decoded uop
+                uop tr_op  = cur_re.op;
+                u64 tr_seq = 0;
+                if(tracer) [[unlikely]]
+                {
+                    if(!tr_ops.empty())
+                    {
+                        tr_op = tr_ops.front();
+                        tr_ops.pop_front();
+                    }
+                    if(!state.seq_addrs.empty()) tr_seq = state.seq_addrs.front();
+                }
 
                 // exception occured at ROB head, print status and shut down (exceptions can not be handled yet)
                 if(cur_re.except)
@@ -852,22 +1164,26 @@ u32 Core::commit()
                         cur_rrt      = rrt.gp;
                         cur_rct      = rrt.gc;
                         cur_trr      = rrt.pg;
+                        cur_refs     = rrt.gp_refs;
                         cur_pregc    = &prf.gp[cur_op->regs[r_rc]];
                         cur_aregc    = &state.arf->gp[cur_trr[cur_op->regs[r_rc]]];
                         cur_pregd    = &prf.gp[cur_op->regs[r_rd]];
                         cur_aregd    = &state.arf->gp[cur_trr[cur_op->regs[r_rd]]];
                         cur_regsz    = REGCLS_0_SIZE;
+                        cur_regcls   = regs_gp;
                         break;
                     case 0x2: // fpu
                         cur_freelist = &rrt.fp_freelist;
                         cur_rrt      = rrt.fp;
                         cur_rct      = rrt.fc;
                         cur_trr      = rrt.pf;
+                        cur_refs     = rrt.fp_refs;
                         cur_pregc    = &prf.fp[cur_op->regs[r_rc]];
                         cur_aregc    = &state.arf->fp[cur_trr[cur_op->regs[r_rc]]];
                         cur_pregd    = &prf.fp[cur_op->regs[r_rd]];
                         cur_aregd    = &state.arf->fp[cur_trr[cur_op->regs[r_rd]]];
                         cur_regsz    = REGCLS_1_SIZE;
+                        cur_regcls   = regs_fp;
                         break;
                     case 0x3: // vec int
                     case 0x4: // vec float
@@ -875,39 +1191,55 @@ u32 Core::commit()
                         cur_rrt      = rrt.vr;
                         cur_rct      = rrt.vc;
                         cur_trr      = rrt.rv;
+                        cur_refs     = rrt.vr_refs;
                         cur_pregc    = &prf.vr[cur_op->regs[r_rc]];
                         cur_aregc    = &state.arf->vr[cur_trr[cur_op->regs[r_rc]]];
                         cur_pregd    = &prf.vr[cur_op->regs[r_rd]];
                         cur_aregd    = &state.arf->vr[cur_trr[cur_op->regs[r_rd]]];
                         cur_regsz    = REGCLS_2_SIZE;
+                        cur_regcls   = regs_vr;
                         break;
                 }
 
+                // eliminated moves share pregs with their sources, reverse lookup belongs to the producer
+                u8 areg_c = cur_re.elim_rc ? cur_re.elim_rc : cur_trr[cur_op->regs[r_rc]];
+                u8 areg_d = cur_re.elim_rd ? cur_re.elim_rd : cur_trr[cur_op->regs[r_rd]];
+                if(cur_re.elim_rc) cur_aregc = &state.arf->gp[areg_c];
+                if(cur_re.elim_rd) cur_aregd = &state.arf->gp[areg_d];
+
+                // frontend temporaries are dead once every uop of their macro op has been allocated
+                // otherwise a reader still in front of alloc has to load them from the ARF
+                u8 mop_alloc = mop_allocated(*cur_op);
+                u8 tmp_c     = mop_alloc && fe.is_tempreg(cur_regcls, areg_c);
+                u8 tmp_d     = mop_alloc && fe.is_tempreg(cur_regcls, areg_d);
+
                 // actual commit to ARF (ignore invalid loads, those will be handled later)
                 if(!(is_load(*cur_op) && cur_re.mref.mode == MM::mr_invalid)) [[likely]]
                 {
                     // todo partial register writes
-                    if(cur_op->control & rc_dest)
+                    if((cur_op->control & rc_dest) && !tmp_c)
                         std::memcpy(cur_aregc, cur_pregc, cur_regsz);
-                    std::memcpy(cur_aregd, cur_pregd, cur_regsz);
-                    util::log(LOG_CORE_PIPE1, "CO.", dec_u<0>, slot, ":   ARF updated.");
+                    if(!tmp_d)
+                        std::memcpy(cur_aregd, cur_pregd, cur_regsz);
+                    util::log(LOG_CORE_PIPE1, "CO.", dec_u<0>, slot, ":   ARF updated", ((tmp_c || tmp_d) ?
+                        ", temporaries skipped." : "."));
                 }
 
 
                 if(cur_op->control & rc_dest)
-                    util::log(LOG_CORE_PIPE1, "          p", dec_u<0>, +cur_op->regs[r_rc], " -> r", +cur_trr[cur_op->regs[r_rc]]);
+                    util::log(LOG_CORE_PIPE1, "          p", dec_u<0>, +cur_op->regs[r_rc], " -> r", +areg_c);
 
-                util::log(LOG_CORE_PIPE1, "          p", dec_u<0>, +cur_op->regs[r_rd], " -> r", +cur_trr[cur_op->regs[r_rd]]);
+                util::log(LOG_CORE_PIPE1, "          p", dec_u<0>, +cur_op->regs[r_rd], " -> r", +areg_d);
 
                 // remove preg mappings
                 if((cur_op->control & rc_dest) && cur_op->regs[r_rc])
                 {
                     // update commit table
-                    cur_rct[cur_trr[cur_op->regs[r_rc]]] = cur_op->regs[r_rc];
+                    cur_rct[areg_c] = cur_op->regs[r_rc];
 
                     // free physical (destination) register
-                    cur_freelist->push_back(cur_op->regs[r_rc]);
-                    cur_trr[cur_op->regs[r_rc]] = 0;
+                    free_preg(cur_freelist, cur_refs, cur_op->regs[r_rc]);
+                    if(!cur_re.elim_rc) cur_trr[cur_op->regs[r_rc]] = 0;
 
                     // unmap physical register from rename table if this is the last write
                     if(cur_rrt[cur_trr[cur_op->regs[r_rc]]] == cur_op->regs[r_rc])
@@ -917,11 +1249,11 @@ u32 Core::commit()
                 if(cur_op->regs[r_rd])
                 {
                     // update commit table
-                    cur_rct[cur_trr[cur_op->regs[r_rd]]] = cur_op->regs[r_rd];
+                    cur_rct[areg_d] = cur_op->regs[r_rd];
 
                     // free physical (destination) register
-                    cur_freelist->push_back(cur_op->regs[r_rd]);
-                    cur_trr[cur_op->regs[r_rd]] = 0;
+                    free_preg(cur_freelist, cur_refs, cur_op->regs[r_rd]);
+                    if(!cur_re.elim_rd) cur_trr[cur_op->regs[r_rd]] = 0;
 
                     // unmap physical register from rename table if this is the last write
                     if(cur_rrt[cur_trr[cur_op->regs[r_rd]]] == cur_op->regs[r_rd])
@@ -991,7 +1323,8 @@ u32 Core::commit()
                     {   // store raised an exception, this *will* commit next
                         flush();
                         rob->push_front((state.cycle + 0), { MM::zero_mref, { uop_int, 0, {0}, cur_re.except },
-                            state.cycle, cur_re.except, exec_running, 0, 0 });
+                            state.cycle, cur_re.except, exec_running, 0, 0, 0, 0, 0, 0, 0, 0, state.cycle });
+                        if(tracer) tr_ops.push_front(zero_op);
                         continue;
                     }
 
@@ -1014,6 +1347,7 @@ u32 Core::commit()
                 }
 
                 // handle branches
+                u8 mispredict = 0;
                 if(is_branch(*cur_op))
                 {
                     util::log(LOG_CORE_PIPE1, "CO.", dec_u<0>, slot, ":   Branch detected. Sequential instruction at v.", hex_u<64>,
@@ -1021,6 +1355,9 @@ u32 Core::commit()
 
                     u64 nextrip = 0;
 
+                    // resolved at execute, younger uops already follow the actual path
+                    if(cur_re.chkpt) chk_freelist.push_back(cur_re.chkpt - 1);
+
                     // relative or absolute jump
                     // - target in memref.vaddr
                     // - memref.size == -1 if not taken
@@ -1036,24 +1373,48 @@ u32 Core::commit()
 
                     // not taken
                     // if we also pass the current rip, we can do the branch update inside the uop
+                    u8 kind = is_indirect(*cur_op) ? bk_indirect : bk_direct;
                     if(cur_re.mref.size == UINT64_MAX)
                     {
-                        fe.bp->update(state.in_flight.front(), nextrip, 0);
+                        fe.bp->update(state.in_flight.front(), nextrip, 0, kind);
                         nextrip = state.seq_addrs.front();
                     }
-                    else fe.bp->update(state.in_flight.front(), nextrip, 1);
+                    else fe.bp->update(state.in_flight.front(), nextrip, 1, kind);
+
+                    if(fe.ras)
+                    {
+                        fe.ras->verify(state.commited_macro, nextrip);
+                        fe.ras->retire(state.commited_macro + 1); // keep its effect across the flush below
+                    }
 
                     // mispredicted, refetch
                     // this will never throw, there will **always** be two elements in in_flight at this point 
                     if(state.in_flight.at(1) != nextrip)
                     {
-                        fe.set_fetchaddr(nextrip);
+                        mispredict = 1;
+                        state.mispredicts++;
+                        state.mp_cycles += state.cycle - cur_re.c_alloc;
+                        if(kind == bk_indirect) state.ind_mispredicts++;
+                        fe.redirect(nextrip, state.cycle + cfg.br_miss_penalty);
                         flush();
                         state.in_flight.push_back(nextrip);
                         state.active = fe_active | core_active; // restart frontend
                     }
                 }
 
+                // in_flight still starts with the committing macro op
+                if(tracer) [[unlikely]]
+                {
+                    u8 flags = (is_load(*cur_op) ? trace::rf_load : 0) | (is_store(*cur_op) ? trace::rf_store : 0) |
+                        ((cur_op->control & mop_last) ? trace::rf_last : 0);
+                    if(is_branch(*cur_op))
+                        flags |= trace::rf_branch | (mispredict ? trace::rf_mispredict : 0) |
+                            ((cur_re.mref.size != UINT64_MAX) ? trace::rf_taken : 0);
+
+                    tracer->put({ state.cycle, state.in_flight.front(), tr_seq, tr_op, flags, cur_re.mref.vaddr,
+                        cur_re.mref.size }); // unused fields are not stored
+                }
+
                 // only update instruction pointers when last in bundle commits
                 if(cur_op->control & mop_last)
                 {
@@ -1074,6 +1435,7 @@ u32 Core::commit()
 
                 state.commited_micro++;
                 if(cur_op->control & mop_last) state.commited_macro++;
+                if(fe.ras) fe.ras->retire(state.commited_macro);
             }
             else
             {
@@ -1102,7 +1464,8 @@ u32 Core::commit()
             flush();
             // TODO LATENCY
             rob->push_front((state.cycle + 1), { MM::zero_mref, { uop_int, 0, {0}, setExcept(ex_PF, 0) },
-                state.cycle + 0 /*latency here*/, setExcept(ex_PF, 0), exec_running, 0, 0 });
+                state.cycle + 0 /*latency here*/, setExcept(ex_PF, 0), exec_running, 0, 0, 0, 0, 0, 0, 0, 0, state.cycle });
+            if(tracer) tr_ops.push_front(zero_op);
         }
     }
 
@@ -1113,7 +1476,163 @@ u32 Core::commit()
     return 0;
 }
 
+// check executed branch against its prediction, recover from checkpoint on mispredict
+u8 Core::resolve(ROBEntry& re)
+{
+    if(!re.chkpt || re.except || re.mref.mode != MM::mr_branch) return 0;
+
+    // find branch in ROB and its macro op index into in_flight
+    u64 idx = 0;
+    u64 mop = 0;
+    for(; idx < rob->size(); idx++)
+    {
+        ROBEntry* cur_re = &rob->at(UINT64_MAX, idx);
+        if(cur_re == &re) break;
+        if(cur_re->op.control & mop_last) mop++;
+    }
+    if(idx == rob->size() || mop >= state.seq_addrs.size()) return 0; // leave it to commit
+
+    u64 nextrip = (re.mref.size == UINT64_MAX) ? state.seq_addrs.at(mop) : re.mref.vaddr;
+
+    if(nextrip == re.pred)
+    {   // prediction was correct, the checkpoint is not needed anymore
+        chk_freelist.push_back(re.chkpt - 1);
+        re.chkpt = 0;
+        return 0;
+    }
+
+    util::log(LOG_CORE_PIPE1, "EX__:   Branch mispredicted, predicted v.", hex_u<64>, re.pred, " actual v.", nextrip, ".");
+
+    state.mispredicts++;
+    state.mp_cycles += state.cycle - re.c_alloc;
+    if(is_indirect(re.op)) state.ind_mispredicts++;
+
+    return squash(idx, mop, nextrip);
+}
+
+// all uops of the macro op of the committed uop op have been allocated
+// op already left the ROB, so its last uop has to be in there unless op is the last one
+u8 Core::mop_allocated(const uop& op)
+{
+    if(op.control & mop_last) return 1;
+
+    for(u64 i = 0; i < rob->size(); i++)
+        if(rob->at(UINT64_MAX, i).op.control & mop_last) return 1;
+
+    return 0;
+}
 
+// discard all uops younger than ROB index idx and refetch from nextrip
+// mop is the index of the macro op containing the resolved uop
+u8 Core::squash(u64 idx, u64 mop, u64 nextrip)
+{
+    std::deque<u8>* cur_freelist = nullptr;
+    u8*             cur_trr      = nullptr;
+    u8*             cur_refs     = nullptr;
+
+    // youngest first, so condition registers and loads can be returned from the back
+    while(rob->size() > idx + 1)
+    {
+        ROBEntry& re = rob->back();
+        uop&      op = re.op;
+
+        switch(getOpPrefix(op))
+        {
+            default:
+            case 0x0: // control
+            case 0x1: // alu
+                cur_freelist = &rrt.gp_freelist;
+                cur_trr      = rrt.pg;
+                cur_refs     = rrt.gp_refs;
+                break;
+            case 0x2: // fpu
+                cur_freelist = &rrt.fp_freelist;
+                cur_trr      = rrt.pf;
+                cur_refs     = rrt.fp_refs;
+                break;
+            case 0x3: // vec int
+            case 0x4: // vec float
+                cur_freelist = &rrt.vr_freelist;
+                cur_trr      = rrt.rv;
+                cur_refs     = rrt.vr_refs;
+                break;
+        }
+
+        // destinations and registers loaded from ARF were allocated by this uop
+        for(u8 r = 0; r < 4; r++)
+            if(op.regs[r] && ((r == r_rd) || ((r == r_rc) && (op.control & rc_dest)) || (re.ld_mask & (use_ra << r))))
+            {
+                free_preg(cur_freelist, cur_refs, op.regs[r]);
+                if(!((r == r_rd) && re.elim_rd) && !((r == r_rc) && re.elim_rc)) cur_trr[op.regs[r]] = 0;
+            }
+
+        if(re.cc_set && !rrt.cc_lastused.empty() && (rrt.cc_lastused.back() == re.cc_set))
+        {
+            rrt.cc_lastused.pop_back();
+            rrt.cc_freelist.push_back(re.cc_set);
+        }
+
+        if(re.chkpt) chk_freelist.push_back(re.chkpt - 1);
+
+        if(is_load(op))
+        {
+            mmu.cancel_load(&re.mref);
+            if(!ldq->empty() && (ldq->back() == &re)) ldq->pop_back();
+        }
+
+        for(auto& rsp : rs.ports)
+            for(auto& fu : rsp.fus)
+                if(fu.re == &re)
+                {
+                    fu.busy  = 0;
+                    fu.cycle = 0;
+                    fu.re    = nullptr;
+                }
+
+        if(re.fused) rob_fused--;
+        rob->pop_back();
+        state.squashed++;
+    }
+    if(tr_ops.size() > rob->size()) tr_ops.resize(rob->size());
+
+    // restore alloc maps, the branch itself does not need its checkpoint anymore
+    ROBEntry& br = rob->back();
+
+    // predictions up to this branch are still valid
+    u64 branches = 0;
+    for(u64 i = 0; i <= idx; i++)
+        if(is_branch(rob->at(UINT64_MAX, i).op) && (rob->at(UINT64_MAX, i).op.control & mop_last)) branches++;
+    fe.bp->recover(branches, nextrip, br.mref.size != UINT64_MAX);
+    if(fe.ras) fe.ras->recover(state.commited_macro + mop + 1);
+
+    std::memcpy(rrt.gp, chk[br.chkpt - 1].gp, REGCLS_0_CNT);
+    std::memcpy(rrt.fp, chk[br.chkpt - 1].fp, REGCLS_1_CNT);
+    std::memcpy(rrt.vr, chk[br.chkpt - 1].vr, REGCLS_2_CNT);
+    chk_freelist.push_back(br.chkpt - 1);
+    br.chkpt = 0;
+    br.pred  = nextrip;
+
+    // uops not allocated yet are on the wrong path as well
+    state.squashed += uqueue->size() + id_ra->size();
+    uqueue->clear();
+    id_ra->clear();
+
+    // keep instruction trace up to the branch
+    state.in_flight.resize(mop + 1);
+    state.in_flight.push_back(nextrip);
+    state.seq_addrs.resize(mop + 1);
+    seq_at_alloc = mop + 1;
+    if(state.refetch_active && std::find(state.in_flight.begin(), state.in_flight.end(), state.refetch_at) ==
+        state.in_flight.end())
+        state.refetch_active = 0;
+
+    fe.flush();
+    fe.redirect(nextrip, state.cycle + cfg.br_miss_penalty);
+    state.active  = fe_active | core_active; // restart frontend
+    next_inactive = 0;
+
+    return 1;
+}
 
 RSPort::RSPort(u8 id, vector<u8> types) : id(id), busy(fu_ready)
 {
@@ -1121,6 +1640,17 @@ RSPort::RSPort(u8 id, vector<u8> types) : id(id), busy(fu_ready)
     for(u8 t : types) fus.push_back(FUInfo(t, i++));
 }
 
+ReservationStation::ReservationStation(const CoreConfig& cfg)
+{
+    for(u8 p = 0; p < RS_PORTS; p++)
+    {
+        vector<u8> types;
+        for(u8 t = fu_ctrl; t <= fu_mul; t++)
+            if(cfg.ports[p] & FU(t)) types.push_back(t);
+        ports.push_back(RSPort(p, types));
+    }
+}
+
 // filter rs ports using portmask
 vector<RSPort*> Core::get_rsports(u8 portmask)
 {
@@ -1134,7 +1664,7 @@ vector<RSPort*> Core::get_rsports(u8 portmask)
     return ret;
 }
 
-std::ostream& operator<<(std::ostream& os, const MM::MemoryRef& mr)
+std::ostream& MM::operator<<(std::ostream& os, const MM::MemoryRef& mr)
 {
     os << "v." << hex_u<64> << mr.vaddr << " size " << dec_u<0> << mr.size << " r " << +mr.ready << " m "
        << MM::memref_mode_str[mr.mode];
@@ -1198,17 +1728,17 @@ std::stringstream Core::prf_readable(u8 regclass)
     std::stringstream ss;
 
     if(regclass == 0) // gp
-        for(u16 i = 0; i < REGCLS_0_RNREG; i++)
+        for(u16 i = 0; i < cfg.gp_rnreg; i++)
             ss << "p" << dec_u<3> << i << " " << hex_u<REGCLS_0_SIZE*8>
                << prf.gp[i] << (i % 4 == 3 ? "\n" : " ");
 
     if(regclass == 1) // fp
-        for(u16 i = 0; i < REGCLS_1_RNREG; i++)
+        for(u16 i = 0; i < cfg.fp_rnreg; i++)
             ss << "p" << dec_u<3> << i << " " << hex_u<REGCLS_1_SIZE*8>
                << prf.fp[i] << (i % 2 == 1 ? "\n" : " ");
 
     if(regclass == 2) // vr
-        for(u16 i = 0; i < REGCLS_2_RNREG; i++)
+        for(u16 i = 0; i < cfg.vr_rnreg; i++)
             ss << "p" << dec_u<3> << i << " " << hex_u<REGCLS_2_SIZE*8>
                << prf.fp[i] << "\n";
 
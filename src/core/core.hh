@@ -13,6 +13,7 @@
 #include "cconf.hh"
 
 #include "uops.hh"
+#include "../config.hh"
 #include "../types.hh"
 #include "../util.hh"
 #include "../sim.hh"
@@ -58,12 +59,12 @@ struct ArchRegFile
     Register<ADDR_SIZE>     ip;
 }; // ArchRegFile
 
-// only visible to core
+// only visible to core, CoreConfig sets the number of registers in use
 struct PhysRegFile
 {
-    Register<REGCLS_0_SIZE> gp[REGCLS_0_RNREG];
-    Register<REGCLS_1_SIZE> fp[REGCLS_1_RNREG];
-    Register<REGCLS_2_SIZE> vr[REGCLS_2_RNREG];
+    Register<REGCLS_0_SIZE> gp[RNREG_MAX];
+    Register<REGCLS_1_SIZE> fp[RNREG_MAX];
+    Register<REGCLS_2_SIZE> vr[RNREG_MAX];
     Register<CCREG_SIZE>    cc[CCREG_CNT];
 }; // PhysRegFile
 
@@ -82,9 +83,14 @@ struct RenameTable
     u8 vc[REGCLS_2_CNT];
 
     // preg -> archreg
-    u8 pg[REGCLS_0_RNREG];
-    u8 pf[REGCLS_1_RNREG];
-    u8 rv[REGCLS_2_RNREG];
+    u8 pg[RNREG_MAX];
+    u8 pf[RNREG_MAX];
+    u8 rv[RNREG_MAX];
+
+    // preg -> additional mappings held by eliminated moves, preg is freed when this is 0
+    u8 gp_refs[RNREG_MAX];
+    u8 fp_refs[RNREG_MAX];
+    u8 vr_refs[RNREG_MAX];
 
     // free lists for pregs
     std::deque<u8> gp_freelist; // unallocated physical gp regs
@@ -92,7 +98,15 @@ struct RenameTable
     std::deque<u8> vr_freelist; // unallocated physical vector regs
     std::deque<u8> cc_freelist; // usable condition registers
     std::deque<u8> cc_lastused; // last set condition registers
-};
+}; // RenameTable
+
+// alloc map snapshot taken when a branch is renamed, restored on mispredict
+struct RenameCheckpoint
+{
+    u8 gp[REGCLS_0_CNT];
+    u8 fp[REGCLS_1_CNT];
+    u8 vr[REGCLS_2_CNT];
+}; // RenameCheckpoint
 
 // stores will be controlled by the ROB
 // loads can be executed speculatively
@@ -106,9 +120,16 @@ struct ROBEntry
     u8            in_exec; // uop in execution
     u8            cc_use;  // used condition register
     u8            cc_set;  // set condition register
+    u8            chkpt;   // rename checkpoint held by branch (index + 1), 0 if none
+    u8            ld_mask; // source regs loaded from ARF at alloc (use_ra << n)
+    u8            elim_rc; // eliminated move: archreg sharing regs[r_rc] with its source, 0 otherwise
+    u8            elim_rd; // eliminated move: archreg sharing regs[r_rd] with its source, 0 otherwise
+    u8            fused;   // fused with the next entry, both take one alloc, ROB and commit slot
+    u64           pred;    // predicted next rip (branches)
+    u64           c_alloc; // cycle of allocation
 }; // ROBEntry
 
-const ROBEntry zero_re = { MM::zero_mref, zero_op, 0, 0, 0, 0, 0 };
+const ROBEntry zero_re = { MM::zero_mref, zero_op, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 
 typedef enum
 {
@@ -122,6 +143,13 @@ typedef enum
     exec_running,
 } exec_status;
 
+typedef enum
+{
+    elim_none,
+    elim_move,  // destinations renamed to the source pregs
+    elim_zero,  // destination zeroed at rename
+} elim_status;
+
 typedef enum
 {
     fu_ready,
@@ -148,19 +176,12 @@ struct RSPort
     RSPort(u8 id, vector<u8> types);
 }; // RSPort
 
+// port layout is taken from CoreConfig.ports
 struct ReservationStation
 {
-    vector<RSPort> ports =
-    {
-        RSPort(0, {fu_alu, fu_div,  fu_brch, fu_ctrl }),
-        RSPort(1, {fu_alu, fu_mul                    }),
-        RSPort(2, {fu_alu, fu_agu                    }),
-        RSPort(3, {fu_alu, fu_brch, fu_ctrl          }),
-        RSPort(4, {fu_agu, fu_ld                     }),
-        RSPort(5, {fu_agu, fu_ld                     }),
-        RSPort(6, {fu_st                             }),
-        RSPort(7, {fu_agu                            }),
-    };
+    vector<RSPort> ports;
+
+    ReservationStation(const CoreConfig& cfg);
 }; // ReservationStation
 
 struct LoadQueueEntry
@@ -179,27 +200,52 @@ class Core
 {
     public:
     Core(LatchQueue<uop>* uqueue, Simulator::SimulatorState& state, MemoryManager& mmu,
-        Frontend& fe);
+        Frontend& fe, const CoreConfig& cfg);
     ~Core();
     u32 cycle();
     u8  flush();
-
-    u32 decode();
-    u32 alloc();
-    u32 issue();
-    u32 execute();
-    u32 commit();
+    // functional mode, executes macro ops in order on the ARF until insts retired or rip == pc
+    u64 fast_forward(u64 insts, u64 pc, simpoint::Profiler* prof = nullptr);
+    // every committed uop is recorded if set
+    trace::Writer* tracer = nullptr;
+
+    // stages are specialized for the config presets, P == preset_runtime reads cfg
+    template<u8 P> u32 decode();
+    template<u8 P> u32 alloc();
+    template<u8 P> u32 issue();
+    template<u8 P> u32 execute();
+    template<u8 P> u32 commit();
+
+    u8  resolve(ROBEntry& re);
+    u8  squash(u64 idx, u64 mop, u64 nextrip);
+    u8  mop_allocated(const uop& op);
 
     template<u8 N>
     u8              run_uop(ROBEntry& re, Register<N>* regfile);
+    template<u8 N>
+    u8              run_functional(ROBEntry& re, Register<N>* regfile, Register<N>* scratch);
     vector<RSPort*> get_rsports(const u8 portmask);
     inline void     set_cc(u8 reg, u64 cc) { prf.cc[reg].write<u64>(cc); };
+    inline void     free_preg(std::deque<u8>* freelist, u8* refs, u8 preg)
+                    { if(refs[preg]) refs[preg]--; else freelist->push_back(preg); };
 
     std::stringstream idra_readable(u8 n);
     std::stringstream rob_readable(u8 n);
     std::stringstream prf_readable(u8 regclass);
 
     private:
+    template<u8 P> u32 run_cycle();
+    void               init_rename();
+    u8                 clear_pipeline();
+    u8                 sync_arf();
+    template<u8 P> constexpr const CoreConfig& params() const
+    {   // constants fold for presets
+        if constexpr(P == config::preset_runtime) return cfg;
+        else return config::core_presets[P];
+    };
+
+    const CoreConfig           cfg;
+    const u8                   preset;           // config::preset_id matching cfg
     LatchQueue<uop>*           uqueue;
     Simulator::SimulatorState& state;
     MemoryManager&             mmu;
@@ -208,9 +254,13 @@ class Core
     RenameTable                rrt;
     ReservationStation         rs;
     LatchQueue<uop>*           id_ra;            // decode / rename&alloc
-    LatchQueue<ROBEntry>*      rob;
+    LatchQueue<ROBEntry>*      rob;              // fused pairs take one of cfg.rob_size slots
     LatchQueue<ROBEntry*>*     ldq;              // load queue
+    vector<RenameCheckpoint>   chk;              // cfg.br_checkpoints
+    std::deque<u8>             chk_freelist;     // unused checkpoints
+    std::deque<uop>            tr_ops;           // decoded uops of the ROB entries while tracing
 
+    u64                        rob_fused    = 0; // ROB entries fused with their successor
     u64                        seq_at_alloc = 0; // index into seq_addrs
     u64                        rip_at_alloc = 0; // may not need this
     u16 next_inactive;                           // inactive next cycle (mask)
@@ -41,7 +41,7 @@ typedef enum
     mop_last  = 0x0100, // uop is last of macro instruction
     imm_delay = 0x0200, // immediate will contain commit delay tbd
     rc_dest   = 0x0400, // use rc as second destination register
-    data_type = 0x0800, // data type, vector: unset int / set float; .. tbd
+    fuse_next = 0x0800, // macro or micro fused with the next uop, the pair is split only for execution
     use_cond  = 0x1000, // uop uses last set condition
     set_cond  = 0x2000, // uop sets a new condition
     rd_extend = 0x4000, // sign/zero extend partial register writes
@@ -88,6 +88,9 @@ constexpr u8  is_branch(uop& op)
         branch_none;
 }
 
+// target is read from a register
+constexpr u8  is_indirect(uop& op)    { return (op.opcode == 0x60) && (op.control & use_ra); }
+
 // extend these and ROBEntry.except if needed, for now only 16 bits error code are ever used in x64
 // upper 16 bits = errorcode, lower 16 bits exception number
 constexpr u32 setExcept(u16 e, u16 c) { return (((u32)c << 16) | e); }
@@ -1,44 +1,908 @@
 // o3 RISC simulator
 //
 // branch prediction
-// - predictor 1
-// - predictor 2
-// ..
+// - simple (sequential)
+// - set associative BTB
+// - TAGE
+// - ITTAGE
+// - loop predictor
+// - return address stack
 //
 // Lukas Heine 2021
 
 #include "bp.hh"
 
+#include <algorithm>
+#include <cmath>
+
+BranchPredictor* new_predictor(u8 type, u8 ittage, u8 loop)
+{
+    BranchPredictor* bp = nullptr;
+    switch(type)
+    {
+        case bp_simple: bp = new SimplePredictor(); break;
+        case bp_tage:   bp = new TAGEPredictor();   break;
+        default:
+        case bp_btb:    bp = new BTBPredictor();    break;
+    }
+
+    if(loop) bp = new LoopPredictor(bp);
+    return ittage ? new ITTAGEPredictor(bp) : bp;
+}
+
+u8 predictor_id(const string& name)
+{
+    if(name == "simple") return bp_simple;
+    if(name == "btb")    return bp_btb;
+    if(name == "tage")   return bp_tage;
+    return UINT8_MAX;
+}
+
+ShadowTags::ShadowTags(u32 size)
+    : nodes(size), index(std::bit_ceil(size) * 2, nil), bits(std::countr_zero(std::bit_ceil(size) * 2)),
+      mask(index.size() - 1)
+{}
+
+u32 ShadowTags::slot(u64 key)
+{
+    u32 i = home(key);
+    for(; index[i] != nil && nodes[index[i]].key != key; i = (i + 1) & mask);
+    return i;
+}
+
+// backward shift deletion, keys probing past i move up
+void ShadowTags::unindex(u32 i)
+{
+    for(u32 j = i;;)
+    {
+        index[i] = nil;
+        for(;;)
+        {
+            j = (j + 1) & mask;
+            if(index[j] == nil) return;
+            if(((j - home(nodes[index[j]].key)) & mask) >= ((j - i) & mask)) break;
+        }
+        index[i] = index[j];
+        i = j;
+    }
+}
+
+void ShadowTags::unlink(u32 n)
+{
+    if(nodes[n].prev != nil) nodes[nodes[n].prev].next = nodes[n].next;
+    else                     head = nodes[n].next;
+    if(nodes[n].next != nil) nodes[nodes[n].next].prev = nodes[n].prev;
+    else                     tail = nodes[n].prev;
+}
+
+void ShadowTags::push_front(u32 n)
+{
+    nodes[n].prev = nil;
+    nodes[n].next = head;
+    if(head != nil) nodes[head].prev = n;
+    else            tail = n;
+    head = n;
+}
+
+u8 ShadowTags::touch(u64 key)
+{
+    u32 n = index[slot(key)];
+    if(n == nil) return 0;
+
+    unlink(n);
+    push_front(n);
+    return 1;
+}
+
+void ShadowTags::insert(u64 key)
+{
+    if(touch(key)) return;
+
+    u32 n;
+    if(used < nodes.size()) n = used++;
+    else if(spare != nil)
+    {
+        n     = spare;
+        spare = nodes[n].next;
+    }
+    else
+    {   // full, replace the least recently used key
+        n = tail;
+        unindex(slot(nodes[n].key));
+        unlink(n);
+    }
+
+    nodes[n].key     = key;
+    index[slot(key)] = n;
+    push_front(n);
+}
+
+void ShadowTags::erase(u64 key)
+{
+    u32 i = slot(key), n = index[i];
+    if(n == nil) return;
+
+    unindex(i);
+    unlink(n);
+    nodes[n].next = spare;
+    spare         = n;
+}
+
+BranchTargetBuffer::BranchTargetBuffer(u32 sets, u8 ways)
+    : sets(sets), ways(ways), setbits(std::countr_zero(sets)), entries(sets * ways, {0, 0, 0, 0}), valid(0),
+      lookups(0), hits(0), conflict(0), capacity(0), shadow(sets * ways)
+{
+    // ages are a permutation of 0..ways-1 in each set
+    for(u32 i = 0; i < sets * ways; i++) entries[i].age = i % ways;
+}
+
+// make way the most recently used one
+void BranchTargetBuffer::touch(BTBEntry* set, u8 way)
+{
+    for(u8 w = 0; w < ways; w++)
+        if(set[w].age < set[way].age) set[w].age++;
+    set[way].age = 0;
+}
+
+u8 BranchTargetBuffer::lookup(u64 rip, u64& target)
+{
+    BTBEntry* set = &entries[get_set(rip) * ways];
+    u32       tag = get_tag(rip);
+
+    lookups++;
+    shadow.touch(get_key(rip));
+    for(u8 w = 0; w < ways; w++)
+        if(set[w].valid && set[w].tag == tag)
+        {
+            touch(set, w);
+            target = set[w].target;
+            hits++;
+            return 1;
+        }
+
+    return 0;
+}
+
+void BranchTargetBuffer::insert(u64 rip, u64 target)
+{
+    BTBEntry* set    = &entries[get_set(rip) * ways];
+    u32       tag    = get_tag(rip);
+    u8        victim = 0;
+
+    for(u8 w = 0; w < ways; w++)
+        if(set[w].valid && set[w].tag == tag)
+        {   // update target
+            set[w].target = target;
+            touch(set, w);
+            shadow.insert(get_key(rip));
+            return;
+        }
+
+    // a taken branch missing here, a fully associative buffer would still hold it unless it was never taken before
+    if(shadow.touch(get_key(rip))) conflict++;
+    else                           capacity++;
+    shadow.insert(get_key(rip));
+
+    // prefer invalid entries, then the least recently used
+    for(u8 w = 1; w < ways && set[victim].valid; w++)
+        if(!set[w].valid || set[w].age > set[victim].age) victim = w;
+
+    if(!set[victim].valid) valid++;
+
+    set[victim] = { tag, 1, set[victim].age, target };
+    touch(set, victim);
+}
+
+void BranchTargetBuffer::invalidate(u64 rip)
+{
+    BTBEntry* set = &entries[get_set(rip) * ways];
+    u32       tag = get_tag(rip);
+
+    for(u8 w = 0; w < ways; w++)
+        if(set[w].valid && set[w].tag == tag)
+        {
+            set[w].valid = 0;
+            valid--;
+        }
+    shadow.erase(get_key(rip));
+}
+
+std::stringstream BranchTargetBuffer::summary(const char* name)
+{
+    std::stringstream ss;
+
+    ss << name << " " << dec_u<0> << sets << "x" << +ways << ": " << lookups << " lookups, hit rate "
+       << (lookups ? (f32)hits / (f32)lookups : 0) << ", " << conflict << " conflict / " << capacity
+       << " capacity or cold misses";
+
+    return ss;
+}
+
+void BranchTargetBuffer::save(std::ostream& os)
+{
+    ckpt::put(os, (u64)entries.size());
+    os.write((const char*)entries.data(), entries.size() * sizeof(BTBEntry));
+    ckpt::put(os, valid);
+}
+
+void BranchTargetBuffer::load(std::istream& is)
+{
+    u64 n;
+    ckpt::get(is, n);
+    if(n != entries.size()) throw CheckpointException();
+    if(!is.read((char*)entries.data(), entries.size() * sizeof(BTBEntry))) throw CheckpointException();
+    ckpt::get(is, valid);
+}
+
 // always predict next uop
-u64 SimplePredictor::predict(u64 rip, u64 seq, u64 target)
+u64 SimplePredictor::predict(u64 rip, u64 seq, u64 target, u8 kind)
 {
     (void) rip;
-    (void)target;
+    (void) target;
+    (void) kind;
     return seq;
 }
 
-void SimplePredictor::update(u64 rip, u64 target, u8 taken)
+void SimplePredictor::update(u64 rip, u64 target, u8 taken, u8 kind)
 {
     (void) rip;
     (void) target;
     (void) taken;
+    (void) kind;
 }
 
-u64 BTBPredictor::predict(u64 rip, u64 seq, u64 target)
+u64 BTBPredictor::predict(u64 rip, u64 seq, u64 target, u8 kind)
 {
-    if(!btb.count(rip))
+    u64 next = 0;
+
+    if(kind == bk_indirect)
+        return ibtb.lookup(rip, next) ? next : seq;
+
+    if(!btb.lookup(rip, next))
         return (rip < target ? seq : target); // backward taken, forward not taken
-    
-    else return btb.at(rip);
+
+    else return next;
 }
 
-void BTBPredictor::update(u64 rip, u64 target, u8 taken)
+void BTBPredictor::update(u64 rip, u64 target, u8 taken, u8 kind)
 {
-    if(taken && btb.size() < BTB_SIZE)
-        btb.insert_or_assign(rip, target);
+    BranchTargetBuffer& b = (kind == bk_indirect) ? ibtb : btb;
 
-    else if(!taken && btb.count(rip))
-        btb.erase(rip);
+    if(taken) b.insert(rip, target);
+    else      b.invalidate(rip);
 
     util::log(LOG_BP_ALL, "BP__:   Updated branch at ", hex_u<64>, rip, " as ", (taken ? "taken" : "not taken"), ".");
 }
+
+std::stringstream BTBPredictor::summary()
+{
+    std::stringstream ss;
+
+    ss << btb.summary("BTB").str() << "\n" << ibtb.summary("iBTB").str();
+
+    return ss;
+}
+
+void BTBPredictor::save(std::ostream& os)
+{
+    btb.save(os);
+    ibtb.save(os);
+}
+
+void BTBPredictor::load(std::istream& is)
+{
+    btb.load(is);
+    ibtb.load(is);
+}
+
+
+TAGEPredictor::TAGEPredictor()
+    : BranchPredictor(), btb(BTB_SETS, BTB_WAYS), ibtb(BTB_IND_SETS, BTB_IND_WAYS)
+{
+    base.fill(0);
+    for(auto& t : tables) t.fill({0, 0, 0});
+
+    // geometric series of history lengths
+    for(u8 i = 0; i < TAGE_TABLES; i++)
+        hlen[i] = (TAGE_TABLES == 1) ? TAGE_HIST_MAX : (u16)(TAGE_HIST_MIN *
+            std::pow((f64)TAGE_HIST_MAX / TAGE_HIST_MIN, (f64)i / (TAGE_TABLES - 1)) + 0.5);
+
+    use_alt  = 0;
+    branches = 0;
+    allocs   = 0;
+    for(auto& p : provided) p = 0;
+}
+
+TAGEPredictor::TAGELookup TAGEPredictor::lookup(u64 rip, const tage_hist& hist)
+{
+    TAGELookup l;
+    l.rip      = rip;
+    l.ghr      = hist;
+    l.provider = -1;
+    l.alt      = -1;
+
+    for(u8 i = 0; i < TAGE_TABLES; i++)
+    {
+        l.idx[i] = (rip ^ (rip >> (TAGE_LOG_TABLE - i)) ^ hist.idx[i]) & ((1 << TAGE_LOG_TABLE) - 1);
+        l.tag[i] = (rip ^ hist.tag[i] ^ (hist.tag1[i] << 1)) & ((1 << TAGE_TAG_BITS) - 1);
+    }
+
+    // longest matching table provides, second longest is the alternate
+    for(i8 i = TAGE_TABLES - 1; i >= 0; i--)
+        if(tables[i][l.idx[i]].tag == l.tag[i])
+        {
+            if(l.provider < 0) l.provider = i;
+            else { l.alt = i; break; }
+        }
+
+    l.altpred = (l.alt < 0) ? base_pred(rip) : (tables[l.alt][l.idx[l.alt]].ctr >= 0);
+
+    if(l.provider < 0) l.pred = l.altpred;
+    else
+    {
+        TAGEEntry& e = tables[l.provider][l.idx[l.provider]];
+        // newly allocated entries are often wrong
+        u8 weak = (e.ctr == 0 || e.ctr == -1) && !e.u;
+        l.pred = (weak && use_alt >= 0) ? l.altpred : (e.ctr >= 0);
+    }
+
+    return l;
+}
+
+u64 TAGEPredictor::predict(u64 rip, u64 seq, u64 target, u8 kind)
+{
+    (void) target;
+
+    TAGELookup l = lookup(rip, ghr_spec);
+
+    // no known target, fetch continues sequentially
+    u64 next = seq;
+    if(l.pred && !((kind == bk_indirect) ? ibtb : btb).lookup(rip, next)) next = seq;
+
+    // speculative history follows the fetched path
+    ghr_spec.push(next != seq, hlen);
+
+    lookups.push_back(l);
+
+    util::log(LOG_BP_ALL, "BP__:   TAGE predicted branch at ", hex_u<64>, rip, " as ", (next != seq ? "taken" : "not taken"),
+        " (table ", dec_u<0>, +l.provider, ").");
+    return next;
+}
+
+void TAGEPredictor::base_update(u64 rip, u8 taken)
+{
+    i8& c = base[rip & ((1 << TAGE_LOG_BASE) - 1)];
+    if(taken && c < 1)   c++;
+    if(!taken && c > -2) c--;
+}
+
+void TAGEPredictor::update(u64 rip, u64 target, u8 taken, u8 kind)
+{
+    constexpr i8 ctr_max = (1 << (TAGE_CTR_BITS - 1)) - 1;
+    constexpr i8 ctr_min = -(1 << (TAGE_CTR_BITS - 1));
+
+    ghr_arch.push(taken, hlen);
+
+    if(taken) ((kind == bk_indirect) ? ibtb : btb).insert(rip, target);
+
+    auto match = std::find_if(lookups.begin(), lookups.end(), [&](auto& l) { return l.rip == rip; });
+    if(match == lookups.end())
+    {   // not predicted at fetch, only train the base table
+        base_update(rip, taken);
+        util::log(LOG_BP_ALL, "BP__:   Updated unpredicted branch at ", hex_u<64>, rip, " as ", (taken ? "taken" : "not taken"), ".");
+        return;
+    }
+
+    // drop lookups of branches that never committed, e.g. when uops were replaced
+    lookups.erase(lookups.begin(), match);
+
+    TAGELookup l = lookups.front();
+    lookups.pop_front();
+
+    provided[l.provider + 1]++;
+
+    if(l.provider >= 0)
+    {
+        TAGEEntry& e = tables[l.provider][l.idx[l.provider]];
+
+        // learn whether weak new entries or their alternate are more reliable
+        if((e.ctr == 0 || e.ctr == -1) && !e.u && ((e.ctr >= 0) != l.altpred))
+        {
+            if((l.altpred == taken) && use_alt < 7)  use_alt++;
+            if((l.altpred != taken) && use_alt > -8) use_alt--;
+        }
+
+        // useful if it differs from the alternate and was right
+        if((e.ctr >= 0) != l.altpred)
+        {
+            if(((e.ctr >= 0) == taken) && e.u < 3) e.u++;
+            if(((e.ctr >= 0) != taken) && e.u > 0) e.u--;
+        }
+
+        if(taken && e.ctr < ctr_max)  e.ctr++;
+        if(!taken && e.ctr > ctr_min) e.ctr--;
+
+        if(l.alt < 0 && !e.u) base_update(rip, taken);
+    }
+    else base_update(rip, taken);
+
+    // mispredicted, allocate an entry in a table with longer history
+    if(l.pred != taken && l.provider < TAGE_TABLES - 1)
+    {
+        u8 allocated = 0;
+        for(u8 i = l.provider + 1; i < TAGE_TABLES; i++)
+            if(!tables[i][l.idx[i]].u)
+            {
+                tables[i][l.idx[i]] = { l.tag[i], (i8)(taken ? 0 : -1), 0 };
+                allocated = 1;
+                allocs++;
+                break;
+            }
+
+        // no free entry, age all candidates
+        if(!allocated)
+            for(u8 i = l.provider + 1; i < TAGE_TABLES; i++)
+                tables[i][l.idx[i]].u--;
+    }
+
+    // graceful aging of useful counters
+    if(++branches >= TAGE_U_RESET)
+    {
+        for(auto& t : tables)
+            for(auto& e : t) e.u >>= 1;
+        branches = 0;
+    }
+
+    util::log(LOG_BP_ALL, "BP__:   Updated branch at ", hex_u<64>, rip, " as ", (taken ? "taken" : "not taken"), ".");
+}
+
+// n-th in flight branch was resolved, later lookups are on the wrong path
+void TAGEPredictor::recover(u64 n, u64 target, u8 taken)
+{
+    (void) target;
+
+    if(!n || n > lookups.size()) return;
+
+    lookups.resize(n);
+    ghr_spec = lookups.back().ghr;
+    ghr_spec.push(taken, hlen);
+}
+
+// nothing is in flight anymore
+void TAGEPredictor::flush()
+{
+    lookups.clear();
+    ghr_spec = ghr_arch;
+}
+
+void TAGEPredictor::save(std::ostream& os)
+{
+    ckpt::put(os, base);
+    ckpt::put(os, tables);
+    ckpt::put(os, ghr_arch.bits);
+    ckpt::put(os, use_alt);
+    ckpt::put(os, branches);
+    btb.save(os);
+    ibtb.save(os);
+}
+
+void TAGEPredictor::load(std::istream& is)
+{
+    ckpt::get(is, base);
+    ckpt::get(is, tables);
+    ckpt::get(is, ghr_arch.bits);
+    ckpt::get(is, use_alt);
+    ckpt::get(is, branches);
+    btb.load(is);
+    ibtb.load(is);
+    ghr_arch.refold(hlen);
+    flush();
+}
+
+std::stringstream TAGEPredictor::summary()
+{
+    std::stringstream ss;
+
+    ss << "TAGE history lengths:";
+    for(auto h : hlen) ss << " " << dec_u<0> << h;
+    ss << "\nTAGE provider base: " << dec_u<0> << provided[0];
+    for(u8 i = 0; i < TAGE_TABLES; i++) ss << " t" << +i << ": " << provided[i + 1];
+    ss << "\nTAGE allocations:   " << allocs;
+    ss << "\n" << btb.summary("BTB").str() << "\n" << ibtb.summary("iBTB").str();
+
+    return ss;
+}
+
+
+ITTAGEPredictor::ITTAGEPredictor(BranchPredictor* dir) : BranchPredictor(), dir(dir), allocs(0)
+{
+    for(auto& t : tables) t.fill({0, 0, 0, 0});
+
+    // geometric series of history lengths, two bits per branch
+    for(u8 i = 0; i < ITTAGE_TABLES; i++)
+        hlen[i] = 2 * ((ITTAGE_TABLES == 1) ? ITTAGE_HIST_MAX : (u16)(ITTAGE_HIST_MIN *
+            std::pow((f64)ITTAGE_HIST_MAX / ITTAGE_HIST_MIN, (f64)i / (ITTAGE_TABLES - 1)) + 0.5));
+
+    for(auto& p : provided) p = 0;
+    label = string(dir->name()) + "+ittage";
+}
+
+// direction and one target bit of each branch
+void ITTAGEPredictor::shift(ittage_hist& hist, u8 taken, u64 target)
+{
+    hist.push(taken && (((target >> 2) ^ (target >> 6)) & 1), hlen);
+    hist.push(taken, hlen);
+}
+
+u64 ITTAGEPredictor::predict(u64 rip, u64 seq, u64 target, u8 kind)
+{
+    u64 next = dir->predict(rip, seq, target, kind);
+
+    ITTAGELookup l;
+    l.rip      = rip;
+    l.hist     = hist_spec;
+    l.indirect = (kind == bk_indirect);
+    l.provider = -1;
+    l.alt      = -1;
+    l.pred     = next;
+    l.altpred  = next;
+
+    if(l.indirect)
+    {
+        for(u8 i = 0; i < ITTAGE_TABLES; i++)
+        {
+            l.idx[i] = (rip ^ (rip >> (ITTAGE_LOG_TABLE - i)) ^ hist_spec.idx[i]) & ((1 << ITTAGE_LOG_TABLE) - 1);
+            l.tag[i] = (rip ^ hist_spec.tag[i] ^ (hist_spec.tag1[i] << 1)) & ((1 << ITTAGE_TAG_BITS) - 1);
+        }
+
+        for(i8 i = ITTAGE_TABLES - 1; i >= 0; i--)
+            if(tables[i][l.idx[i]].tag == l.tag[i] && tables[i][l.idx[i]].target)
+            {
+                if(l.provider < 0) l.provider = i;
+                else { l.alt = i; break; }
+            }
+
+        // base target from the direction predictor
+        if(l.alt >= 0) l.altpred = tables[l.alt][l.idx[l.alt]].target;
+
+        if(l.provider >= 0)
+        {
+            ITTAGEEntry& e = tables[l.provider][l.idx[l.provider]];
+            l.pred = (e.ctr || l.alt < 0) ? e.target : l.altpred;
+        }
+        next = l.pred;
+
+        util::log(LOG_BP_ALL, "BP__:   ITTAGE predicted indirect branch at ", hex_u<64>, rip, " to ", next,
+            " (table ", dec_u<0>, +l.provider, ").");
+    }
+
+    shift(hist_spec, next != seq, next);
+    lookups.push_back(l);
+
+    return next;
+}
+
+void ITTAGEPredictor::update(u64 rip, u64 target, u8 taken, u8 kind)
+{
+    dir->update(rip, target, taken, kind);
+    shift(hist_arch, taken, target);
+
+    auto match = std::find_if(lookups.begin(), lookups.end(), [&](auto& l) { return l.rip == rip; });
+    if(match == lookups.end()) return;
+
+    lookups.erase(lookups.begin(), match);
+    ITTAGELookup l = lookups.front();
+    lookups.pop_front();
+
+    if(!l.indirect || !taken) return;
+
+    provided[l.provider + 1]++;
+
+    if(l.provider >= 0 && tables[l.provider][l.idx[l.provider]].tag == l.tag[l.provider])
+    {
+        ITTAGEEntry& e = tables[l.provider][l.idx[l.provider]];
+        if(e.target == target)
+        {
+            if(e.ctr < 3) e.ctr++;
+            if(l.altpred != target && e.u < 3) e.u++;
+        }
+        else
+        {   // replace target once confidence is gone
+            if(e.ctr) e.ctr--;
+            else      e.target = target;
+            if(l.altpred == target && e.u) e.u--;
+        }
+    }
+
+    // mispredicted, allocate an entry with longer history
+    if(l.pred != target && l.provider < ITTAGE_TABLES - 1)
+    {
+        u8 allocated = 0;
+        for(u8 i = l.provider + 1; i < ITTAGE_TABLES; i++)
+            if(!tables[i][l.idx[i]].u)
+            {
+                tables[i][l.idx[i]] = { l.tag[i], 0, 0, target };
+                allocated = 1;
+                allocs++;
+                break;
+            }
+
+        if(!allocated)
+            for(u8 i = l.provider + 1; i < ITTAGE_TABLES; i++)
+                tables[i][l.idx[i]].u--;
+    }
+}
+
+void ITTAGEPredictor::recover(u64 n, u64 target, u8 taken)
+{
+    dir->recover(n, target, taken);
+
+    if(!n || n > lookups.size()) return;
+
+    lookups.resize(n);
+    hist_spec = lookups.back().hist;
+    shift(hist_spec, taken, target);
+}
+
+void ITTAGEPredictor::flush()
+{
+    dir->flush();
+    lookups.clear();
+    hist_spec = hist_arch;
+}
+
+void ITTAGEPredictor::save(std::ostream& os)
+{
+    dir->save(os);
+    ckpt::put(os, tables);
+    ckpt::put(os, hist_arch.bits);
+}
+
+void ITTAGEPredictor::load(std::istream& is)
+{
+    dir->load(is);
+    ckpt::get(is, tables);
+    ckpt::get(is, hist_arch.bits);
+    hist_arch.refold(hlen);
+    flush();
+}
+
+std::stringstream ITTAGEPredictor::summary()
+{
+    std::stringstream ss;
+
+    ss << dir->summary().str() << "\nITTAGE history lengths:";
+    for(auto h : hlen) ss << " " << dec_u<0> << h / 2;
+    ss << "\nITTAGE provider base: " << dec_u<0> << provided[0];
+    for(u8 i = 0; i < ITTAGE_TABLES; i++) ss << " t" << +i << ": " << provided[i + 1];
+    ss << "\nITTAGE allocations:   " << allocs;
+
+    return ss;
+}
+
+LoopPredictor::LoopPredictor(BranchPredictor* dir)
+    : BranchPredictor(), dir(dir), overrides(0), override_misses(0), allocs(0)
+{
+    entries.fill({0, 0, 0, 0, 0, 0});
+    label = string(dir->name()) + "+loop";
+}
+
+// replay fetched directions on top of the committed iteration counts
+void LoopPredictor::resync()
+{
+    for(auto& e : entries) e.iter_spec = e.iter_arch;
+
+    for(auto& l : lookups)
+    {
+        LoopEntry& e = entries[l.rip % LOOP_ENTRIES];
+        if(e.rip == l.rip) e.iter_spec = l.taken ? e.iter_spec + 1 : 0;
+    }
+}
+
+u64 LoopPredictor::predict(u64 rip, u64 seq, u64 target, u8 kind)
+{
+    u64        next = dir->predict(rip, seq, target, kind);
+    LoopEntry& e    = entries[rip % LOOP_ENTRIES];
+    u8         used = 0;
+
+    if(kind == bk_direct && e.rip == rip && e.conf >= LOOP_CONF)
+    {
+        next = (e.iter_spec < e.trip) ? e.target : seq;
+        used = 1;
+        overrides++;
+        util::log(LOG_BP_ALL, "BP__:   Loop predictor: iteration ", dec_u<0>, e.iter_spec, " of ", e.trip, " at ",
+            hex_u<64>, rip, ".");
+    }
+
+    if(e.rip == rip) e.iter_spec = (next != seq) ? e.iter_spec + 1 : 0;
+    lookups.push_back({ rip, (u8)(next != seq), used });
+
+    return next;
+}
+
+void LoopPredictor::update(u64 rip, u64 target, u8 taken, u8 kind)
+{
+    dir->update(rip, target, taken, kind);
+
+    auto match = std::find_if(lookups.begin(), lookups.end(), [&](auto& l) { return l.rip == rip; });
+    if(match != lookups.end())
+    {
+        if(match->used && match->taken != taken) override_misses++;
+        lookups.erase(lookups.begin(), match + 1);
+    }
+
+    LoopEntry& e = entries[rip % LOOP_ENTRIES];
+    if(e.rip == rip)
+    {
+        if(taken)
+        {
+            e.target = target;
+            if(++e.iter_arch > LOOP_MAX_TRIP) e.rip = 0; // not a counted loop
+        }
+        else
+        {
+            if(e.iter_arch == e.trip && e.conf < 7) e.conf++;
+            else if(e.iter_arch != e.trip)
+            {
+                e.trip = e.iter_arch;
+                e.conf = 0;
+            }
+            e.iter_arch = 0;
+        }
+        resync();
+    }
+    // backward branch fell through, might be a loop exit
+    else if(kind == bk_direct && !taken && target < rip)
+    {
+        if(!e.rip || !e.conf)
+        {
+            e = { rip, target, 0, 0, 0, 0 };
+            allocs++;
+            resync();
+        }
+        else e.conf--;
+    }
+}
+
+void LoopPredictor::recover(u64 n, u64 target, u8 taken)
+{
+    dir->recover(n, target, taken);
+
+    if(!n || n > lookups.size()) return;
+
+    lookups.resize(n);
+    lookups.back().taken = taken;
+    resync();
+}
+
+void LoopPredictor::flush()
+{
+    dir->flush();
+    lookups.clear();
+    resync();
+}
+
+void LoopPredictor::save(std::ostream& os)
+{
+    dir->save(os);
+    ckpt::put(os, entries);
+}
+
+void LoopPredictor::load(std::istream& is)
+{
+    dir->load(is);
+    ckpt::get(is, entries);
+    flush();
+}
+
+std::stringstream LoopPredictor::summary()
+{
+    std::stringstream ss;
+
+    ss << dir->summary().str() << "\nLoop predictor: " << dec_u<0> << overrides << " overrides, " << override_misses
+       << " mispredicted, " << allocs << " allocations";
+
+    return ss;
+}
+
+ReturnStack::ReturnStack() : tos(RAS_DEPTH - 1), count(0), pushes(0), pops(0), hits(0), mispredicts(0), overflows(0),
+    underflows(0)
+{
+    stack.fill(0);
+}
+
+void ReturnStack::push(u64 seq_no, u64 ret)
+{
+    u8 next = (tos + 1) % RAS_DEPTH;
+    snapshots.push_back({ seq_no, tos, count, next, stack[next], 0 });
+
+    // oldest entry is overwritten
+    if(count == RAS_DEPTH) overflows++;
+    else count++;
+
+    tos = next;
+    stack[tos] = ret;
+    pushes++;
+
+    util::log(LOG_BP_ALL, "BP__:   RAS push ", hex_u<64>, ret, ".");
+}
+
+// target is left untouched if the stack is empty
+u8 ReturnStack::pop(u64 seq_no, u64& target)
+{
+    if(!count)
+    {
+        snapshots.push_back({ seq_no, tos, count, tos, stack[tos], 0 });
+        underflows++;
+        return 0;
+    }
+
+    target = stack[tos];
+    snapshots.push_back({ seq_no, tos, count, tos, stack[tos], target });
+
+    tos = (tos + RAS_DEPTH - 1) % RAS_DEPTH;
+    count--;
+    pops++;
+
+    util::log(LOG_BP_ALL, "BP__:   RAS pop ", hex_u<64>, target, ".");
+    return 1;
+}
+
+// compare predicted return address with the committed target
+void ReturnStack::verify(u64 seq_no, u64 target)
+{
+    for(auto& s : snapshots)
+        if(s.seq_no == seq_no && s.pred)
+        {
+            if(s.pred == target) hits++;
+            else                 mispredicts++;
+            return;
+        }
+}
+
+// drop snapshots of committed instructions
+void ReturnStack::retire(u64 seq_no)
+{
+    while(!snapshots.empty() && snapshots.front().seq_no < seq_no) snapshots.pop_front();
+}
+
+// undo all pushes/pops from seq_no on
+void ReturnStack::recover(u64 seq_no)
+{
+    while(!snapshots.empty() && snapshots.back().seq_no >= seq_no)
+    {
+        RASSnapshot& s = snapshots.back();
+        stack[s.idx] = s.val;
+        tos   = s.tos;
+        count = s.count;
+        snapshots.pop_back();
+    }
+}
+
+std::stringstream ReturnStack::summary()
+{
+    std::stringstream ss;
+
+    ss << "RAS " << dec_u<0> << RAS_DEPTH << " entries: " << pushes << " pushes, " << pops << " pops, " << hits
+       << " hits, " << mispredicts << " mispredicts, " << overflows << " overflows, " << underflows << " underflows";
+
+    return ss;
+}
+
+void ReturnStack::save(std::ostream& os)
+{
+    ReturnStack arch = *this;
+    arch.recover(0);
+
+    ckpt::put(os, arch.stack);
+    ckpt::put(os, arch.tos);
+    ckpt::put(os, arch.count);
+}
+
+void ReturnStack::load(std::istream& is)
+{
+    ckpt::get(is, stack);
+    ckpt::get(is, tos);
+    ckpt::get(is, count);
+    snapshots.clear();
+}
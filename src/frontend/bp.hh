@@ -1,9 +1,12 @@
 // o3 RISC simulator
 //
 // branch prediction
-// - predictor 1
-// - predictor 2
-// ..
+// - simple (sequential)
+// - set associative BTB
+// - TAGE
+// - ITTAGE
+// - loop predictor
+// - return address stack
 //
 // Lukas Heine 2021
 
@@ -11,39 +14,390 @@
 #define SIM_BP_H
 
 #include "../util.hh"
+#include "../checkpoint.hh"
 #include "fconf.hh"
 
-#include <unordered_map>
+#include <array>
+#include <bitset>
+
+typedef enum
+{
+    bp_simple, bp_btb, bp_tage,
+} predictors;
+
+typedef enum
+{
+    bk_direct,   // target encoded in instruction
+    bk_indirect, // target from register or memory
+} branch_kind;
+
+// fully associative LRU tags, storage is allocated once
+// a set associative buffer of the same capacity misses on a present key: conflict miss
+class ShadowTags
+{
+    public:
+    ShadowTags(u32 size);
+    // 1 if present, it becomes the most recently used key
+    u8   touch(u64 key);
+    // evicts the least recently used key if full
+    void insert(u64 key);
+    void erase(u64 key);
+
+    private:
+    static constexpr u32 nil = UINT32_MAX;
+
+    struct Node
+    {
+        u64 key;
+        u32 prev, next;  // LRU list, next links the spare nodes
+    }; // Node
+
+    u32  home(u64 key)   { return (key * 0x9e3779b97f4a7c15ull) >> (64 - bits); };
+    u32  slot(u64 key);  // index slot holding key or the empty slot it goes to
+    void unindex(u32 i);
+    void unlink(u32 n);
+    void push_front(u32 n);
+
+    vector<Node> nodes;
+    vector<u32>  index;  // linear probing, at most half full
+    const u8     bits;
+    const u32    mask;
+    u32          head = nil, tail = nil, spare = nil, used = 0;
+}; // ShadowTags
+
+// set associative, partially tagged target buffer with LRU replacement
+class BranchTargetBuffer
+{
+    public:
+    BranchTargetBuffer(u32 sets, u8 ways);
+    u8   lookup(u64 rip, u64& target);
+    void insert(u64 rip, u64 target);
+    void invalidate(u64 rip);
+    std::stringstream summary(const char* name);
+    void save(std::ostream& os);
+    void load(std::istream& is);
+
+    private:
+    struct BTBEntry
+    {
+        u32 tag;
+        u8  valid;
+        u8  age;    // 0: most recently used
+        u64 target;
+    }; // BTBEntry
+
+    u32  get_set(u64 rip)     { return (rip ^ (rip >> setbits)) & (sets - 1); };
+    u32  get_tag(u64 rip)     { return (rip >> setbits) & ((1ull << BTB_TAG_BITS) - 1); };
+    u64  get_key(u64 rip)     { return ((u64)get_tag(rip) << 32) | get_set(rip); };
+    void touch(BTBEntry* set, u8 way);
+
+    const u32           sets;
+    const u8            ways;
+    const u8            setbits;
+    vector<BTBEntry>    entries;    // sets * ways, allocated once
+    u64                 valid;      // valid entries
+
+    // stats, allocations of taken branches are classified against the shadow tags
+    u64        lookups, hits, conflict, capacity;
+    ShadowTags shadow;
+}; // BranchTargetBuffer
 
 class BranchPredictor
 {
     public:
     BranchPredictor() {};
     virtual ~BranchPredictor() {};
-    virtual u64  predict(u64 rip, u64 seq, u64 target) = 0;
-    virtual void update(u64 rip, u64 target, u8 taken) = 0;
+    virtual u64  predict(u64 rip, u64 seq, u64 target, u8 kind = bk_direct) = 0;
+    virtual void update(u64 rip, u64 target, u8 taken, u8 kind = bk_direct) = 0;
+
+    // speculative state, n: # of in flight predictions to keep, the last one was resolved to target/taken
+    virtual void recover(u64 n, u64 target, u8 taken) { (void) n; (void) target; (void) taken; };
+    virtual void flush()                    {};
+    virtual std::stringstream summary()     { return std::stringstream(); };
+    // committed tables for checkpoints, loading drops all in flight predictions
+    virtual void save(std::ostream& os)     { (void) os; };
+    virtual void load(std::istream& is)     { (void) is; };
+    virtual const char* name() = 0;
 }; // BranchPredictor
 
+BranchPredictor* new_predictor(u8 type, u8 ittage = 0, u8 loop = 0);
+// "simple", "btb", "tage" -> predictors, UINT8_MAX if unknown
+u8               predictor_id(const string& name);
+
+// compress the youngest len history bits to bits width
+template<size_t N>
+u32 fold_hist(const std::bitset<N>& hist, u16 len, u8 bits)
+{
+    u32 f = 0;
+    for(u16 i = 0; i < len; i++)
+        f ^= (u32)hist[i] << (i % bits);
+
+    return f & ((1 << bits) - 1);
+}
+
+// global history with the index and tag folds of each table, shifted along with it instead of refolding the history
+// https://jilp.org/vol8/v8paper1.pdf, section 4.3
+template<size_t N, u8 T, u8 IB, u8 TB>
+struct FoldedHistory
+{
+    std::bitset<N>     bits;
+    std::array<u32, T> idx  = {};  // IB wide
+    std::array<u32, T> tag  = {};  // TB wide
+    std::array<u32, T> tag1 = {};  // TB - 1 wide
+
+    // youngest bit is in, the oldest bit of each table leaves its fold
+    void push(u8 in, const std::array<u16, T>& len)
+    {
+        for(u8 i = 0; i < T; i++)
+        {
+            const u8 out = bits[len[i] - 1];
+            idx[i]  = shift_fold(idx[i], in, out, len[i], IB);
+            tag[i]  = shift_fold(tag[i], in, out, len[i], TB);
+            tag1[i] = shift_fold(tag1[i], in, out, len[i], TB - 1);
+        }
+        bits <<= 1;
+        bits[0] = in;
+    }
+
+    // after the bits were replaced
+    void refold(const std::array<u16, T>& len)
+    {
+        for(u8 i = 0; i < T; i++)
+        {
+            idx[i]  = fold_hist(bits, len[i], IB);
+            tag[i]  = fold_hist(bits, len[i], TB);
+            tag1[i] = fold_hist(bits, len[i], TB - 1);
+        }
+    }
+
+    static u32 shift_fold(u32 f, u8 in, u8 out, u16 len, u8 width)
+    {
+        f = (f << 1) | in;
+        f ^= (u32)out << (len % width);
+        f ^= f >> width;
+        return f & ((1 << width) - 1);
+    }
+}; // FoldedHistory
+
 class SimplePredictor : public BranchPredictor
 {
     public:
     SimplePredictor() : BranchPredictor() {};
     ~SimplePredictor() {};
-    u64  predict(u64 rip, u64 seq, u64 target);
-    void update(u64 rip, u64 target, u8 taken);
+    u64  predict(u64 rip, u64 seq, u64 target, u8 kind = bk_direct);
+    void update(u64 rip, u64 target, u8 taken, u8 kind = bk_direct);
+    const char* name() { return "simple"; };
 };
 
 class BTBPredictor : public BranchPredictor
 {
     public:
-    BTBPredictor() : BranchPredictor() {};
+    BTBPredictor() : BranchPredictor(), btb(BTB_SETS, BTB_WAYS), ibtb(BTB_IND_SETS, BTB_IND_WAYS) {};
     ~BTBPredictor() {};
-    u64  predict(u64 rip, u64 seq, u64 target);
-    void update(u64 rip, u64 target, u8 taken);
+    u64  predict(u64 rip, u64 seq, u64 target, u8 kind = bk_direct);
+    void update(u64 rip, u64 target, u8 taken, u8 kind = bk_direct);
+    std::stringstream summary();
+    void save(std::ostream& os);
+    void load(std::istream& is);
+    const char* name() { return "btb"; };
 
     private:
     // all not taken at start
-    std::unordered_map<u64, u64> btb;
+    BranchTargetBuffer btb;
+    BranchTargetBuffer ibtb;
 };
 
+typedef FoldedHistory<TAGE_HIST_MAX, TAGE_TABLES, TAGE_LOG_TABLE, TAGE_TAG_BITS> tage_hist;
+
+// https://jilp.org/vol8/v8paper1.pdf
+class TAGEPredictor : public BranchPredictor
+{
+    public:
+    TAGEPredictor();
+    ~TAGEPredictor() {};
+    u64  predict(u64 rip, u64 seq, u64 target, u8 kind = bk_direct);
+    void update(u64 rip, u64 target, u8 taken, u8 kind = bk_direct);
+    void recover(u64 n, u64 target, u8 taken);
+    void flush();
+    std::stringstream summary();
+    void save(std::ostream& os);
+    void load(std::istream& is);
+    const char* name() { return "tage"; };
+
+    private:
+    struct TAGEEntry
+    {
+        u16 tag;
+        i8  ctr;    // signed prediction counter, taken if >= 0
+        u8  u;      // useful counter
+    }; // TAGEEntry
+
+    // table lookup done at predict, reused for the update of the same branch
+    struct TAGELookup
+    {
+        u64       rip;
+        tage_hist ghr;                 // history before this branch
+        u32       idx[TAGE_TABLES];
+        u16       tag[TAGE_TABLES];
+        i8        provider;            // providing table, -1 for base
+        i8        alt;                 // alternate table, -1 for base
+        u8        pred;                // final prediction
+        u8        altpred;             // alternate prediction
+    }; // TAGELookup
+
+    TAGELookup lookup(u64 rip, const tage_hist& hist);
+    u8         base_pred(u64 rip)            { return base[rip & ((1 << TAGE_LOG_BASE) - 1)] >= 0; };
+    void       base_update(u64 rip, u8 taken);
+
+    std::array<i8, (1 << TAGE_LOG_BASE)>                                base;
+    std::array<std::array<TAGEEntry, (1 << TAGE_LOG_TABLE)>, TAGE_TABLES> tables;
+    std::array<u16, TAGE_TABLES>                                        hlen;   // history lengths
+    BranchTargetBuffer                                                  btb;
+    BranchTargetBuffer                                                  ibtb;
+
+    tage_hist               ghr_spec;   // updated at predict
+    tage_hist               ghr_arch;   // updated at commit
+    std::deque<TAGELookup>  lookups;    // in flight predictions, oldest first
+    i8                      use_alt;    // use alternate prediction for new entries if >= 0
+    u64                     branches;   // updates since last useful reset
+
+    u64                     provided[TAGE_TABLES + 1];
+    u64                     allocs;
+};
+
+typedef FoldedHistory<2 * ITTAGE_HIST_MAX, ITTAGE_TABLES, ITTAGE_LOG_TABLE, ITTAGE_TAG_BITS> ittage_hist;
+
+// indirect targets from tagged tables indexed with direction and target path history
+// wraps the direction predictor, which provides all other predictions and the base target
+class ITTAGEPredictor : public BranchPredictor
+{
+    public:
+    ITTAGEPredictor(BranchPredictor* dir);
+    ~ITTAGEPredictor() { delete dir; };
+    u64  predict(u64 rip, u64 seq, u64 target, u8 kind = bk_direct);
+    void update(u64 rip, u64 target, u8 taken, u8 kind = bk_direct);
+    void recover(u64 n, u64 target, u8 taken);
+    void flush();
+    std::stringstream summary();
+    void save(std::ostream& os);
+    void load(std::istream& is);
+    const char* name() { return label.c_str(); };
+
+    private:
+    struct ITTAGEEntry
+    {
+        u16 tag;
+        u8  ctr;    // confidence
+        u8  u;      // useful counter
+        u64 target;
+    }; // ITTAGEEntry
+
+    // every predicted branch keeps the history it saw, only indirect ones do a lookup
+    struct ITTAGELookup
+    {
+        u64         rip;
+        ittage_hist hist;
+        u8          indirect;
+        u32         idx[ITTAGE_TABLES];
+        u16         tag[ITTAGE_TABLES];
+        i8          provider;
+        i8          alt;
+        u64         pred;
+        u64         altpred;
+    }; // ITTAGELookup
+
+    void shift(ittage_hist& hist, u8 taken, u64 target);
+
+    BranchPredictor*                                                            dir;
+    std::array<std::array<ITTAGEEntry, (1 << ITTAGE_LOG_TABLE)>, ITTAGE_TABLES> tables;
+    std::array<u16, ITTAGE_TABLES>                                              hlen;
+
+    ittage_hist              hist_spec;
+    ittage_hist              hist_arch;
+    std::deque<ITTAGELookup> lookups;
+    string                   label;
+
+    u64                      provided[ITTAGE_TABLES + 1];
+    u64                      allocs;
+}; // ITTAGEPredictor
+
+// trip counts of counted loops, overrides the wrapped predictor once a count repeated LOOP_CONF times
+class LoopPredictor : public BranchPredictor
+{
+    public:
+    LoopPredictor(BranchPredictor* dir);
+    ~LoopPredictor() { delete dir; };
+    u64  predict(u64 rip, u64 seq, u64 target, u8 kind = bk_direct);
+    void update(u64 rip, u64 target, u8 taken, u8 kind = bk_direct);
+    void recover(u64 n, u64 target, u8 taken);
+    void flush();
+    std::stringstream summary();
+    void save(std::ostream& os);
+    void load(std::istream& is);
+    const char* name() { return label.c_str(); };
+
+    private:
+    struct LoopEntry
+    {
+        u64 rip;       // 0 if unused
+        u64 target;
+        u16 trip;      // taken iterations before the exit
+        u16 iter_arch; // taken iterations committed since the last exit
+        u16 iter_spec; // taken iterations fetched since the last exit
+        u8  conf;      // trip count repetitions
+    }; // LoopEntry
+
+    struct LoopLookup
+    {
+        u64 rip;
+        u8  taken;     // fetched direction
+        u8  used;      // loop predictor provided the direction
+    }; // LoopLookup
+
+    void resync();
+
+    BranchPredictor*                      dir;
+    std::array<LoopEntry, LOOP_ENTRIES>   entries;
+    std::deque<LoopLookup>                lookups;
+    string                                label;
+
+    u64 overrides, override_misses, allocs;
+}; // LoopPredictor
+
+// circular return address stack for x64 call/ret
+// every push/pop in flight keeps the overwritten state and is undone youngest first on recovery
+// seq_no: index of the macro op in the instruction stream (commited_macro + in_flight index)
+class ReturnStack
+{
+    public:
+    ReturnStack();
+    void push(u64 seq_no, u64 ret);
+    u8   pop(u64 seq_no, u64& target);
+    void verify(u64 seq_no, u64 target);
+    void retire(u64 seq_no);
+    void recover(u64 seq_no);
+    std::stringstream summary();
+    // committed stack only, in flight pushes and pops are undone
+    void save(std::ostream& os);
+    void load(std::istream& is);
+
+    private:
+    struct RASSnapshot
+    {
+        u64 seq_no;
+        u8  tos;
+        u8  count;
+        u8  idx;     // entry written by a push
+        u64 val;     // and its previous content
+        u64 pred;    // predicted return address, 0 if not a ret or empty
+    }; // RASSnapshot
+
+    std::array<u64, RAS_DEPTH> stack;
+    u8                         tos;       // top entry
+    u8                         count;     // valid entries
+    std::deque<RASSnapshot>    snapshots; // in flight calls and rets, oldest first
+
+    u64 pushes, pops, hits, mispredicts, overflows, underflows;
+}; // ReturnStack
+
 #endif // SIM_BP_H
\ No newline at end of file
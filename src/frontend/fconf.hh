@@ -12,21 +12,69 @@
 #define FETCH_WIDTH     4                   // RISC instructions fetched each cycle
 #define FETCH_LATENCY   1                   // fetch + bp latency
 
+// decoupled frontend
+#define FTQ_SIZE        8                   // predicted fetch blocks queued between branch predictor and fetch
+#define FTQ_BLOCK_BYTES 64                  // fetch blocks end at this alignment or at a predicted taken branch
+#define FTQ_BLOCK_MOPS  16                  // max instructions per fetch block
+
 // branch prediction
-#define BTB_SIZE        4096
+#define BTB_SETS        512                 // direct branch targets
+#define BTB_WAYS        8
+#define BTB_TAG_BITS    16                  // partial tag width
+#define BTB_IND_SETS    64                  // indirect branch targets
+#define BTB_IND_WAYS    4
+#define RAS_DEPTH       16                  // return address stack entries
+#define LOOP_ENTRIES    64                  // loop predictor entries (direct mapped)
+#define LOOP_CONF       2                   // repeated trip counts before the loop predictor overrides
+#define LOOP_MAX_TRIP   4095                // longer loops are not tracked
+
+// TAGE: bimodal base table and TAGE_TABLES tagged tables with geometric history lengths
+#define TAGE_TABLES     7                   // # of tagged tables
+#define TAGE_LOG_BASE   13                  // log2 entries of the base table
+#define TAGE_LOG_TABLE  10                  // log2 entries of each tagged table
+#define TAGE_TAG_BITS   10                  // partial tag width
+#define TAGE_HIST_MIN   5                   // history length of the shortest table
+#define TAGE_HIST_MAX   130                 // history length of the longest table
+#define TAGE_CTR_BITS   3                   // prediction counter width of tagged entries
+#define TAGE_U_RESET    (1 << 18)           // branches between useful bit resets
+
+// ITTAGE: tagged indirect target tables on top of the direction predictor's iBTB
+#define ITTAGE_TABLES   4                   // # of tagged tables
+#define ITTAGE_LOG_TABLE 9                  // log2 entries of each tagged table
+#define ITTAGE_TAG_BITS 11                  // partial tag width
+#define ITTAGE_HIST_MIN 4                   // branches in the history of the shortest table
+#define ITTAGE_HIST_MAX 64                  // branches in the history of the longest table
 
 // x64 config
-#define X64_FETCH_BYTES 16                  // # of bytes read from memory and sent to predecode
+#define X64_FETCH_BYTES 16                  // # of bytes read from memory and sent to predecode (16, 32, 64)
 #define X64_FETCH_ALIGN ~(X64_FETCH_BYTES - 1)
+#define X64_PD_BUFFER   (X64_FETCH_BYTES + 16) // fetch block + bytes carried from the last block, SIMD padded
 
-#define IQUEUE_SIZE     50                  // # of x64 instructions in the instruction queue 
+#define IQUEUE_SIZE     50                  // # of x64 instructions in the instruction queue, > X64_FETCH_BYTES
 
 #define PD_LATENCY      1
 
+#define X64_CMPLX_UOPS  4                   // max uops from the complex decoder, longer bundles use the MSROM
+#define X64_MSROM_WIDTH 4                   // uops per cycle from the MSROM
+#define X64_MSROM_PENALTY 2                 // cycles to switch from the decoders to the MSROM
+#define X64_MAX_UOPS    16                  // uop bundle capacity of one macro op
+
+#define LSD_ENABLE      1                   // loop stream detector: replay locked loops from the loop buffer
+#define LSD_SIZE        28                  // max uops in a locked loop body
+#define LSD_WIDTH       4                   // uops per cycle sent from the loop buffer
+
+// trace replay
+#define REPLAY_WIDTH    4                   // recorded uops sent each cycle, whole macro ops
+#define REPLAY_PENALTY  4                   // cycles added to each mispredict for the wrong path fetch that isn't replayed
+
+#define X64_MACRO_FUSION 1                  // decode flag setting instruction + jcc as one pair
+#define X64_MICRO_FUSION 1                  // ld + op bundles count as one uop, fit the simple decoders
+
 
 // logging
 #define LOG_FE_INIT     1
 #define LOG_FE_FETCH    5
+#define LOG_FE_FTQ      3
 
 #define LOG_BP_ALL      3
 
@@ -35,6 +83,15 @@
 #define LOG_64_PIPE2    3
 #define LOG_64_PIPE3    6
 
-static_assert((bits_set(X64_FETCH_BYTES) == 1));
+static_assert((bits_set(X64_FETCH_BYTES) == 1) && X64_FETCH_BYTES >= 16 && X64_FETCH_BYTES <= 64);
+static_assert(IQUEUE_SIZE > X64_FETCH_BYTES);
+static_assert((bits_set(FTQ_BLOCK_BYTES) == 1) && FTQ_SIZE >= 1 && FTQ_BLOCK_MOPS >= 1);
+static_assert(RAS_DEPTH >= 1 && RAS_DEPTH < 256);
+static_assert(X64_MSROM_WIDTH >= 1 && X64_MSROM_WIDTH <= X64_CMPLX_UOPS);
+static_assert(X64_MAX_UOPS > X64_CMPLX_UOPS && X64_MAX_UOPS < 256);
+static_assert(LOOP_ENTRIES >= 1 && LOOP_MAX_TRIP < UINT16_MAX);
+static_assert((bits_set(BTB_SETS) == 1) && (bits_set(BTB_IND_SETS) == 1) && BTB_TAG_BITS <= 32);
+static_assert(ITTAGE_TABLES >= 1 && ITTAGE_TAG_BITS <= 16 && ITTAGE_HIST_MIN <= ITTAGE_HIST_MAX);
+static_assert(TAGE_TABLES >= 1 && TAGE_TAG_BITS <= 16 && TAGE_LOG_TABLE <= 24 && TAGE_HIST_MIN <= TAGE_HIST_MAX);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,116 @@
+// o3 RISC simulator
+//
+// decoupled frontend
+// - branch predictor runs ahead of fetch
+// - fetch target queue
+//
+// Lukas Heine 2021
+
+#include "frontend.hh"
+#include "fconf.hh"
+
+// predict the next fetch block and queue it for fetch
+u8 Frontend::predict()
+{
+    ftq_cycles++;
+    ftq_occupancy += ftq.size();
+    if(ftq.empty()) ftq_empty++;
+
+    if(!(state.active & if_active) || bp_halt || state.cycle < resume_at)
+        return 1;
+
+    if(ftq.size() >= cfg.ftq_size)
+    {
+        util::log(LOG_FE_FTQ, "BP__:   FTQ is full.");
+        ftq_full++;
+        return 0;
+    }
+
+    FetchTarget ft = { bpaddr, bpaddr, bpaddr, 0 };
+    u64 blockend   = (bpaddr & ~(u64)(FTQ_BLOCK_BYTES - 1)) + FTQ_BLOCK_BYTES;
+    u64 seq_no     = state.commited_macro + state.in_flight.size() - 1 + ftq_mops; // of the first instruction
+
+    // sequential instructions until a predicted taken branch or the end of the block
+    for(; ft.mops < cfg.ftq_block_mops;)
+    {
+        u64 seq = 0, pred = 0;
+        if(predict_next(ft.end, seq_no + ft.mops, seq, pred))
+        {
+            util::log(LOG_FE_FTQ, "BP__:   Nothing to predict at v.", hex_u<64>, ft.end, ", fetch takes over.");
+            bp_halt = 1;
+            break;
+        }
+
+        ft.end  = seq;
+        ft.next = pred;
+        ft.mops++;
+
+        if(pred != seq || seq >= blockend) break;
+    }
+
+    if(!ft.mops) return 0;
+
+    util::log(LOG_FE_FTQ, "BP__:   Fetch block v.", hex_u<64>, ft.start, " - v.", hex_u<64>, ft.end, " (",
+        dec_u<0>, ft.mops, " instructions), next v.", hex_u<64>, ft.next);
+
+    ftq.push_back(ft);
+    ftq_mops += ft.mops;
+    ftq_blocks++;
+    bpaddr = ft.next;
+
+    prefetch(ft);
+    return 0;
+}
+
+// fetch of one instruction, returns the predicted next rip
+u64 Frontend::consume(u64 seq)
+{
+    // predictor stopped, nothing to follow
+    if(ftq.empty()) return seq;
+
+    FetchTarget& ft = ftq.front();
+    ftq_mops--;
+
+    if(--ft.mops) return seq;
+
+    if(seq != ft.end)
+        util::log(LOG_FE_FTQ, "BP__: * Fetch block ended at v.", hex_u<64>, seq, " instead of v.", hex_u<64>, ft.end);
+
+    u64 next = ft.next;
+    ftq.pop_front();
+    return next;
+}
+
+// drop all predicted blocks and restart the predictor at the fetch address
+void Frontend::flush_ftq()
+{
+    ftq.clear();
+    bpaddr   = fetchaddr;
+    ftq_mops = 0;
+    bp_halt  = 0;
+}
+
+// FDIP: request the lines of a fetch block before fetch gets there
+// there is no instruction cache yet, so requests are only counted
+void Frontend::prefetch(const FetchTarget& ft)
+{
+    for(u64 line = ft.start & ~(u64)(FTQ_BLOCK_BYTES - 1); line < ft.end; line += FTQ_BLOCK_BYTES)
+    {
+        if(line == last_prefetch) continue;
+
+        util::log(LOG_FE_FTQ, "BP__:   Prefetching line v.", hex_u<64>, line);
+        last_prefetch = line;
+        prefetches++;
+    }
+}
+
+std::stringstream Frontend::ftq_summary()
+{
+    std::stringstream ss;
+
+    ss << "FTQ:            " << dec_u<0> << ftq_blocks << " blocks. Avg occupancy: "
+       << (ftq_cycles ? ((f32)ftq_occupancy / (f32)ftq_cycles) : 0) << ". Empty: " << dec_u<0> << ftq_empty
+       << " cycles. Full: " << dec_u<0> << ftq_full << " cycles. Prefetched lines: " << dec_u<0> << prefetches;
+
+    return ss;
+}
@@ -12,9 +12,21 @@
 #include "../util.hh"
 #include "../sim.hh"
 #include "../mem.hh"
+#include "../config.hh"
 
 #include "bp.hh"
 
+namespace trace { class Reader; }
+
+// fetch block predicted ahead of fetch
+struct FetchTarget
+{
+    u64 start; // first instruction
+    u64 end;   // sequential rip of the last instruction
+    u64 next;  // predicted start of the following block
+    u16 mops;  // instructions left to fetch
+}; // FetchTarget
+
 class Frontend
 {
     public:
@@ -25,37 +37,124 @@ class Frontend
     // Frontend(std::vector<u8>& bytecode, LatchQueue<struct uop>* uqueue,
     //         Simulator::SimulatorState& state) 
     //     : bytecode(bytecode), uqueue(uqueue), state(state) {};
-    Frontend(MemoryManager& mmu, LatchQueue<uop>* uqueue, Simulator::SimulatorState& state)
-        : mmu(mmu), uqueue(uqueue), state(state) {};
+    Frontend(MemoryManager& mmu, LatchQueue<uop>* uqueue, Simulator::SimulatorState& state,
+        const FrontendConfig& cfg)
+        : ras(nullptr), cfg(cfg), fetchaddr(0), mmu(mmu), uqueue(uqueue), state(state), resume_at(0) { flush_ftq(); };
+    virtual ~Frontend() {};
     virtual u8                cycle()   = 0;
     virtual u8                flush()   = 0;
     virtual std::stringstream summary() = 0;
 
-    void       set_fetchaddr(u64 rip)   { fetchaddr = rip; };
+    void       set_fetchaddr(u64 rip)   { fetchaddr = rip; flush_ftq(); };
+    // restart fetch at rip, but not before cycle
+    void       redirect(u64 rip, u64 cycle) { fetchaddr = rip; resume_at = cycle; flush_ftq(); };
+
+    u8                predict();
+    std::stringstream ftq_summary();
     
-    // overwrite this and then check at alloc to remove any load/exec stalls
-    // need free and used list, get treg at alloc, discard after first read
-    // virtual u8 is_tempreg(u8 reg)       { return reg & 0; };
+    // frontend temporary (uop register number), dead after the last uop of its macro op
+    // the core does not write those back to the ARF
+    virtual u8        is_tempreg(u8 regcls, u8 reg) { (void)(regcls); (void)(reg); return 0; };
+
+    // functional mode: uops of the macro op at rip without fetch timing, 1 if it can't be decoded
+    // the predictor and RAS see it like at fetch, seq_no numbers the macro op for the RAS
+    virtual u8        decode_at(u64 rip, u64 seq_no, vector<uop>& uops, u64& seq, u64& pred) = 0;
 
     BranchPredictor*            bp;
+    ReturnStack*                ras;         // call/ret prediction, nullptr if unused
 
     protected:
+    // predecode the instruction at rip and predict its successor, 1 if there is nothing to decode
+    virtual u8   predict_next(u64 rip, u64 seq_no, u64& seq, u64& pred) = 0;
+    virtual void prefetch(const FetchTarget& ft);
+    u64          consume(u64 seq);
+    void         flush_ftq();
+
+    const FrontendConfig        cfg;
     u64                         fetchaddr;
     MemoryManager&              mmu;
     LatchQueue<uop>*            uqueue;
     Simulator::SimulatorState&  state;
+    u64                         resume_at;   // fetch is stalled until this cycle
+
+    // fetch target queue
+    std::deque<FetchTarget>     ftq;
+    u64                         bpaddr;      // next rip the predictor starts a block at
+    u64                         ftq_mops;    // predicted instructions not fetched yet
+    u8                          bp_halt;     // predictor hit undecodable bytes, fetch runs sequentially
+
+    u64                         ftq_cycles    = 0;
+    u64                         ftq_occupancy = 0; // sum of blocks in the FTQ each cycle
+    u64                         ftq_empty     = 0;
+    u64                         ftq_full      = 0;
+    u64                         ftq_blocks    = 0;
+    u64                         prefetches    = 0; // lines requested ahead of fetch
+    u64                         last_prefetch = 0;
 };
 
 class RiscFrontend : public Frontend
 {
     public:
-    RiscFrontend(MemoryManager& mmu, LatchQueue<uop>* uqueue,
-            Simulator::SimulatorState& state);
+    RiscFrontend(MemoryManager& mmu, LatchQueue<uop>* uqueue, Simulator::SimulatorState& state,
+            const FrontendConfig& cfg, u8 bpred = bp_btb, u8 ittage = 0, u8 loop = 0);
     ~RiscFrontend();
     u8                cycle();
     u8                flush();
     std::stringstream summary();
+    u8                decode_at(u64 rip, u64 seq_no, vector<uop>& uops, u64& seq, u64& pred);
+
+    protected:
+    u8                predict_next(u64 rip, u64 seq_no, u64& seq, u64& pred);
+};
+
+// feeds the decoded uops of a commit trace instead of fetching and decoding
+// - branches are predicted at their recorded rip, the core resolves them against the executed outcome
+// - the wrong path is not replayed, fetch stalls until the redirect and then waits cfg.replay_penalty
+// - the trace has to start at the same architectural state as the replay
+class TraceFrontend : public Frontend
+{
+    public:
+    TraceFrontend(MemoryManager& mmu, LatchQueue<uop>* uqueue, Simulator::SimulatorState& state,
+            const FrontendConfig& cfg, const string& path, u8 fe_id, u8 bpred = bp_btb, u8 ittage = 0, u8 loop = 0);
+    ~TraceFrontend();
+    u8                cycle();
+    u8                flush();
+    std::stringstream summary();
+    u8                decode_at(u64 rip, u64 seq_no, vector<uop>& uops, u64& seq, u64& pred);
+
+    protected:
+    u8                predict_next(u64 rip, u64 seq_no, u64& seq, u64& pred);
+
+    private:
+    // recorded macro op, its uops are in ops
+    struct MacroOp
+    {
+        u64 rip;
+        u64 seq;
+        u64 next;   // recorded successor
+        u64 target; // passed to the predictor
+        u64 first;  // uop number
+        u16 uops;
+        u8  branch;
+        u8  kind;
+    }; // MacroOp
+
+    u8  fill(u64 idx);
+
+    std::unique_ptr<trace::Reader> reader;
+    const u8                       fe_id;
+    std::deque<MacroOp>            window;           // macro ops from number base on, refetched after squashes
+    std::deque<uop>                ops;              // uops from number ops_base on
+    u64                            base     = UINT64_MAX; // set by the first cycle, a checkpoint may be loaded
+    u64                            ops_base = 0;
+    u64                            read_ops = 0;     // uops read from the trace
+    u8                             wrong_path = 0;   // a mispredicted macro op was sent
+    u8                             ended      = 0;   // end of trace reached
 
+    u64                            replayed_mops = 0;
+    u64                            replayed_uops = 0;
+    u64                            stall_cycles  = 0; // waiting for a mispredict to resolve
+    u64                            penalties     = 0;
 };
 
 #endif // SIM_FRONTEND_H
@@ -0,0 +1,184 @@
+// o3 RISC simulator
+//
+// trace replay frontend
+// - recorded macro op window
+// - branch prediction against the recorded path
+// - wrong path approximation
+//
+// Lukas Heine 2021
+
+#include "frontend.hh"
+#include "fconf.hh"
+
+#include "../trace.hh"
+#include "../core/uops.hh"
+
+TraceFrontend::TraceFrontend(MemoryManager& mmu, LatchQueue<uop>* uqueue, Simulator::SimulatorState& state,
+        const FrontendConfig& cfg, const string& path, u8 fe_id, u8 bpred, u8 ittage, u8 loop)
+    : Frontend(mmu, uqueue, state, cfg), reader(std::make_unique<trace::Reader>(path)), fe_id(fe_id)
+{
+    // register numbers and branch targets differ between the frontends
+    if(reader->header.frontend != fe_id) throw TraceException();
+
+    bp = new_predictor(bpred, ittage, loop);
+
+    util::log(LOG_FE_INIT, "Trace frontend initialized with ", bp->name(), " predictor.\n");
+}
+
+TraceFrontend::~TraceFrontend()
+{
+    delete bp;
+}
+
+// read until the window holds macro op idx, 0 at the end of the trace
+u8 TraceFrontend::fill(u64 idx)
+{
+    trace::Record r;
+    MacroOp       mop   = {};
+    u8            taken = 0;
+    mop.first = read_ops;
+
+    while(window.size() <= idx)
+    {
+        if(ended || !reader->next(r))
+        {
+            ended = 1;
+            return 0;
+        }
+
+        ops.push_back(r.op);
+        read_ops++;
+        mop.uops++;
+
+        if(r.flags & trace::rf_branch)
+        {
+            mop.branch = 1;
+            mop.kind   = is_indirect(r.op) ? bk_indirect : bk_direct;
+            mop.target = (fe_id == x64) ? UINT64_MAX : r.op.imm; // like the live frontends
+            taken      = r.flags & trace::rf_taken;
+            if(taken) mop.next = r.vaddr;
+        }
+
+        if(r.flags & trace::rf_last)
+        {
+            mop.rip = r.rip;
+            mop.seq = r.seq;
+            if(!taken) mop.next = r.seq;
+            window.push_back(mop);
+
+            mop       = {};
+            mop.first = read_ops;
+            taken     = 0;
+        }
+    }
+    return 1;
+}
+
+// send recorded macro ops while fetch follows the recorded path
+u8 TraceFrontend::cycle()
+{
+    if( !(state.active & if_active) )
+    {
+        util::log(LOG_FE_FETCH, "IF__:   Frontend inactive.\n");
+        return 1;
+    }
+
+    if(state.cycle < resume_at)
+    {
+        util::log(LOG_FE_FETCH, "IF__:   Waiting for redirect.\n");
+        return 0;
+    }
+
+    // committed macro ops are never refetched
+    if(base == UINT64_MAX) base = state.commited_macro;
+    for(; (base < state.commited_macro) && !window.empty(); base++)
+    {
+        ops.erase(ops.begin(), ops.begin() + window.front().uops);
+        ops_base += window.front().uops;
+        window.pop_front();
+    }
+
+    for(u32 sent = 0; sent < cfg.replay_width;)
+    {
+        const u64 idx = state.commited_macro + state.in_flight.size() - 1 - base;
+        if(!fill(idx))
+        {
+            util::log(LOG_FE_FETCH, "IF__:   End of trace reached.");
+            state.active &= ~fe_active; // restarted by a redirect
+            break;
+        }
+
+        const MacroOp& mop = window[idx];
+        if(mop.rip != fetchaddr)
+        {
+            // nothing left in flight to redirect fetch, execution went elsewhere than the trace
+            if(state.in_flight.size() == 1)
+            {
+                util::log_always("Replay left the trace at v.", hex_u<64>, fetchaddr, ", recorded v.", mop.rip, ".");
+                state.active &= ~fe_active;
+                break;
+            }
+
+            util::log(LOG_FE_FETCH, "IF__:   Wrong path at v.", hex_u<64>, fetchaddr, ", waiting for redirect.");
+            stall_cycles++;
+            break;
+        }
+
+        // back on the recorded path after a mispredict
+        if(wrong_path)
+        {
+            wrong_path = 0;
+            penalties++;
+            if(cfg.replay_penalty)
+            {
+                resume_at = state.cycle + cfg.replay_penalty;
+                break;
+            }
+        }
+
+        if(uqueue->size() + mop.uops > cfg.uqueue_size)
+        {
+            util::log(LOG_FE_FETCH, "IF__: * uQ is full. Not sending any instructions.");
+            break;
+        }
+        if(sent && (sent + mop.uops > cfg.replay_width)) break;
+
+        const u64 pred = mop.branch ? bp->predict(mop.rip, mop.seq, mop.target, mop.kind) : mop.seq;
+        wrong_path = (pred != mop.next);
+
+        util::log(LOG_FE_FETCH, "IF__:   Replaying v.", hex_u<64>, mop.rip, ", next v.", pred, ".");
+
+        state.seq_addrs.push_back(mop.seq);
+        state.in_flight.push_back(pred);
+        fetchaddr = pred;
+
+        for(u16 i = 0; i < mop.uops; i++)
+            uqueue->push_back(state.cycle + cfg.fetch_latency, ops[mop.first - ops_base + i]);
+
+        sent += mop.uops;
+        replayed_mops++;
+        replayed_uops += mop.uops;
+    }
+
+    util::log(5, "");
+    return 0;
+}
+
+// the window is indexed by the core's macro op numbers, there is nothing to resynchronize
+u8 TraceFrontend::flush()
+{
+    return 0;
+}
+
+// there is no functional mode on a trace
+u8 TraceFrontend::predict_next(u64 rip, u64 seq_no, u64& seq, u64& pred)
+{
+    (void) rip; (void) seq_no; (void) seq; (void) pred;
+    return 1;
+}
+
+u8 TraceFrontend::decode_at(u64 rip, u64 seq_no, vector<uop>& uops, u64& seq, u64& pred)
+{
+    (void) uops;
+    return predict_next(rip, seq_no, seq, pred);
+}
@@ -11,12 +11,12 @@
 
 #include <endian.h>
 
-RiscFrontend::RiscFrontend(MemoryManager& mmu, LatchQueue<uop>* uqueue,
-        Simulator::SimulatorState& state) : Frontend(mmu, uqueue, state)
+RiscFrontend::RiscFrontend(MemoryManager& mmu, LatchQueue<uop>* uqueue, Simulator::SimulatorState& state,
+        const FrontendConfig& cfg, u8 bpred, u8 ittage, u8 loop) : Frontend(mmu, uqueue, state, cfg)
 {
-    bp = new BTBPredictor();
+    bp = new_predictor(bpred, ittage, loop);
 
-    util::log(LOG_FE_INIT, "RISC frontend initialized.\n");
+    util::log(LOG_FE_INIT, "RISC frontend initialized with ", bp->name(), " predictor.\n");
 }
 
 RiscFrontend::~RiscFrontend()
@@ -24,7 +24,7 @@ RiscFrontend::~RiscFrontend()
     delete bp;
 }
 
-// fetch only
+// predict and fetch
 u8 RiscFrontend::cycle()
 {
     // todo fetch traces instead of sequential ops? -> trace cache in bp
@@ -35,19 +35,33 @@ u8 RiscFrontend::cycle()
         return 1;
     }
 
+    if(state.cycle < resume_at)
+    {
+        util::log(LOG_FE_FETCH, "IF__:   Waiting for redirect.\n");
+        return 0;
+    }
+
+    predict();
+
     util::log(LOG_FE_FETCH, "IF__:   Fetching new instructions from memory.");
 
     std::pair<uop, u64> fetch = { zero_op, 0 };
     uop cur_op = zero_op;
 
-    for(u64 slot = 0; slot < FETCH_WIDTH; slot++)
+    for(u64 slot = 0; slot < cfg.fetch_width; slot++)
     {
-        if(uqueue->size() >= UQUEUE_SIZE)
+        if(uqueue->size() >= cfg.uqueue_size)
         {
             util::log(LOG_FE_FETCH, "IF__: * uQ is full. Not fetching any instructions.");
             break;
         }
 
+        if(ftq.empty() && !bp_halt)
+        {
+            util::log(LOG_FE_FETCH, "IF__:   FTQ is empty.");
+            break;
+        }
+
         try
         {
             util::log(LOG_FE_FETCH, "IF__:   Fetchaddr: ", hex_u<64>, fetchaddr);
@@ -63,7 +77,7 @@ u8 RiscFrontend::cycle()
             cur_op = fetch.first;
 
             cur_op.opcode  = be16toh(cur_op.opcode);
-            cur_op.control = be16toh(cur_op.control) | mop_first | mop_last; // all uops are standalone here!
+            cur_op.control = (be16toh(cur_op.control) & ~fuse_next) | mop_first | mop_last; // all uops are standalone here!
             cur_op.imm     = be64toh(cur_op.imm);
 
             util::log(LOG_FE_FETCH, "IF__:   Fetched instruction ", cur_op, ".");
@@ -108,12 +122,12 @@ u8 RiscFrontend::cycle()
    
         u64 seq = fetchaddr + 0x10;
         state.seq_addrs.push_back(seq);
-        fetchaddr = (is_branch(cur_op) ? bp->predict(fetchaddr, seq, cur_op.imm) : seq);
+        fetchaddr = consume(seq);
         state.in_flight.push_back(fetchaddr); // predicted next instruction
 
         try
         {
-            uqueue->push_back( (state.cycle + FETCH_LATENCY + fetch.second), cur_op );
+            uqueue->push_back( (state.cycle + cfg.fetch_latency + fetch.second), cur_op );
         }
         catch(const LatchFullException& fe) // this should _never_ occur since size is checked
         {
@@ -128,5 +142,41 @@ u8 RiscFrontend::cycle()
 
 u8 RiscFrontend::flush()
 {
+    flush_ftq();
+    return 0;
+}
+
+// instructions are read ahead of fetch to find the branches
+u8 RiscFrontend::predict_next(u64 rip, u64 seq_no, u64& seq, u64& pred)
+{
+    (void) seq_no; // no RAS
+
+    uop op = zero_op;
+    try
+    {
+        op = mmu.readT<uop>(rip, MM::p_x);
+    }
+    catch(const MemoryManagerException& mme) { return 1; }
+
+    op.opcode  = be16toh(op.opcode);
+    op.control = be16toh(op.control);
+    op.imm     = be64toh(op.imm);
+
+    seq  = rip + 0x10;
+    pred = (is_branch(op) ? bp->predict(rip, seq, op.imm, is_indirect(op) ? bk_indirect : bk_direct) : seq);
+    return 0;
+}
+
+// uops are the instructions here, there is nothing to decode
+u8 RiscFrontend::decode_at(u64 rip, u64 seq_no, vector<uop>& uops, u64& seq, u64& pred)
+{
+    if(predict_next(rip, seq_no, seq, pred)) return 1;
+
+    uop op     = mmu.readT<uop>(rip, MM::p_x);
+    op.opcode  = be16toh(op.opcode);
+    op.control = (be16toh(op.control) & ~fuse_next) | mop_first | mop_last;
+    op.imm     = be64toh(op.imm);
+
+    uops.push_back(op);
     return 0;
 }
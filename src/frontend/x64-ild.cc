@@ -0,0 +1,192 @@
+// o3 RISC simulator
+//
+// x64 frontend
+// - instruction length decoder
+// - prefix detection
+//
+// Lukas Heine 2021
+
+#include "x64.hh"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif // __SSE2__
+
+namespace x64ild
+{
+
+// trailing zero count of a 128 bit mask, x != 0
+static inline u8 ctz128(u128 x)
+{
+    u64 lo = (u64)x;
+    return lo ? __builtin_ctzll(lo) : 64 + __builtin_ctzll((u64)(x >> 64));
+}
+
+// immediate size of 1 byte group opcodes depends on modrm.reg, these need an opinfo lookup
+// resolved once for all operand sizes
+static u8 group_immsz(const u8 byte, const u8 opsz, const u8 mod_reg)
+{
+    static const auto table = []() {
+        std::array<std::array<std::array<u8, 8>, 256>, 3> t = {};
+        const u8 sizes[3] = { 2, 4, 8 };
+
+        for(u8 s = 0; s < 3; s++)
+            for(u16 b = 0; b < 256; b++)
+                if(x64def::opgrp_1b(b))
+                    for(u8 r = 0; r < 8; r++)
+                        t[s][b][r] = get_immsz(b, sizes[s], 0, r);
+        return t;
+    }();
+
+    return table[(opsz == 2) ? 0 : ((opsz == 4) ? 1 : 2)][byte][mod_reg];
+}
+
+// bit i set if buf[i] is a legacy or REX prefix
+// buf has to be readable up to len rounded up to 16 bytes
+u128 prefix_mask(const u8* buf, size_t len)
+{
+    u128 mask = 0;
+
+#ifdef __SSE2__
+    const __m128i rexhi = _mm_set1_epi8((char)0xf0);
+    const __m128i rex   = _mm_set1_epi8(0x40);
+
+    for(size_t i = 0; i < len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(buf + i));
+        __m128i m = _mm_cmpeq_epi8(_mm_and_si128(v, rexhi), rex);
+
+        for(u8 p : { 0xf0, 0xf2, 0xf3, 0x64, 0x65, 0x66, 0x67 })
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8((char)p)));
+
+        mask |= (u128)(u16)_mm_movemask_epi8(m) << i;
+    }
+#else
+    for(size_t i = 0; i < len; i++)
+        if(is_legacy(buf[i]) || is_rex(buf[i])) mask |= (u128)1 << i;
+#endif // __SSE2__
+
+    if(len < 128) mask &= ((u128)1 << len) - 1;
+    return mask;
+}
+
+// length and offsets of the instruction at buf
+// pfx: prefix mask starting at buf[0]
+// same rules as the decoders: rex counts if it is the last prefix, memory operands go to the complex decoder
+u8 length(const u8* buf, size_t avail, u128 pfx, x64op& op)
+{
+    op = zero_x64op;
+
+    u8 idx = ctz128(~pfx);
+    if(idx >= 15) return ild_ud;
+    if(idx >= avail) return ild_partial;
+
+    for(u8 i = 0; i < idx; i++)
+    {
+        switch(buf[i])
+        {   // group 1/2: last prefix counts
+            case 0xf0: case 0xf2: case 0xf3:
+                op.meta.has_g1 = buf[i]; break;
+            case 0x64: case 0x65:
+                op.meta.has_g2 = buf[i]; break;
+            case 0x66:
+                op.meta.has_66 = 1; break;
+            case 0x67:
+                op.meta.has_67  = 1;
+                op.meta.decoder = x64d_cmplx;
+                break;
+        }
+    }
+
+    // rex has to be the last prefix before esc/opcodes
+    if(idx && is_rex(buf[idx - 1]))
+    {
+        op.meta.has_rex = 1;
+        op.meta.off_rex = idx - 1;
+    }
+
+    if(is_vex(buf[idx]) || is_evex(buf[idx])) return ild_ud;
+
+    op.off_opcode = idx;
+    if(is_esc1(buf[idx]))
+    {
+        if(++idx >= avail) return ild_partial;
+        if(is_esc2(buf[idx])) return ild_ud;
+    }
+
+    const u8 opcode = buf[idx++];
+    op.meta.op_mode = idx - op.off_opcode - 1;
+
+    u8 displsz = 0;
+    if(use_modrm(opcode, op.meta.op_mode))
+    {
+        if(idx >= avail) return ild_partial;
+        op.off_modrm = idx++;
+
+        // at least one memory operand -> complex, unless ld + op will be micro fused
+        if(modrm::get_mod(buf[op.off_modrm]) != 0b11 && !(X64_MICRO_FUSION && is_loadop(opcode, op.meta.op_mode)))
+            op.meta.decoder = x64d_cmplx;
+
+        if(use_sib(buf[op.off_modrm]))
+        {
+            if(idx >= avail) return ild_partial;
+            op.off_sib = idx++;
+        }
+
+        displsz = get_displsz(buf[op.off_modrm], (op.off_sib ? buf[op.off_sib] : 0));
+    }
+
+    u8 has_rex_w = op.meta.has_rex && !!(buf[op.meta.off_rex] & rex::w);
+    u8 opsz      = (has_rex_w ? 8 : ((op.meta.has_66 || op.meta.has_67) ? 2 : 4));
+    u8 mod_reg   = op.off_modrm ? modrm::get_reg(buf[op.off_modrm]) : 0;
+
+    u8 immsz = (!op.meta.op_mode && x64def::opgrp_1b(opcode)) ? group_immsz(opcode, opsz, mod_reg) :
+        get_immsz(opcode, opsz, op.meta.op_mode, mod_reg);
+
+    if(displsz) op.off_displ = idx;
+    if(immsz)   op.off_imm   = idx + displsz;
+
+    u8 len = idx + displsz + immsz;
+    if(len > 15)    return ild_ud;
+    if(len > avail) return ild_partial;
+
+    op.bytes.append(buf, len);
+    op.len = len;
+    return ild_ok;
+}
+
+// length decode all instructions in buf
+// a #UD instruction ends the block as zero op, a partial one is left at block.tail
+u8 decode_block(const u8* buf, size_t len, Block& block)
+{
+    u128 pfx = prefix_mask(buf, len);
+
+    block.starts = 0;
+    block.count  = 0;
+    block.status = ild_ok;
+
+    size_t idx = 0;
+    for(; idx < len;)
+    {
+        x64op& op = block.ops[block.count];
+        block.status = length(buf + idx, len - idx, pfx >> idx, op);
+
+        if(block.status == ild_partial) break;
+
+        block.starts |= (u128)1 << idx;
+        block.count++;
+
+        if(block.status == ild_ud)
+        {
+            op = zero_x64op; // zero op will always #UD
+            break;
+        }
+
+        idx += op.len;
+    }
+
+    block.tail = idx;
+    return block.count;
+}
+
+} // x64ild
@@ -8,6 +8,9 @@
 #ifndef SIM_TABLES64_H
 #define SIM_TABLES64_H
 
+#include <algorithm>
+#include <span>
+
 #include "../types.hh"
 
 namespace x64def
@@ -246,7 +249,7 @@ constexpr u8 is_rmop(x64operand op)
 constexpr u8 is_immop(x64operand op)    { return (op.addr_mode == I) || (op.addr_mode == J); }
 
 // get modrm.rm operand with possible memory access and its position
-inline pair<x64operand, u8> get_rmop(vector<x64operand> operands)
+inline pair<x64operand, u8> get_rmop(const vector<x64operand>& operands)
 {
     u8 i = 0;
     for(auto op : operands)
@@ -259,12 +262,22 @@ inline pair<x64operand, u8> get_rmop(vector<x64operand> operands)
     return std::make_pair((x64operand)0, 0);
 }
 
+// lexicographic opcode compare, lets lookups use a stack buffer as key
+struct opkey_less
+{
+    using is_transparent = void;
+
+    template<typename A, typename B>
+    bool operator()(const A& a, const B& b) const
+    { return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end()); }
+}; // opkey_less
+
 // map required prefixes, escape, opcode bytes (plus relevant modrm bits) -> opinfo
 // simple lookup: { (prefixes), opcodes }
 // group lookup:  { (prefixes), opcodes, modrm bits }
 // const std::pair<vector<u8>, x64opinfo> x64opmap[768] =
 // instrs marked with line comment are not implemented yet
-const std::map<vector<u8>, x64opinfo> x64opmap =
+const std::map<vector<u8>, x64opinfo, opkey_less> x64opmap =
 {
     // one byte 
     { {0x00},               { "add",                {{E,b}, {G,b}}          }},
@@ -692,15 +705,19 @@ const std::map<vector<u8>, x64opinfo> x64opmap =
 //     else return it->second;
 // }
 
-inline x64opinfo get_opinfo(const vector<u8> opcode)
+inline const x64opinfo& get_opinfo(std::span<const u8> opcode)
 {
-    if(!x64opmap.count(opcode)) [[unlikely]]
+    auto it = x64opmap.find(opcode);
+    if(it == x64opmap.end()) [[unlikely]]
         return zero_x64opinfo;
     else
-        return x64opmap.at(opcode);
+        return it->second;
     // https://gcc.gnu.org/bugzilla/show_bug.cgi?id=101361 ? only happens at O3/Ofast
 }
 
+inline const x64opinfo& get_opinfo(std::initializer_list<u8> opcode)
+{   return get_opinfo(std::span<const u8>(opcode.begin(), opcode.size())); }
+
 }
 
 #endif // SIM_TABLES64_H
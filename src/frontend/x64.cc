@@ -6,38 +6,62 @@
 
 #include "x64.hh"
 
-x64Frontend::x64Frontend(MemoryManager& mmu, LatchQueue<uop>* uqueue,
-        Simulator::SimulatorState& state) : Frontend(mmu, uqueue, state)
+#include <algorithm>
+
+x64Frontend::x64Frontend(MemoryManager& mmu, LatchQueue<uop>* uqueue, Simulator::SimulatorState& state,
+        const FrontendConfig& cfg, u8 bpred, u8 ittage, u8 loop) : Frontend(mmu, uqueue, state, cfg)
 {
     // TODO make this static
     if(REGCLS_0_CNT < reg64_tmax)
-        util::abort("x64 frontend requires at least", dec_u<0>, reg64_tmax, " GP registers.");
+        throw ConfigException("x64 frontend requires at least ", dec_u<0>, reg64_tmax, " GP registers.");
     if(REGCLS_2_CNT < reg64_tmmmax)
-        util::abort("x64 frontend requires at least", dec_u<0>, reg64_tmmmax, " vec registers.");
-
-    bp = new BTBPredictor();
-    fetchbytes.resize(X64_FETCH_BYTES, 0);
-    pdblocksz    = X64_FETCH_BYTES;
-    pd_state     = pd_prefix;
-    pd_remaining = 0;
-    part_op      = zero_x64op;
-    part_op.bytes.reserve(15);
+        throw ConfigException("x64 frontend requires at least ", dec_u<0>, reg64_tmmmax, " vec registers.");
+
+    bp  = new_predictor(bpred, ittage, loop);
+    ras = new ReturnStack();
+    pd_carry.clear();
     next_decoder = {};
     msrip        = 0;
-    cur_tmp_gp   = reg64_t0 - 1;
-    cur_tmp_vr   = reg64_tmm0 - 1;
+    lsd_body.reserve(LSD_SIZE + 1);
+
+    lsd_window_uops = 0;
+    lsd_state       = lsd_idle;
+    lsd_pos         = 0;
+    fetch_cycles    = 0;
+    decoded_mops    = 0;
+    lsd_uops        = 0;
+    lsd_locks       = 0;
+    decoded_uops    = 0;
+    macro_fused     = 0;
+    micro_fused     = 0;
+    msrom_ops       = 0;
+    ms_ready        = 0;
+    decode_groups   = {};
+    decode_stalls   = {};
 
     // util::log(0, x64def::get_opinfo({0xc3}) == x64def::zero_x64opinfo);
 
     util::log(LOG_FE_INIT, "x64 Frontend initialized with:");
     util::log(LOG_FE_INIT, "        Fetch block size: ", dec_u<0>, X64_FETCH_BYTES);
-    util::log(LOG_FE_INIT, "        iQueue size:      ", dec_u<0>, IQUEUE_SIZE);
+    util::log(LOG_FE_INIT, "        iQueue size:      ", dec_u<0>, cfg.iqueue_size);
     util::log(LOG_FE_INIT, "        Decoders:         ", dec_u<0>, ds);
+    util::log(LOG_FE_INIT, "        Predictor:        ", bp->name());
+    util::log(LOG_FE_INIT, "        RAS depth:        ", dec_u<0>, RAS_DEPTH);
+    util::log(LOG_FE_INIT, "        LSD:              ", (cfg.lsd_enable ? "enabled" : "disabled"));
+    util::log(LOG_FE_INIT, "        Macro fusion:     ", (X64_MACRO_FUSION ? "enabled" : "disabled"));
+    util::log(LOG_FE_INIT, "        Micro fusion:     ", (X64_MICRO_FUSION ? "enabled" : "disabled"));
     util::log(LOG_FE_INIT, "");
 }
 
+x64Frontend::~x64Frontend()
+{
+    delete bp;
+    delete ras;
+}
+
 u8 x64Frontend::cycle()
 {
+    predict();
     fetch();
     udecode();
 
@@ -54,21 +78,33 @@ u8 x64Frontend::flush()
 u8 x64Frontend::flush(u8 total)
 {
     // flush predecoder
-    fetchbytes.resize(X64_FETCH_BYTES, 0);
-    pdblocksz    = X64_FETCH_BYTES;
-    pd_state     = pd_prefix;
-    pd_remaining = 0;
-    part_op      = zero_x64op;
-    part_op.bytes.reserve(15);
+    pd_carry.clear();
 
     // flush everything else
     if(total)
     {
         next_decoder = {};
         msrip        = 0;
-        cur_tmp_gp   = reg64_t0 - 1;
-        cur_tmp_vr   = reg64_tmm0 - 1;
+        tmp_gp.release();
+        tmp_vr.release();
         iqueue.clear();
+        ms_uops.clear();
+
+        for(auto& dec : ds.decoders)
+        {
+            dec.busy  = 0;
+            dec.instr = zero_x64op;
+            dec.fused = zero_x64op;
+        }
+
+        // buffer might be stale after SMC, capture again
+        lsd_window.clear();
+        lsd_window_uops = 0;
+        lsd_body.clear();
+        lsd_state       = lsd_idle;
+        lsd_pos         = 0;
+
+        flush_ftq();
     }
     return 0;
 }
@@ -84,231 +120,44 @@ u8 x64Frontend::fetch()
         return 1;
     }
 
-    // worst case: bundle will contain 16 one byte instructions
-    if(iqueue.size() >= (IQUEUE_SIZE - 16))
+    if(state.cycle < resume_at)
     {
-        util::log(LOG_64_PIPE1, "IFPD: * Instruction queue is full, stalling frontend.");
+        util::log(LOG_64_PIPE1, "IFPD:   Waiting for redirect.");
         return 0;
     }
 
-    // not every cycle is going to fetch new instructions
-    if(state.active & if_active)
-        util::log(LOG_64_PIPE1, "IFPD:   Fetching new instructions from memory.");
-
-
-    auto parse_prefix = [&](u8& idx) {
-        util::log(LOG_64_PIPE2, "          PD state PREFIX");
-        for(;idx < pdblocksz;)
-        {
-            if(is_legacy(fetchbytes[idx]) || is_rex(fetchbytes[idx]))
-            {
-                util::log(LOG_64_PIPE3, "            Prefix ", hex_u<8>, +fetchbytes[idx], ".");
-                switch(fetchbytes[idx])
-                {   // group 1/2: last prefix counts
-                    case 0xf0: case 0xf2: case 0xf3:
-                        part_op.meta.has_g1 = fetchbytes[idx]; break;
-                    case 0x64: case 0x65:
-                        part_op.meta.has_g2 = fetchbytes[idx]; break;
-                    // addr will make this a complex instruction (?)
-                    case 0x66:
-                        part_op.meta.has_66 = 1;
-                        // part_op.meta.decoder = x64d_cmplx;
-                        break;
-                    case 0x67:
-                        part_op.meta.has_67 = 1;
-                        part_op.meta.decoder = x64d_cmplx;
-                        break;
-                    // todo pretty much all (implied) memory operations will go through complex decoder
-                    // uarch p122/p160
-                }
-
-                part_op.bytes.push_back(fetchbytes[idx]);
-                part_op.len++; idx++;
-                part_op.off_opcode++;
-            }
-            else if(is_vex(fetchbytes[idx]) || is_evex(fetchbytes[idx]))
-            {   // not supported -> #UD
-                util::log(LOG_64_PIPE3, "            VEX/EVEX ", hex_u<8>, +fetchbytes[idx], " detected, #UD!");
-                part_op  = zero_x64op;      // zero-op will always #UD
-                pd_state = pd_reset;        // bypass instruction to iqueue
-                idx      = pdblocksz; // and force out of range to stop predecoding
-                state.active &= ~(if_active | pd_active);
-                return 1;
-            }
-            else break;
-        }
-
-        // rex has to be the last prefix before esc/opcodes
-        if((idx > 0) && is_rex(part_op.bytes[part_op.len-1]))
-        {
-            util::log(LOG_64_PIPE3, "            REX is valid.");
-            part_op.meta.has_rex = 1;
-            part_op.meta.off_rex = part_op.len-1;
-        }
-        return (idx < pdblocksz ? 0 : 1); // capture state if prefix byte is last in block
-    };
-
-    auto parse_opcode = [&](u8& idx) {
-        util::log(LOG_64_PIPE2, "          PD state OPCODE");
-        if(idx < pdblocksz && is_esc1(fetchbytes[idx]))
-        {   // two or three byte opcode incoming
-            util::log(LOG_64_PIPE3, "            Esc1 ", hex_u<8>, +fetchbytes[idx], ".");
-            part_op.bytes.push_back(fetchbytes[idx]); // push back escape
-            part_op.len++; idx++;
-        }
-
-        if(idx < pdblocksz && 
-           is_esc1(part_op.bytes[part_op.len-1]) && is_esc2(fetchbytes[idx]))
-        {   // two byte escape -> SSE3+, this will #UD for now (-> shut down fetch/pd)
-            util::log(LOG_64_PIPE3, "            Esc2 ", hex_u<8>, +fetchbytes[idx], ", #UD!");
-            part_op  = zero_x64op;
-            pd_state = pd_reset;
-            idx      = pdblocksz;
-            state.active &= ~(if_active | pd_active);
-            return 1;
-        }
-
-        if(idx >= pdblocksz) return 1; // escape was the last byte in fetch block
-
-        // TODO macro ops <-> decoder type
-        util::log(LOG_64_PIPE3, "            Opcode ", hex_u<8>, +fetchbytes[idx], ".");
-        part_op.bytes.push_back(fetchbytes[idx]); // push back opcode
-        part_op.len++; idx++;
-
-        part_op.meta.op_mode = part_op.len - part_op.off_opcode - 1;
+    if(lsd_state == lsd_locked)
+    {
+        util::log(LOG_64_PIPE1, "IFPD:   Loop stream detector locked, fetch idle.");
         return 0;
-    };
-
-    auto parse_modrm = [&](u8& idx) {
-        util::log(LOG_64_PIPE2, "          PD state modRM");
-        if(!part_op.off_modrm && idx < pdblocksz && use_modrm(part_op.bytes[part_op.len-1], part_op.meta.op_mode))
-        {
-            util::log(LOG_64_PIPE3, "            modR/M ", hex_u<8>, +fetchbytes[idx], ".");
-            part_op.bytes.push_back(fetchbytes[idx]); // push back modrm
-            part_op.off_modrm = part_op.len;
-            part_op.len++; idx++;
-
-            // at least one memory operand -> complex
-            // (what about lea..?)
-            if(modrm::get_mod(part_op.bytes.back()) != 0b11)
-                part_op.meta.decoder = x64d_cmplx;
-        }
-
-        if(!part_op.off_sib && part_op.off_modrm && idx < pdblocksz && use_sib(part_op.bytes[part_op.off_modrm]))
-        {
-            util::log(LOG_64_PIPE3, "            SIB ", hex_u<8>, +fetchbytes[idx], ".");
-            part_op.bytes.push_back(fetchbytes[idx]); // push back sib
-            part_op.off_sib = part_op.len;
-            part_op.len++; idx++;
-        }
-
-        // short circuit!
-        if(part_op.off_modrm && (pd_remaining || (pd_remaining = get_displsz(part_op.bytes[part_op.off_modrm],
-                (part_op.off_sib ? part_op.bytes[part_op.off_sib] : 0)))) && idx < pdblocksz)
-        {
-            std::vector<u8>::iterator start = fetchbytes.begin() + idx;
-
-            // make sure we don't overflow out of fetch buffer when reading multiple bytes at once
-            u8 bytecount = (pd_remaining <= (pdblocksz - idx) ? pd_remaining : (pdblocksz - idx));
-            util::log(LOG_64_PIPE3, "            Displacement used.");
-
-            part_op.bytes.insert(part_op.bytes.end(), start, start + bytecount); // push back displacement bytes
-            
-            if(!part_op.off_displ) part_op.off_displ = part_op.len; // don't overwrite offset if already set
-            part_op.len  += bytecount;
-            pd_remaining -= bytecount;
-            idx          += bytecount;
-        }
-
-        // modrm, displ or sib not finished
-        // these checks are getting to complex... might have to rewrite the predecoder if everything else is done 
-        return ((pd_remaining ||
-            (!part_op.off_modrm && use_modrm(part_op.bytes[part_op.off_opcode], part_op.meta.op_mode)) || 
-            (!part_op.off_sib && part_op.off_modrm && use_sib(part_op.bytes[part_op.off_modrm]))) ? 1 : 0);
-    };
-
-    auto parse_imm = [&](u8& idx) {
-        util::log(LOG_64_PIPE2, "          PD state IMM");
-        u8 has_rex_w = part_op.meta.has_rex && !!(part_op.bytes[part_op.meta.off_rex] & rex::w);
-        u8 has_66_67 = part_op.meta.has_66 || part_op.meta.has_67;
-
-        u8 opsz = (has_rex_w ? 8 : (has_66_67 ? 2 : 4));
-
-        // ....
-        if(pd_remaining || (pd_remaining = get_immsz(part_op.bytes[part_op.off_opcode + part_op.meta.op_mode], opsz,
-            part_op.meta.op_mode, part_op.off_modrm ? modrm::get_reg(part_op.bytes[part_op.off_modrm]) : 0)))
-        {
-            if(idx >= pdblocksz) return 1; // we need an immediate but it's not in the current buffer
-            
-            std::vector<u8>::iterator start = fetchbytes.begin() + idx;
-
-            u8 bytecount = (pd_remaining <= (pdblocksz - idx) ? pd_remaining : (pdblocksz - idx));
-            util::log(LOG_64_PIPE3, "            Immediate used.");
-
-            part_op.bytes.insert(part_op.bytes.end(), start, start + bytecount); // push back immediate bytes
-
-            if(!part_op.off_imm) part_op.off_imm = part_op.len;
-            // util::log(0, "partoplen ", dec_u<0>, +part_op.len);
-            // part_op.len  += pd_remaining;
-            part_op.len  += bytecount;
-            // util::log(0, "partoplen ", dec_u<0>, +part_op.len);
-            // getchar();
-            pd_remaining -= bytecount;
-            idx          += bytecount;
-        }
+    }
 
-        // all instruction bytes read, reset
-        if(!pd_remaining)
-        {
-            util::log(LOG_64_PIPE2, "IFPD:     Instruction decoded, state reset.");
-            pd_state = pd_reset;
-        }
-        else
-            util::log(LOG_64_PIPE2, "              ", +pd_remaining, " bytes left.");
+    if(ftq.empty() && !bp_halt)
+    {
+        util::log(LOG_64_PIPE1, "IFPD:   FTQ is empty.");
         return 0;
-    };
-
-    // parse one instruction starting from fetch block index, set index to start of next instruction
-    auto parse_instr = [&](u8& idx) {
-        switch(pd_state)
-        {   // no errors:   fall through until done 
-            // error?       capture last state for next predecode cycle
-            case pd_reset:
-            case pd_prefix:
-                pd_state = pd_prefix;
-                if(parse_prefix(idx)) break;
-                [[fallthrough]]; // prefix will return error code on fast #UD!
-            case pd_opcode:
-                pd_state = pd_opcode;
-                if(parse_opcode(idx)) break;
-                [[fallthrough]]; // same for opcode
-            case pd_modrm: 
-                pd_state = pd_modrm;
-                if(parse_modrm(idx)) break;
-                [[fallthrough]];
-            case pd_imm:   
-                pd_state = pd_imm;   
-                parse_imm(idx);
-        }
-    };
-
-    // check iQueue size here
+    }
 
-    // read bytes into buffer
-    // split up macro ops and put into iqueue
-    // fuse ops inside the macro queue
-    // take out ops from iqueue and decode them to uops
-    // buffer uops for loop detection and micro fusion?
+    // worst case: block will contain X64_FETCH_BYTES one byte instructions
+    if(iqueue.size() >= (cfg.iqueue_size - X64_FETCH_BYTES))
+    {
+        util::log(LOG_64_PIPE1, "IFPD: * Instruction queue is full, stalling frontend.");
+        return 0;
+    }
 
+    // not every cycle is going to fetch new instructions
+    if(state.active & if_active)
+        util::log(LOG_64_PIPE1, "IFPD:   Fetching new instructions from memory.");
 
     util::log(LOG_64_PIPE1, "IFPD:   Fetchaddr: ", hex_u<64>, fetchaddr);
 
     u64 fetchbase = fetchaddr & X64_FETCH_ALIGN;  // address of the fetch block
     u64 fetchoffs = fetchaddr & ~X64_FETCH_ALIGN; // index of instructions we are actually interested in
     u64 bytesread = 0;
-    
+
     // if a page fault occurs, add instruction with length -1 to iqueue
     // decode will directly translate it to uop_int #PF(EC)
+    // an instruction carried over from the last block faults as well, its remaining bytes are missing
     u8  inject_pf = 0;
 
     util::log(LOG_64_PIPE1, "IFPD:   Base: ", hex_u<64>, fetchbase, ". Offs: ", hex_u<X64_FETCH_BYTES/8>, fetchoffs, ".");
@@ -317,7 +166,10 @@ u8 x64Frontend::fetch()
     {
         if((state.active & if_active))
             if(!mmu.is_busy(fetchbase, X64_FETCH_BYTES))
+            {
+                fetch_cycles++;
                 bytesread = mmu.read(fetchbase, fetchbytes.data(), X64_FETCH_BYTES, MM::p_x).second;
+            }
             else
                 util::log(LOG_64_PIPE1, "IFPD:   Waiting for memory ...");
         else
@@ -330,7 +182,7 @@ u8 x64Frontend::fetch()
         if(SILENT_HALT)
             util::log(LOG_64_PIPE1, "IFPD:   End of code reached.");
         else
-            inject_pf = part_op.bytes.empty() ? 1 : 2; // inject #PF after the current instruction, since this one is ok
+            inject_pf = 1;
     }
     catch(const ProtectionViolationException& pv)
     {
@@ -343,26 +195,32 @@ u8 x64Frontend::fetch()
         inject_pf = 1;
     }
 
-
     try
     {
-        // last bytes in byte vector are invalid and should not be treated as instruction bytes
+        // last bytes in the block are invalid and should not be treated as instruction bytes
         // this marks the end of code -> shut down fetch/pd
         if(bytesread < X64_FETCH_BYTES)
         {
             util::log(LOG_64_PIPE1, "IFPD:   End of code reached.");
-            fetchbytes.resize(bytesread); // reset this on flush!!
-            pdblocksz     = bytesread;
             state.active &= ~(if_active | pd_active);
             // don't return here, buffer is not empty yet
         }
 
-        util::log(LOG_64_BUF, "\nIFPD:   Predecode buffer: ", (fetchbytes.size() ? fetchbytes : (vector<u8>)0 ));
+        // predecode buffer: bytes carried over from the last block, then the fetched bytes from the offset
+        size_t pdlen = pd_carry.size();
+        std::copy_n(pd_carry.b.begin(), pdlen, pdbuf.begin());
+        if(bytesread > fetchoffs)
+        {
+            std::copy_n(fetchbytes.begin() + fetchoffs, bytesread - fetchoffs, pdbuf.begin() + pdlen);
+            pdlen += bytesread - fetchoffs;
+        }
+        std::fill(pdbuf.begin() + pdlen, pdbuf.end(), 0);
+        pd_carry.clear();
 
-        if(!part_op.bytes.empty())
-            util::log(LOG_64_BUF, "\nIFPD:   Instruction buffer: ", part_op, "\n");
+        if(util::log_enabled(LOG_64_BUF))
+            util::log(LOG_64_BUF, "\nIFPD:   Predecode buffer: ", vector<u8>(pdbuf.begin(), pdbuf.begin() + pdlen));
 
-        // do some predecoding:
+        // length decode the whole buffer at once:
         // instruction length   (max 15)
         // offsets:
         //   prefixes
@@ -372,60 +230,57 @@ u8 x64Frontend::fetch()
         //   displacement
         //   immediate
         // don't check for #UD or anything else yet! decoders will do that
+        x64ild::decode_block(pdbuf.data(), pdlen, pdblock);
 
-        for(u8 i = fetchoffs; /*i < pdblocksz*/;)
-        {
-            util::log(LOG_64_PIPE2, "\nIFPD:   Predecoding ...");
-            parse_instr(i);
-
-            // instruction not finished but reached end of block
-            if(pd_state != pd_reset)
-            {
-                // instruction continues in next block
-                fetchaddr = fetchbase + X64_FETCH_BYTES;
-                util::log(LOG_64_PIPE2, "IFPD:   Instruction incomplete, fetching next block.");
-                util::log(LOG_64_PIPE2, "          ", part_op);
+        util::log(LOG_64_PIPE2, "IFPD:   Predecoded ", dec_u<0>, +pdblock.count, " instructions, ",
+            dec_u<0>, +pdblock.tail, "/", pdlen, " bytes.");
 
-                if(!inject_pf)
-                    break;
-            }
+        if(pdblock.status == x64ild::ild_ud)
+        {
+            util::log(LOG_64_PIPE3, "            VEX/EVEX, 3 byte opcode or overlong instruction, #UD!");
+            state.active &= ~(if_active | pd_active);
+        }
 
-            util::log(LOG_64_PIPE1, "IFPD:   Predecode yielded: ", part_op);
+        u8 redirected = 0;
+        for(u8 n = 0; n < pdblock.count; n++)
+        {
+            x64op& op = pdblock.ops[n];
+            util::log(LOG_64_PIPE1, "IFPD:   Predecode yielded: ", op);
 
             u64 pred = 0, seq = 0;
             // slightly more complex than risc prediction since we might have to jump from inside the fetch block
             // we don't really have to "predict" unconditional jumps, but the predictor may already know the target
-            // todo
-            seq = state.in_flight.back() + part_op.bytes.size();
+            seq = state.in_flight.back() + op.bytes.size();
             util::log(LOG_64_PIPE3, "          sequential rip ", hex_u<64>, seq, " -> seq_addrs");
             state.seq_addrs.push_back(seq);
 
-            if(u8 brtype; (brtype = is_branch(part_op)))
-                pred = bp->predict(fetchaddr, seq, -1);
-            else [[likely]]
-                pred = seq;
+            pred = consume(seq);
 
-            if(inject_pf == 1) // page fault on this instruction
-                part_op.len = 0xff;
-            else if(inject_pf == 2) // next instruction
-                inject_pf--;
-
-            iqueue.push_back((state.cycle + FETCH_LATENCY), part_op);
-            part_op = zero_x64op;
+            op.rip = state.in_flight.back();
+            iqueue.push_back((state.cycle + cfg.fetch_latency), op);
 
             util::log(LOG_64_PIPE2, "IFPD:   Instruction at v.", hex_u<64>, state.in_flight.back(), " added. ",
                 "Sequential instruction at v. ", hex_u<64>, seq);
-            // getchar();
 
             // need to fetch next instruction from somewhere else
             if(pred != seq)
             {
+                // captured loop is taken again, stop fetching and replay it once decode is drained
+                if(cfg.lsd_enable && lsd_state == lsd_armed && state.in_flight.back() == lsd_body.back().rip &&
+                    pred == lsd_body.front().rip)
+                {
+                    util::log(LOG_64_PIPE2, "IFPD:   Loop at v.", hex_u<64>, pred, " locked.");
+                    lsd_state = lsd_locked;
+                    lsd_pos   = 0;
+                    lsd_locks++;
+                }
+
                 fetchaddr = pred;
                 state.active |= (if_active | pd_active);
-                // fetchbytes.resize(X64_FETCH_BYTES); // !!!!!!!
                 flush(false);
                 util::log(LOG_64_PIPE3, "          predicted rip ", hex_u<64>, pred, " -> in_flight");
                 state.in_flight.push_back(pred);
+                redirected = 1;
                 break;
             }
             else fetchaddr = seq;
@@ -433,18 +288,33 @@ u8 x64Frontend::fetch()
             util::log(LOG_64_PIPE3, "          next rip ", hex_u<64>, pred, " -> in_flight");
             state.in_flight.push_back(pred);
 
-            if(inject_pf) break;
+            // predictor has not caught up, continue from here once it has
+            if(ftq.empty() && !bp_halt)
+            {
+                state.active |= (if_active | pd_active);
+                flush(false);
+                redirected = 1;
+                break;
+            }
         }
 
-        if(!pdblocksz && inject_pf)
+        if(!redirected && inject_pf)
         {
-            part_op.len = 0xff;
-            iqueue.push_back((state.cycle + 1), part_op);
-            // u64 seq = (state.seq_addrs.empty() ? state.in_flight.back() : state.seq_addrs.back()) + part_op.bytes.size();
+            x64op pf = zero_x64op;
+            pf.len   = 0xff;
+            pf.rip   = state.in_flight.back();
+            iqueue.push_back((state.cycle + 1), pf);
             util::log(LOG_64_PIPE3, "ifseq pushing back ", hex_u<64>, fetchaddr);
             state.seq_addrs.push_back(fetchaddr);
             state.in_flight.push_back(fetchaddr);
         }
+        // instruction not finished but reached end of block, continues in the next one
+        else if(!redirected && pdblock.status == x64ild::ild_partial)
+        {
+            pd_carry.append(pdbuf.data() + pdblock.tail, pdlen - pdblock.tail);
+            fetchaddr = fetchbase + X64_FETCH_BYTES;
+            util::log(LOG_64_PIPE2, "IFPD:   Instruction incomplete, fetching next block.");
+        }
 
         if(iqueue.size()) 
         {
@@ -464,13 +334,100 @@ u8 x64Frontend::fetch()
     return 0;
 }
 
-// try to fuse macro instructions
-// disabled for now
-u8 x64Frontend::fuse_macro()
+// length decode the instruction at rip without touching the predecoder, 1 if it can't be decoded
+// same length decoder as predecode, but the bytes are read at once
+u8 x64Frontend::peek(u64 rip, x64op& op)
 {
+    std::array<u8, 16> buf = { 0 };
+    u64 avail = 0;
+
+    try
+    {
+        avail = mmu.read(rip, buf.data(), 15, MM::p_x).second;
+    }
+    catch(const MemoryManagerException& mme) { return 1; }
+
+    if(x64ild::length(buf.data(), avail, x64ild::prefix_mask(buf.data(), avail), op) != x64ild::ild_ok) return 1;
+
+    op.rip = rip;
+    return 0;
+}
+
+// branch prediction on length decoded instructions ahead of fetch
+u8 x64Frontend::predict_next(u64 rip, u64 seq_no, u64& seq, u64& pred)
+{
+    x64op op = zero_x64op;
+    if(peek(rip, op)) return 1;
+
+    predict_op(op, seq_no, seq, pred);
+    return 0;
+}
+
+void x64Frontend::predict_op(const x64op& op, u64 seq_no, u64& seq, u64& pred)
+{
+    seq  = op.rip + op.bytes.size();
+    pred = seq;
+
+    if(is_branch(op))
+    {
+        pred = bp->predict(op.rip, seq, -1, is_indirect(op) ? bk_indirect : bk_direct);
+
+        // calls push the return address, rets take it from the RAS unless it is empty
+        if(is_call(op))     ras->push(seq_no, seq);
+        else if(is_ret(op)) ras->pop(seq_no, pred);
+    }
+}
+
+// same decoders as udecode, the uqueue is empty in functional mode and only passes the bundle through
+u8 x64Frontend::decode_at(u64 rip, u64 seq_no, vector<uop>& uops, u64& seq, u64& pred)
+{
+    x64op op = zero_x64op;
+    if(peek(rip, op)) return 1;
+
+    predict_op(op, seq_no, seq, pred);
+
+    // fast-forwarded instructions don't count as decoded and don't train the LSD
+    functional = 1;
+    u8 ms      = run_decode(op);
+    functional = 0;
+
+    if(ms) // long bundle, handed to the MSROM
+    {
+        uops.assign(ms_uops.begin(), ms_uops.end());
+        ms_uops.clear();
+        msrip = 0;
+    }
+    else for(auto it = uqueue->begin(); it != uqueue->end(); ++it) uops.push_back(it->elem);
+
+    uqueue->clear();
     return 0;
 }
 
+// mark flag setting instructions followed by a fusible jcc in the iqueue
+// both are decoded on the same decoder
+u8 x64Frontend::fuse_macro()
+{
+    if(!X64_MACRO_FUSION) return 0;
+
+    u8 fused = 0;
+    for(auto it = iqueue.begin(); it != iqueue.end() && (it + 1) != iqueue.end(); ++it)
+    {
+        // both have to be available this cycle
+        if((it + 1)->cycle > state.cycle) break;
+        if(it->elem.meta.fused) { ++it; continue; }
+
+        if(macro_fusible(it->elem, (it + 1)->elem))
+        {
+            util::log(LOG_64_PIPE2, "DE__:   Macro fusion ", it->elem, " + ", (it + 1)->elem);
+            it->elem.meta.fused = 1;
+            macro_fused++; fused++;
+            ++it;
+        }
+    }
+
+    return fused;
+}
+
 // pass instructions to decoders
 u8 x64Frontend::udecode()
 {
@@ -480,55 +437,268 @@ u8 x64Frontend::udecode()
         return 1;
     }
 
-    // try to assign instruction at iqueue head to available decoder
-    // todo exhaustive search
-    for(u8 i = 0; i < iqueue.size(); i++)
-        for(auto& dec : ds.decoders)
-            if(iqueue.ready(state.cycle) && !dec.busy && (dec.type == iqueue.front(state.cycle).meta.decoder))
-            {   
-                util::log(LOG_64_PIPE2, "DE__:   Matching decoder found: ", +dec.id, " ", x64d_type_str[dec.type]);
-                next_decoder.push_back(dec.id);
-                dec.instr = iqueue.get_front(state.cycle);
-                dec.busy  = 1;
-                if(iqueue.empty()) break;
-            }
+    fuse_macro();
+    assign_decoders();
 
     // decode instructions on assigned decoders
     x64Decoder* next = next_decoder.empty() ? nullptr : &ds.decoders[next_decoder.front()];
     for(;next && next->busy;)
     {
-        // worst case: uop bundle contains 4 instructions
-        if(uqueue->size() >= (UQUEUE_SIZE - 4))
+        // worst case: uop bundle contains 4 instructions (+ fused jcc)
+        if(uqueue->size() >= (cfg.uqueue_size - X64_CMPLX_UOPS - (size_t)next->instr.meta.fused))
         {
             util::log(LOG_64_PIPE1, "DE__: * uQ might overflow. Stalling macro decode.");
             break;
         }
 
-        util::log(LOG_64_PIPE1, "DE.", +next->id, ":   Decoding macro op ", next->instr);
-        if(!run_decode(next->instr))
-        {   // decoder is finished, remove from queue
-            next->busy  = 0;
-            next->instr = zero_x64op;
-            next_decoder.pop_front();
-            next = next_decoder.empty() ? nullptr : &ds.decoders[next_decoder.front()];
-        }
-        // empty out buffer here
-        // and break if uqueue is full
+        u8 from_ms = !ms_uops.empty();
+        if(!from_ms) util::log(LOG_64_PIPE1, "DE.", +next->id, ":   Decoding macro op ", next->instr);
+
+        // long bundles keep the MSROM busy for the following cycles
+        if(from_ms ? ms_stream() : run_decode(next->instr))
+            break;
+
+        // decoder is finished, remove from queue
+        if(next->instr.meta.fused)
+            run_decode(next->fused);
+
+        next->busy  = 0;
+        next->instr = zero_x64op;
+        next->fused = zero_x64op;
+        next_decoder.pop_front();
+        next = next_decoder.empty() ? nullptr : &ds.decoders[next_decoder.front()];
+
+        // MSROM cycles don't decode anything else
+        if(from_ms) break;
     }
 
+    if(lsd_state == lsd_locked && iqueue.empty() && !next) lsd_replay();
+
     if(iqueue.empty() && !next && !(state.active & (if_active | pd_active)))
         state.active &= ~de_active;
 
     return 0;
 }
 
-// fuse micro ops inside the uQ
-// disabled for now
-u8 x64Frontend::fuse_micro()
+// remember decoded macro ops until a backward conditional branch closes a loop that fits into the buffer
+void x64Frontend::lsd_capture(const x64op& op, const UopBundle& uops)
 {
+    if(lsd_state == lsd_locked) return;
+
+    u64 seq    = op.rip + op.bytes.size();
+    u64 target = jcc_target(op, seq);
+
+    // only straight line code with a single exit at the closing branch is captured
+    if(!lsd_window.empty() && lsd_window.back().seq != op.rip)
+    {
+        lsd_window.clear();
+        lsd_window_uops = 0;
+    }
+
+    if(uops.empty() || std::any_of(uops.begin(), uops.end(), [](const uop& u) { return u.opcode == uop_int; }) ||
+        (is_branch(op) && !(target && target < op.rip)))
+    {
+        lsd_window.clear();
+        lsd_window_uops = 0;
+        return;
+    }
+
+    // every entry holds at least one uop, trimming to LSD_SIZE uops keeps the window from filling up
+    lsd_window.push_back(0, { op.rip, seq, uops });
+    lsd_window_uops += uops.size();
+
+    for(; lsd_window_uops > LSD_SIZE;)
+    {
+        lsd_window_uops -= lsd_window.front(0).uops.size();
+        lsd_window.pop_front();
+    }
+
+    if(!target || target >= op.rip) return;
+
+    auto head = std::find_if(lsd_window.begin(), lsd_window.end(),
+        [&](const auto& e) { return e.elem.rip == target; });
+
+    if(head != lsd_window.end())
+    {
+        lsd_body.clear();
+        for(; head != lsd_window.end(); ++head)
+            lsd_body.push_back(head->elem);
+        lsd_state = lsd_armed;
+        util::log(LOG_64_PIPE2, "LSD_:   Captured loop v.", hex_u<64>, target, " - v.", hex_u<64>, op.rip,
+            " (", dec_u<0>, lsd_body.size(), " macro ops).");
+    }
+
+    lsd_window.clear();
+    lsd_window_uops = 0;
+}
+
+// stream uops of the captured loop into the uqueue while fetch and decode are idle
+u8 x64Frontend::lsd_replay()
+{
+    u8 sent = 0;
+
+    for(; lsd_state == lsd_locked;)
+    {
+        const LoopBufferEntry& e = lsd_body[lsd_pos];
+
+        // only whole macro ops
+        if((sent && sent + e.uops.size() > cfg.lsd_width) || uqueue->size() + e.uops.size() > cfg.uqueue_size) break;
+        if(ftq.empty() && !bp_halt) break;
+
+        // the predictor keeps running ahead through the loop
+        u64 pred = consume(e.seq);
+
+        state.seq_addrs.push_back(e.seq);
+        state.in_flight.push_back(pred);
+
+        util::log(LOG_64_PIPE1, "LSD_:   Replaying macro op at v.", hex_u<64>, e.rip);
+        for(const uop& op : e.uops)
+        {
+            if(util::log_enabled(LOG_64_PIPE1))
+                util::log(LOG_64_PIPE1, "          ", uop_readable(op).str());
+            uqueue->push_back(state.cycle + DECODE_LATENCY, op);
+        }
+
+        sent     += e.uops.size();
+        lsd_uops += e.uops.size();
+        lsd_pos   = (lsd_pos + 1) % lsd_body.size();
+
+        // predicted loop exit, continue fetching behind the loop
+        if(!lsd_pos && pred != lsd_body.front().rip)
+        {
+            util::log(LOG_64_PIPE1, "LSD_:   Loop exit predicted, resuming fetch at v.", hex_u<64>, pred);
+            lsd_state = lsd_armed;
+            fetchaddr = pred;
+            state.active |= (if_active | pd_active);
+            flush(false);
+        }
+    }
+
+    return sent;
+}
+
+// start a new decode group once the last one is done
+// 4-1-1-1: the first instruction goes to the complex decoder, the following ones only fit the simple decoders
+// MSROM instructions have to be first and take the whole group
+u8 x64Frontend::assign_decoders()
+{
+    if(!next_decoder.empty())
+    {
+        decode_stalls[ms_uops.empty() ? dst_busy : dst_msrom]++;
+        return 0;
+    }
+
+    u8 free   = ds.simple_mask;
+    u8 slots  = 0;
+    u8 reason = dst_none;
+
+    for(; slots < ds.width;)
+    {
+        if(!iqueue.ready(state.cycle))
+        {
+            reason = (iqueue.empty() ? dst_empty : dst_latency);
+            break;
+        }
+
+        u8 type = iqueue.front(state.cycle).meta.decoder;
+        u8 id   = 0;
+
+        if(!slots)
+            id = (type == x64d_seq ? ds.seq_id : ds.cmplx_id);
+        else if(type == x64d_fast && free)
+            id = __builtin_ctz(free);
+        else
+        {
+            reason = (type == x64d_seq ? dst_msrom : dst_complex);
+            break;
+        }
+
+        x64Decoder& dec = ds.decoders[id];
+        util::log(LOG_64_PIPE2, "DE__:   Matching decoder found: ", +dec.id, " ", x64d_type_str[dec.type]);
+
+        next_decoder.push_back(id);
+        dec.instr = iqueue.get_front(state.cycle);
+        dec.busy  = 1;
+
+        // fused jcc takes no decoder of its own
+        if(dec.instr.meta.fused)
+            dec.fused = iqueue.get_front(state.cycle);
+
+        free &= ~(1 << id);
+        slots++;
+
+        if(id == ds.seq_id)
+        {
+            reason = dst_msrom;
+            break;
+        }
+    }
+
+    decode_groups[slots]++;
+    if(slots < ds.width) decode_stalls[reason]++;
+
+    return slots;
+}
+
+// send the next uops of a long bundle, 1 while the MSROM is still busy
+u8 x64Frontend::ms_stream()
+{
+#if COUNT_ALLOCS
+    util::DecodeScope alloc_scope;
+#endif // COUNT_ALLOCS
+
+    if(state.cycle < ms_ready)
+    {
+        util::log(LOG_64_PIPE1, "DE__:   Switching to MSROM ...");
+        return 1;
+    }
+
+    for(u8 i = 0; i < cfg.msrom_width && msrip < ms_uops.size(); i++, msrip++)
+    {
+        if(util::log_enabled(LOG_64_PIPE1))
+            util::log(LOG_64_PIPE1, "DE.MS:  ", uop_readable(ms_uops[msrip]).str());
+        uqueue->push_back(state.cycle + DECODE_LATENCY, ms_uops[msrip]);
+    }
+
+    if(msrip < ms_uops.size()) return 1;
+
+    ms_uops.clear();
+    msrip = 0;
     return 0;
 }
 
+// mark uop pairs of a bundle that stay one uop until execute
+// - load feeding the next uop
+// - address calculation feeding the store
+u8 x64Frontend::fuse_micro(UopBundle& uops)
+{
+    if(!X64_MICRO_FUSION) return 0;
+
+    u8 fused = 0;
+    for(u8 i = 1; i < uops.size(); i++)
+    {
+        uop& first = uops[i-1];
+        uop& next  = uops[i];
+        u8   dst   = first.regs[r_rd];
+
+        if(!dst || (next.control & fuse_next)) continue;
+
+        u8 feeds = ((next.control & use_ra) && next.regs[r_ra] == dst) ||
+                   ((next.control & use_rb) && next.regs[r_rb] == dst) ||
+                   ((next.control & use_rc) && next.regs[r_rc] == dst);
+
+        if(feeds && ((is_load(first) && !is_store(next)) || (first.opcode == uop_lea && is_store(next))))
+        {
+            first.control |= fuse_next;
+            fused++;
+            i++;
+        }
+    }
+
+    if(!functional) micro_fused += fused;
+    return fused;
+}
+
 // print x64op as hexstring
 std::ostream& operator<<(std::ostream& os, const x64op& op)
 {
@@ -537,7 +707,7 @@ std::ostream& operator<<(std::ostream& os, const x64op& op)
 
     os << (op.off_opcode != 0 ? "||p " : "||o ");
 
-    for(u8 i = 0; i < op.bytes.size(); i++)
+    for(u8 i = 0; i < std::min(op.bytes.size(), op.bytes.b.size()); i++)
     {
         if(op.off_opcode && i == op.off_opcode) os << "|o ";
         if(op.off_modrm  && i == op.off_modrm)  os << "|m ";
@@ -560,20 +730,29 @@ std::ostream& operator<<(std::ostream& os, const DecoderStation& ds)
     return os << "|";
 }
 
-// get a temporary register from the register pool
-// for now this is implemented as ring buffer (use free/use list instead?)
-// todo those registers need to be reset
+// get a temporary register from the register pool, held until the next macro op is decoded
 u8 x64Frontend::get_tmpreg(const u8 regcls)
 {
     switch(regcls)
     {
         default:
         case regs_gp: // gp
-            return (cur_tmp_gp = reg64_t0 + ((cur_tmp_gp - reg64_t0 + 1) % (reg64_tmax - reg64_t0 + 1)));
-            break;
+            return tmp_gp.get();
         case regs_vr: // vr
-            return (cur_tmp_vr = reg64_tmm0 + ((cur_tmp_vr - reg64_tmm0 + 1) % reg64_tmmmax - reg64_tmm0 + 1));
-            break;
+            return tmp_vr.get();
+    }
+}
+
+// temporaries are x64 registers past the architectural ones
+u8 x64Frontend::is_tempreg(u8 regcls, u8 reg)
+{
+    if(!reg) return 0;
+
+    switch(regcls)
+    {
+        default:      return 0;
+        case regs_gp: return tmp_gp.contains(reg - 1);
+        case regs_vr: return tmp_vr.contains(reg - 1);
     }
 }
 
@@ -583,8 +762,16 @@ u8 x64Frontend::get_tmpreg(const u8 regcls)
 // -- modrm (+sib): ld/op or op/st or ld/op/st uop bundle
 u8 x64Frontend::run_decode(const x64op& op)
 {
+#if COUNT_ALLOCS
+    util::DecodeScope alloc_scope;
+#endif // COUNT_ALLOCS
+
+    // the last bundle has been emitted, its temporaries are dead
+    tmp_gp.release();
+    tmp_vr.release();
+
     // uops to be added to the uqueue
-    vector<uop> uops = {};
+    UopBundle uops;
     uop ud           = { uop_int, use_imm, {0}, ex_UD };
 
     // treat the entire macro op as #ud
@@ -688,17 +875,16 @@ u8 x64Frontend::run_decode(const x64op& op)
     const u8 reqpfx = has_reqpfx(opcode, op.meta.op_mode);
     const u8 haspfx = op.meta.has_g1 ? op.meta.has_g1 : 0;
 
-    vector<u8> opvec = [&]{
-        vector<u8> v = {};
-        if(reqpfx && haspfx)     v.push_back(haspfx);
-        if(op.meta.op_mode == 1) v.push_back(0x0f);
-        v.push_back(opcode);
-        if(opgrp)                v.push_back(modrm::get_reg(modrm)); // only 3 bit extension for now
-        return v;
-    }();
+    // opmap key on the stack: prefix, escape, opcode, group bits
+    std::array<u8, 4> opkey = { 0 };
+    u8                keylen = 0;
+    if(reqpfx && haspfx)     opkey[keylen++] = haspfx;
+    if(op.meta.op_mode == 1) opkey[keylen++] = 0x0f;
+    opkey[keylen++] = opcode;
+    if(opgrp)                opkey[keylen++] = modrm::get_reg(modrm); // only 3 bit extension for now
 
-    x64def::x64opinfo opinfo            = x64def::get_opinfo(opvec);
-    vector<x64def::x64operand> operands = opinfo.operands;
+    const x64def::x64opinfo& opinfo            = x64def::get_opinfo({ opkey.data(), keylen });
+    const vector<x64def::x64operand>& operands = opinfo.operands;
 
     util::log(LOG_64_PIPE1, "        macro mnemonic: ", opinfo.mnemonic);
 
@@ -1991,18 +2177,42 @@ u8 x64Frontend::run_decode(const x64op& op)
 
     util::log(LOG_64_PIPE1, "        Uop bundle:", (uops.empty() ? " EMPTY" : ""));
 
-    // add collected uops to the queue
-    for(uop op : uops)
-    {
+    for(uop& op : uops)
         if(op.imm) op.control |= use_imm; // adjusted register
 
-        util::log(LOG_64_PIPE1, "          ", uop_readable(op).str());
+    if(!functional)
+    {
+        decoded_mops++;
+        decoded_uops += uops.size();
+    }
+
+    // the jcc decoded next on this decoder joins the flag setting uop
+    if(op.meta.fused && !uops.empty()) uops.back().control |= fuse_next;
+    fuse_micro(uops);
+    if(cfg.lsd_enable && !functional) lsd_capture(op, uops);
+
+    // too long for the complex decoder, the MSROM takes over
+    if(uops.size() > X64_CMPLX_UOPS)
+    {
+        util::log(LOG_64_PIPE1, "          ", dec_u<0>, uops.size(), " uops from MSROM.\n");
+        ms_uops  = uops;
+        msrip    = 0;
+        ms_ready = state.cycle + cfg.msrom_penalty;
+        if(!functional) msrom_ops++;
+        return 1;
+    }
+
+    // add collected uops to the queue
+    for(uop& op : uops)
+    {
+        if(util::log_enabled(LOG_64_PIPE1))
+            util::log(LOG_64_PIPE1, "          ", uop_readable(op).str());
         uqueue->push_back(state.cycle + DECODE_LATENCY, op);
     }
 
     util::log(LOG_64_PIPE1, "");
 
     // 0: all uops have been inserted
-    // 1: some uops are still missing (e.g. MSROM?) TBD
+    // 1: some uops are still missing (MSROM)
     return 0;
 }
\ No newline at end of file
@@ -14,6 +14,12 @@
 
 #include "../core/uops.hh"
 
+// a macro op exceeds the compiled decoder limits
+struct x64DecodeException : public MessageException
+{
+    using MessageException::MessageException;
+}; // x64DecodeException
+
 // decode metadata
 struct x64d_meta
 {
@@ -25,11 +31,31 @@ struct x64d_meta
     u8 off_rex  = 0;
     u8 op_mode  = 0; // # of opcode escapes
     u8 decoder  = 0;
+    u8 fused    = 0; // macro fused with the next instruction in the iqueue
 };
 
+// instruction bytes stored inline
+// overlong instructions (#UD) keep counting their length, but only the first 15 bytes are kept and can be indexed
+struct x64bytes
+{
+    std::array<u8, 15> b = { 0 };
+    u8                 n = 0;
+
+    size_t size()  const { return n; };
+    bool   empty() const { return !n; };
+    void   clear()       { n = 0; };
+
+    u8&       operator[](size_t i)       { return b[i]; };
+    const u8& operator[](size_t i) const { return b[i]; };
+    u8&       back()                     { return b[n - 1]; };
+
+    void push_back(u8 v) { if(n < b.size()) b[n] = v; n++; };
+    void append(const u8* src, size_t len) { for(size_t i = 0; i < len; i++) push_back(src[i]); };
+}; // x64bytes
+
 struct x64op
 {
-    vector<u8> bytes;
+    x64bytes bytes;
     // prefix always starts at offset 0 if present
     u8 off_opcode = 0; // these are offsets into .bytes
     u8 off_modrm  = 0; //
@@ -38,6 +64,7 @@ struct x64op
     u8 off_imm    = 0; //
     u8 len        = 0; // 0 invalid, >15 invalid -> #UD
     x64d_meta meta;
+    u64 rip       = 0; // set when the instruction enters the iqueue
     // todo recognize partial instructions
 };
 
@@ -48,7 +75,39 @@ typedef enum
     x64d_seq,   // uop sequencer/ROM: >4 uops (4 / cycle)
 } x64d_type;
 
-const x64op zero_x64op = { {}, 0, 0, 0, 0, 0, 0, {} };
+const x64op zero_x64op = { {}, 0, 0, 0, 0, 0, 0, {}, 0 };
+
+// uops of one macro op, built in place by the decoders
+// fixed capacity so decode does not touch the heap
+struct UopBundle
+{
+    std::array<uop, X64_MAX_UOPS> u;
+    u8                            n = 0;
+
+    size_t size()  const { return n; };
+    bool   empty() const { return !n; };
+    void   clear()       { n = 0; };
+
+    uop&       operator[](size_t i)       { return u[i]; };
+    const uop& operator[](size_t i) const { return u[i]; };
+    uop&       front()                    { return u[0]; };
+    uop&       back()                     { return u[n - 1]; };
+
+    uop*       begin()                    { return u.data(); };
+    uop*       end()                      { return u.data() + n; };
+    const uop* begin() const              { return u.data(); };
+    const uop* end()   const              { return u.data() + n; };
+
+    void push_back(const uop& op)
+    {
+        if(n >= X64_MAX_UOPS) [[unlikely]]
+            throw x64DecodeException("Uop bundle exceeds X64_MAX_UOPS (", X64_MAX_UOPS, ").");
+        u[n++] = op;
+    };
+}; // UopBundle
+
+// copied through iqueue and decoders by value
+static_assert(std::is_trivially_copyable_v<x64op> && sizeof(x64op) <= 64);
 
 std::ostream& operator<<(std::ostream& os, const x64op& op);
 
@@ -252,7 +311,7 @@ constexpr u8 get_immsz(const u8 byte, const u8 opsz, const u8 mode, const u8 mod
             if(!group) return x64def::immsz_1b[byte];
             else
             {
-                x64def::x64opinfo info = x64def::get_opinfo({byte, mod_reg});
+                const x64def::x64opinfo& info = x64def::get_opinfo({byte, mod_reg});
                 u8 tmp = 0;
                 for(auto i : info.operands)
                     if(i.addr_mode == x64def::I)
@@ -284,6 +343,7 @@ inline u8 is_branch(const x64op& op)
             {
                 case 0x70 ... 0x7f:
                 case 0xca ... 0xcb:
+                case 0xe3:          // jrcxz
                     return branch_cond;
                 case 0xc2 ... 0xc3: // ret will always jump
                 case 0xe8 ... 0xe9: // and so will call
@@ -310,6 +370,127 @@ inline u8 is_branch(const x64op& op)
     }
 }
 
+// target of a direct conditional branch, 0 otherwise
+inline u64 jcc_target(const x64op& op, u64 seq)
+{
+    if(is_branch(op) != branch_cond || !op.off_imm) return 0;
+
+    switch(op.bytes.size() - op.off_imm)
+    {
+        case 1:
+            return seq + (i8)op.bytes[op.off_imm];
+        case 4:
+        {
+            i32 rel;
+            std::memcpy(&rel, &op.bytes[op.off_imm], 4);
+            return seq + rel;
+        }
+        default:
+            return 0;
+    }
+}
+
+// flag setting instruction can be macro fused with the following jcc
+// test/and fuse with every jcc, add/sub/cmp not on o/s/p, inc/dec only on z/l/le
+// memory operands only for cmp/test without immediate
+inline u8 macro_fusible(const x64op& op, const x64op& jcc)
+{
+    if(op.bytes.empty() || jcc.bytes.empty() || op.len == 0xff || jcc.len == 0xff || op.meta.op_mode) return 0;
+
+    u8 jop = jcc.bytes[jcc.off_opcode + jcc.meta.op_mode];
+    if(!((!jcc.meta.op_mode && jop >= 0x70 && jop <= 0x7f) || (jcc.meta.op_mode == 1 && jop >= 0x80 && jop <= 0x8f)))
+        return 0;
+
+    enum { fuse_none, fuse_logic, fuse_arith, fuse_incdec } type = fuse_none;
+
+    u8 opcode = op.bytes[op.off_opcode];
+    u8 reg    = op.off_modrm ? modrm::get_reg(op.bytes[op.off_modrm]) : 0;
+    u8 mem    = op.off_modrm && modrm::get_mod(op.bytes[op.off_modrm]) != 0b11;
+
+    switch(opcode)
+    {
+        case 0x20 ... 0x25: // and
+        case 0x84 ... 0x85: // test
+        case 0xa8 ... 0xa9:
+            type = fuse_logic; break;
+        case 0x00 ... 0x05: // add
+        case 0x28 ... 0x2d: // sub
+        case 0x38 ... 0x3d: // cmp
+            type = fuse_arith; break;
+        case 0x80 ... 0x81: // group 1 with immediate
+        case 0x83:
+            type = (reg == 0b100 ? fuse_logic :
+                ((reg == 0b000 || reg == 0b101 || reg == 0b111) ? fuse_arith : fuse_none)); break;
+        case 0xf6 ... 0xf7: // test Eb/Ib, Ev/Iz
+            type = (reg == 0b000 ? fuse_logic : fuse_none); break;
+        case 0xfe ... 0xff: // inc, dec
+            type = (reg <= 0b001 ? fuse_incdec : fuse_none); break;
+    }
+
+    if(mem && !((opcode >= 0x38 && opcode <= 0x3b) || opcode == 0x84 || opcode == 0x85)) return 0;
+
+    u8 cc = jop & 0xf;
+    switch(type)
+    {
+        case fuse_logic:  return 1;
+        case fuse_arith:  return !(cc <= scc_NO || (cc >= scc_S && cc <= scc_NP));
+        case fuse_incdec: return (cc == scc_E || cc == scc_NE || cc >= scc_L);
+        default:          return 0;
+    }
+}
+
+// memory source form that decodes to ld + op, micro fused into one uop
+constexpr u8 is_loadop(const u8 opcode, const u8 mode)
+{
+    if(mode) return 0;
+
+    return ((opcode < 0x40 && ((opcode & 0x07) == 0x02 || (opcode & 0x07) == 0x03)) || // op r, r/m
+            opcode == 0x38 || opcode == 0x39 ||                                        // cmp r/m, r
+            opcode == 0x84 || opcode == 0x85 ||                                        // test r/m, r
+            opcode == 0x8a || opcode == 0x8b);                                         // mov r, r/m
+}
+
+// near call, pushes the sequential rip
+inline u8 is_call(const x64op& op)
+{
+    if(op.meta.op_mode) return 0;
+
+    switch(op.bytes[op.off_opcode])
+    {
+        case 0xe8:
+            return 1;
+        case 0xff:          // call r/m
+            return modrm::get_reg(op.bytes[op.off_modrm]) == 0b010;
+        default:
+            return 0;
+    }
+}
+
+// near return
+inline u8 is_ret(const x64op& op)
+{
+    return !op.meta.op_mode && (op.bytes[op.off_opcode] == 0xc2 || op.bytes[op.off_opcode] == 0xc3);
+}
+
+// target is not encoded in the instruction
+inline u8 is_indirect(const x64op& op)
+{
+    if(op.meta.op_mode) return 0;
+
+    switch(op.bytes[op.off_opcode])
+    {
+        case 0xc2 ... 0xc3: // ret
+            return 1;
+        case 0xff:          // call/jmp r/m
+        {
+            u8 modreg = modrm::get_reg(op.bytes[op.off_modrm]);
+            return modreg >= 0b010 && modreg <= 0b101;
+        }
+        default:
+            return 0;
+    }
+}
+
 // instruction is a gp instruction
 inline u8 is_gp(const x64op& op)
 {
@@ -432,6 +613,34 @@ typedef enum
 constexpr u8 to_ureg(const u8 reg)                 { return (reg + 1); }
 constexpr u8 to_ureg(const u8 reg, const u8 valid) { return (valid ? (reg + 1) : 0); }
 
+// temporaries of one register class
+// free/used masks, a macro op takes what it needs and releases all of them before the next one is decoded
+// temps never live across macro ops, so the last uop of the bundle is their last reader
+struct TempRegs
+{
+    const u8 first; // first temp register
+    const u8 count;
+    u32      free;  // bit i: first + i is free
+    u32      used;  // held by the current macro op
+
+    TempRegs(u8 first, u8 last) : first(first), count(last - first + 1), free(bitmask(count)), used(0) {};
+
+    u8 get()
+    {
+        if(!free) [[unlikely]]
+            throw x64DecodeException("Macro op needs more than ", +count, " temporary registers.");
+        u8 i  = __builtin_ctz(free);
+        free &= ~(1u << i);
+        used |=  (1u << i);
+        return first + i;
+    };
+
+    void release()             { free |= used; used = 0; };
+    u8   contains(u8 reg) const { return reg >= first && reg < first + count; };
+}; // TempRegs
+
+static_assert(reg64_tmax - reg64_t0 + 1 <= 32 && reg64_tmmmax - reg64_tmm0 + 1 <= 32);
+
 // -> lut?
 constexpr u8 to_core_except(const u8 x64_ex)
 {
@@ -439,19 +648,39 @@ constexpr u8 to_core_except(const u8 x64_ex)
     return ex_UNSPEC;
 };
 
-typedef enum
+// instruction length decoder
+// - prefix mask of a predecode buffer
+// - table driven length and offsets of one instruction
+// - boundaries of all instructions in a buffer
+namespace x64ild
 {
-    pd_reset,  // ready
-    pd_prefix, // parse prefixes
-    pd_opcode, // opcode bytes
-    pd_modrm,  // modrm, sib, displacement
-    pd_imm,    // imm bytes
-} pd_state;
+    typedef enum
+    {
+        ild_ok,      // complete instruction
+        ild_partial, // instruction continues past the buffer
+        ild_ud,      // VEX/EVEX, 3 byte opcode or > 15 bytes -> #UD
+    } ild_status;
+
+    // length decoded predecode buffer
+    struct Block
+    {
+        std::array<x64op, X64_PD_BUFFER> ops;
+        u128 starts = 0; // bit i: instruction starts at buffer index i
+        u8   count  = 0; // # of ops, a trailing #UD op is included
+        u8   tail   = 0; // first byte not covered by ops
+        u8   status = 0; // ild_status of the instruction at tail
+    }; // Block
+
+    u128 prefix_mask(const u8* buf, size_t len);
+    u8   length(const u8* buf, size_t avail, u128 pfx, x64op& op);
+    u8   decode_block(const u8* buf, size_t len, Block& block);
+}
 
 // TODO msrom latency
 struct x64Decoder
 {
     x64op    instr = zero_x64op; // instruction to decode
+    x64op    fused = zero_x64op; // jcc macro fused with instr
     const u8 type;               // x64d_type
     u8       busy  = 0;
     const u8 id;                 // unique id
@@ -474,26 +703,63 @@ const std::string x64d_type_str[3] =
 // - fuse
 // -> uqueue
 
+// 4-1-1-1 legacy decode + MSROM
 struct DecoderStation
 {
     vector<x64Decoder> decoders =
     {
-        x64Decoder(0, x64d_fast),
+        x64Decoder(0, x64d_cmplx),
         x64Decoder(1, x64d_fast),
         x64Decoder(2, x64d_fast),
         x64Decoder(3, x64d_fast),
-        x64Decoder(4, x64d_cmplx),
-        x64Decoder(5, x64d_seq),
+        x64Decoder(4, x64d_seq),
     };
+
+    const u8 cmplx_id    = 0;
+    const u8 seq_id      = 4;
+    const u8 simple_mask = 0b01110;
+    const u8 width       = 4;       // instructions per decode group
+}; // DecoderStation
+
+// why a decode group was smaller than the decode width
+typedef enum
+{
+    dst_none,    // all decoders used
+    dst_empty,   // iqueue empty
+    dst_latency, // instructions still in predecode
+    dst_complex, // complex instruction not first in its group
+    dst_msrom,   // MSROM switch or streaming
+    dst_busy,    // last group still decoding, uqueue full
+    dst_max,
+} decode_stall;
+
+const std::string decode_stall_str[dst_max] =
+{
+    ("none"), ("empty"), ("latency"), ("complex"), ("MSROM"), ("busy")
 };
 
 std::ostream& operator<<(std::ostream& os, const DecoderStation& ds);
 
+typedef enum
+{
+    lsd_idle,   // collecting decoded macro ops
+    lsd_armed,  // loop body captured
+    lsd_locked, // fetch/decode idle, uops come from the loop buffer
+} lsd_status;
+
+// decoded macro op in the loop buffer
+struct LoopBufferEntry
+{
+    u64       rip;
+    u64       seq;
+    UopBundle uops;
+}; // LoopBufferEntry
+
 class x64Frontend : public Frontend
 {
     public:
-    x64Frontend(MemoryManager& mmu, LatchQueue<uop>* uqueue,
-            Simulator::SimulatorState& state);
+    x64Frontend(MemoryManager& mmu, LatchQueue<uop>* uqueue, Simulator::SimulatorState& state,
+            const FrontendConfig& cfg, u8 bpred = bp_btb, u8 ittage = 0, u8 loop = 0);
     ~x64Frontend();
     u8                cycle();
     u8                flush();
@@ -502,29 +768,61 @@ class x64Frontend : public Frontend
     u8 fetch();
     u8 fuse_macro();
     u8 udecode();
-    u8 fuse_micro();
+    u8 fuse_micro(UopBundle& uops);
 
     u8 get_tmpreg(const u8 regcls);
+    u8 is_tempreg(u8 regcls, u8 reg);
     u8 run_decode(const x64op& op);
+    u8 decode_at(u64 rip, u64 seq_no, vector<uop>& uops, u64& seq, u64& pred);
+
+    protected:
+    u8                  predict_next(u64 rip, u64 seq_no, u64& seq, u64& pred);
 
     private:
     u8                  flush(u8 total);
-
-    LatchQueue<x64op>   iqueue = LatchQueue<x64op>(IQUEUE_SIZE);
+    u8                  peek(u64 rip, x64op& op);
+    void                predict_op(const x64op& op, u64 seq_no, u64& seq, u64& pred);
+    void                lsd_capture(const x64op& op, const UopBundle& uops);
+    u8                  lsd_replay();
+    u8                  assign_decoders();
+    u8                  ms_stream();
+
+    LatchQueue<x64op>   iqueue = LatchQueue<x64op>(cfg.iqueue_size);
     DecoderStation      ds;
 
-    vector<u8>          fetchbytes;   // fetch queue aka pd buffer
-    u64                 pdblocksz;    // current block size
-    u8                  pd_state;     // last predecoder state
-    u8                  pd_remaining; // remaining displ/imm bytes
-    x64op               part_op;      // last partially decoded instruction
+    std::array<u8, X64_FETCH_BYTES> fetchbytes; // fetch block
+    std::array<u8, X64_PD_BUFFER>   pdbuf;      // predecode buffer: carried bytes + fetch block
+    x64bytes            pd_carry;     // bytes of an instruction continuing in the next block
+    x64ild::Block       pdblock;      // length decoded pdbuf
     std::deque<u8>      next_decoder; // decoder which places uops into the uqueue next
     u8                  msrip;        // next uop index for current macro op
+    UopBundle           ms_uops;      // bundle streamed from the MSROM
+    u64                 ms_ready;     // MSROM switch penalty over
+    u8                  functional = 0; // decode_at is running, no stats and no LSD capture
 
     // one per regfile
-    u8                  cur_tmp_gp;   // last used temporary gpreg
-    u8                  cur_tmp_vr;
-    // u8                  cur_tmp_fp;
+    TempRegs            tmp_gp = TempRegs(reg64_t0, reg64_tmax);
+    TempRegs            tmp_vr = TempRegs(reg64_tmm0, reg64_tmmmax);
+
+    // loop stream detector
+    LatchQueue<LoopBufferEntry> lsd_window =     // last decoded contiguous macro ops
+        LatchQueue<LoopBufferEntry>(LSD_SIZE + 1);
+    u16                         lsd_window_uops;
+    vector<LoopBufferEntry>     lsd_body;        // captured loop, ends with the backward branch
+    u8                          lsd_state;
+    u16                         lsd_pos;         // next body entry to replay
+
+    // activity
+    u64                         fetch_cycles;    // cycles fetch/predecode did work
+    u64                         decoded_mops;
+    u64                         lsd_uops;        // uops sent from the loop buffer
+    u64                         lsd_locks;
+    u64                         decoded_uops;
+    u64                         macro_fused;     // cmp/test + jcc pairs
+    u64                         micro_fused;     // ld + op, address + store pairs
+    u64                         msrom_ops;
+    std::array<u64, 5>          decode_groups;   // cycles with n instructions sent to the decoders
+    std::array<u64, dst_max>    decode_stalls;
 };
 
 #endif // SIM_FRONTEND64_H
@@ -11,9 +11,10 @@
 
 #include "core/uops.hh"
 
+#include <algorithm>
 #include <cstring>
 
-MemoryManager::MemoryManager(Simulator::SimulatorState& state) : state(state)
+MemoryManager::MemoryManager(Simulator::SimulatorState& state, const MemConfig& cfg) : state(state), cfg(cfg)
 {
     util::log(LOG_MM_INIT, "MMU initialized with:");
     util::log(LOG_MM_INIT, "        ADDR_SIZE ", dec_u<0>, ADDR_SIZE);
@@ -22,6 +23,9 @@ MemoryManager::MemoryManager(Simulator::SimulatorState& state) : state(state)
 
 MemoryManager::~MemoryManager()
 {
+    // committed stores still own their buffers
+    for(auto& sr : stbuf) free(sr.mref.data);
+
     unmap_all_pages();
     unmap_all_frames();
 }
@@ -66,6 +70,19 @@ u8 MemoryManager::refresh()
     return 0;
 }
 
+// execute all buffered stores now, regardless of their latency
+u8 MemoryManager::drain()
+{
+    for(auto& mr : stbuf)
+    {
+        write(mr.mref.vaddr, mr.mref.data, mr.mref.size);
+        free(mr.mref.data);
+    }
+    stbuf.clear();
+    ldbuf.clear();
+    return 0;
+}
+
 // clear load buffer
 u8 MemoryManager::clear_bufs()
 {
@@ -74,6 +91,18 @@ u8 MemoryManager::clear_bufs()
     return 0;
 }
 
+// drop a pending load whose ROB entry was squashed
+u8 MemoryManager::cancel_load(MM::MemoryRef* mref)
+{
+    for(auto i = ldbuf.begin(); i != ldbuf.end(); ++i)
+        if(i->mref == mref)
+        {
+            ldbuf.erase(i);
+            return 1;
+        }
+    return 0;
+}
+
 u8 MemoryManager::active()
 {
     return !stbuf.empty();
@@ -86,7 +115,7 @@ MM::PageFrame& MemoryManager::map_frame(u64 paddr, i8 pl, u8 rwx, string name)
     if((paddr > PADDR_LIMIT) || (paddr % PAGE_SIZE)) throw InvalidPageaddrException();
     if(mem.count(paddr)) throw PageAlreadyMappedException();
 
-    MM::PageFrame frame = { aligned_alloc(PAGE_SIZE, PAGE_SIZE), PAGE_SIZE, pl, rwx, 0, name };
+    MM::PageFrame frame = { aligned_alloc(PAGE_SIZE, PAGE_SIZE), PAGE_SIZE, pl, rwx, 0, 0, name };
     if(!(frame.data)) throw AllocationFailedException();
 
     memset(frame.data, 0, PAGE_SIZE); // init to zero
@@ -109,7 +138,8 @@ u8 MemoryManager::unmap_frame(u64 paddr)
     util::log(LOG_MM_MAPPED, "MMU_:   Unmapped frame p.", hex_u<64>, paddr, " with data at e.", hex_u<64>,
         (uptr)cur_page->data, ".\n");
 
-    free((void*)cur_page->data);
+    // external memory belongs to whoever mapped it
+    if(!cur_page->ext) free((void*)cur_page->data);
     mem.erase(paddr);
 
     return 0;
@@ -121,7 +151,7 @@ u8 MemoryManager::unmap_all_frames()
     void* cur_data;
     for(auto& pf : mem)
     {
-        if(pf.second.ext)
+        if(!pf.second.ext)
         {
             cur_data = pf.second.data;
             util::log(LOG_MM_MAPPED, "MMU_:   Freeing e.", (uptr)cur_data, ".");
@@ -192,7 +222,7 @@ vector<std::pair<MM::PageFrame*, u64>> MemoryManager::mmap_frames(u64 paddr, voi
     uptr cur_eaddr = (uptr)extaddr;
     for(;len >= PAGE_SIZE; (len -= PAGE_SIZE))
     {        
-        MM::PageFrame frame = { (void*)cur_eaddr, PAGE_SIZE, pl, rwx, 1, name };
+        MM::PageFrame frame = { (void*)cur_eaddr, PAGE_SIZE, pl, rwx, 1, 0, name };
         auto ins = mem.insert({ cur_paddr, frame });
 
         util::log(LOG_MM_MAPPED, "MMU_:   Mapped frame \'", frame.name, "\' p.", hex_u<64>, cur_paddr, " -> e.",
@@ -207,7 +237,7 @@ vector<std::pair<MM::PageFrame*, u64>> MemoryManager::mmap_frames(u64 paddr, voi
     // special case: last frame is smaller than frame size
     if(len && (len < PAGE_SIZE))
     {
-        MM::PageFrame frame = { (void*)cur_eaddr, len, pl, rwx, 1, name };
+        MM::PageFrame frame = { (void*)cur_eaddr, len, pl, rwx, 1, 0, name };
         auto ins = mem.insert({ cur_paddr, frame });
 
         util::log(LOG_MM_MAPPED, "MMU_:   Mapped frame \'", frame.name, "\' p.", hex_u<64>, cur_paddr, " -> e.",
@@ -307,18 +337,20 @@ void* MemoryManager::get_eaddr(u64 vaddr, u8 rwx)
 {
     if(!pagetable.count(pageFloor(vaddr))) throw PageNotMappedException();
 
-    u64 frame = pageFloor(get_paddr(vaddr, rwx));
+    auto pf = mem.find(pageFloor(get_paddr(vaddr, rwx)));
 
-    if(!mem.count(frame) || (pageOffs(vaddr) > (mem.at(frame).bytes_used - 1)))
+    if((pf == mem.end()) || (pageOffs(vaddr) > (pf->second.bytes_used - 1)))
         throw InvalidAddrException();
 
-    if(!(rwx & mem.at(frame).rwx))
+    MM::PageFrame& frame = pf->second;
+    if(!(rwx & frame.rwx))
         throw AccessBitViolationException();
 
-    if(state.ring > mem.at(frame).pl)
+    if(state.ring > frame.pl)
         throw ProtectionViolationException();
 
-    return (void*)((uptr)mem.at(frame).data + pageOffs(vaddr));
+    if(rwx & MM::p_w) frame.dirty = 1;
+    return (void*)((uptr)frame.data + pageOffs(vaddr));
 }
 
 // add a read request to the load queue
@@ -342,9 +374,9 @@ u8 MemoryManager::get(MM::MemoryRequest& req, u8 rx)
     // no dependency check needed! core laod/store check will handle this
     req.mref->ready = MM::mr_inexec;
     util::log(LOG_MM_REQUEST, "MMU_:   Load from v.", hex_u<64>, req.mref->vaddr, " requested. Expected latency ",
-        MM_LD_LATENCY, " cycles.");
+        cfg.ld_latency, " cycles.");
     
-    req.cycle = state.cycle + MM_LD_LATENCY;
+    req.cycle = state.cycle + cfg.ld_latency;
     ldbuf.push_back(req);
     return 0;
 }
@@ -366,9 +398,9 @@ u8 MemoryManager::put(MM::MemoryRequest& req)
     }
     // this request is not allowed to throw or fault in any way, the core views this store as commited
     util::log(LOG_MM_REQUEST, "MMU_:   Store to v.", hex_u<64>, req.mref->vaddr, " requested. Expected latency ",
-        MM_ST_LATENCY, " cycles.");
+        cfg.st_latency, " cycles.");
 
-    req.cycle = state.cycle + MM_ST_LATENCY;
+    req.cycle = state.cycle + cfg.st_latency;
     
     void* localbuf = aligned_alloc(req.mref->size, req.mref->size);
     if(!localbuf) throw AllocationFailedException(); // needed for correct values after many cycles, preg may be invalid
@@ -383,6 +415,31 @@ u8 MemoryManager::put(MM::MemoryRequest& req)
     return 0;
 }
 
+// read or write req immediately, 1 if the access faulted and the exception is set
+u8 MemoryManager::access(MM::MemoryRequest& req, u8 rwx)
+{
+    u8 present = !!(pagetable.count(pageFloor(req.mref->vaddr)) &&
+        pagetable.count(pageFloor(req.mref->vaddr + req.mref->size - 1)));
+
+    if(present && !bad_pl(req.mref->vaddr, req.mref->size) && !bad_rwx(req.mref->vaddr, req.mref->size, rwx))
+        try
+        {
+            if(rwx == MM::p_w) write(req.mref->vaddr, req.mref->data, req.mref->size);
+            else               read(req.mref->vaddr, req.mref->data, req.mref->size, rwx);
+            req.mref->ready = MM::mr_valready;
+            return 0;
+        }
+        catch(const MemoryManagerException& mme) { util::log(LOG_MM_REQUEST, "MMU_:   ", mme.what()); }
+
+    util::log(LOG_MM_REQUEST, "MMU_:   Access to v.", hex_u<64>, req.mref->vaddr, " with ", req.mref->size,
+        " bytes faulted. Exception set.");
+
+    *req.exception = setExcept(ex_PF, present | ((rwx == MM::p_w) ? expf_write : 0) |
+        (state.ring == pl_user ? expf_user : 0));
+    req.mref->ready = MM::mr_valready;
+    return 1;
+}
+
 // read from vaddr into data, return latency and actual number of bytes read
 pair<u64, u64> MemoryManager::read(u64 vaddr, void* data, size_t len, u8 rx)
 {
@@ -427,7 +484,7 @@ pair<u64, u64> MemoryManager::read(u64 vaddr, void* data, size_t len, u8 rx)
         }
         else std::memcpy(data, get_eaddr(vaddr, rx), len);
 
-        latency = MM_LD_LATENCY;
+        latency = cfg.ld_latency;
     } // rethrow any exceptions caused by address lookups
     catch(const MemoryManagerException& mme) { throw; }
 
@@ -482,6 +539,121 @@ void MemoryManager::write(u64 vaddr, void* data, size_t len)
     util::log(LOG_MM_EXEC, "MMU_:   Write successful.\n");
 }
 
+// page table, frame table and the contents of written frames
+void MemoryManager::save(ckpt::Writer& w, u8 compress)
+{
+    // committed stores still in the buffer belong to the snapshot, apply them to copies of their frames
+    std::map<u64, vector<u8>> copies;
+    for(auto& sr : stbuf)
+        for(size_t i = 0; i < sr.mref.size; i++)
+        {
+            u64 paddr = get_paddr(sr.mref.vaddr + i, MM::p_w);
+            MM::PageFrame& f = mem.at(pageFloor(paddr));
+            vector<u8>& c = copies[pageFloor(paddr)];
+            if(c.empty()) c.assign((u8*)f.data, (u8*)f.data + f.bytes_used);
+            c[pageOffs(paddr)] = ((u8*)sr.mref.data)[i];
+        }
+
+    std::ostream& pt    = w.section(ckpt::sec_pagetable);
+    std::ostream& ft    = w.section(ckpt::sec_frames);
+    std::ostream& pages = w.section(ckpt::sec_pages);
+
+    for(auto& p : pagetable)
+        ckpt::put(pt, ckpt::PageRecord { p.first, p.second.frameno, p.second.present, p.second.pl, p.second.rwx, {} });
+
+    u64 offs = 0;
+    for(auto& pf : mem)
+    {
+        const MM::PageFrame& f = pf.second;
+        const u8* data = copies.count(pf.first) ? copies[pf.first].data() : (const u8*)f.data;
+
+        ckpt::FrameRecord rec = { pf.first, f.bytes_used, offs, 0, f.pl, f.rwx, ckpt::enc_clean, 0 };
+        if(f.dirty || copies.count(pf.first))
+        {
+            rec.enc = std::all_of(data, data + f.bytes_used, [](u8 b) { return !b; }) ? ckpt::enc_zero : ckpt::enc_raw;
+
+            vector<u8> rle;
+            if((rec.enc == ckpt::enc_raw) && compress) rle = ckpt::rle_encode(data, f.bytes_used);
+
+            if((rec.enc == ckpt::enc_raw) && compress && (rle.size() < f.bytes_used))
+            {
+                rec.enc  = ckpt::enc_rle;
+                rec.size = rle.size();
+                pages.write((const char*)rle.data(), rle.size());
+            }
+            else if(rec.enc == ckpt::enc_raw)
+            {
+                // raw frames stay page aligned inside the mapped file
+                u64 pad = (PAGE_SIZE - (offs % PAGE_SIZE)) % PAGE_SIZE;
+                pages << string(pad, '\0');
+                rec.offset = offs + pad;
+                rec.size   = f.bytes_used;
+                pages.write((const char*)data, f.bytes_used);
+                offs += pad;
+            }
+        }
+
+        offs += rec.size;
+        ckpt::put(ft, rec);
+    }
+
+    util::log(LOG_MM_MAPPED, "MMU_:   Saved ", dec_u<0>, pagetable.size(), " pages, ", mem.size(), " frames, ", offs,
+        " bytes of frame data.");
+}
+
+// restore into the mappings of the same workload, missing frames are allocated
+void MemoryManager::load(const ckpt::Reader& r)
+{
+    std::string_view pt    = r.section(ckpt::sec_pagetable);
+    std::string_view ft    = r.section(ckpt::sec_frames);
+    std::string_view pages = r.section(ckpt::sec_pages);
+    if((pt.size() % sizeof(ckpt::PageRecord)) || (ft.size() % sizeof(ckpt::FrameRecord))) throw CheckpointException();
+
+    clear_bufs();
+    for(auto& sr : stbuf) free(sr.mref.data);
+    stbuf.clear();
+
+    for(size_t i = 0; i < ft.size(); i += sizeof(ckpt::FrameRecord))
+    {
+        ckpt::FrameRecord rec;
+        std::memcpy(&rec, ft.data() + i, sizeof(rec));
+
+        if(!mem.count(rec.paddr)) map_frame(rec.paddr, rec.pl, rec.rwx, ".ckpt");
+        MM::PageFrame& f = mem.at(rec.paddr);
+        if((f.bytes_used != rec.bytes_used) || (rec.offset > pages.size()) || (rec.size > pages.size() - rec.offset))
+            throw CheckpointException();
+
+        const u8* data = (const u8*)pages.data() + rec.offset;
+        switch(rec.enc)
+        {
+            case ckpt::enc_clean: break;
+            case ckpt::enc_zero:  std::memset(f.data, 0, f.bytes_used); break;
+            case ckpt::enc_raw:
+                if(rec.size != f.bytes_used) throw CheckpointException();
+                std::memcpy(f.data, data, f.bytes_used);
+                break;
+            case ckpt::enc_rle:
+                if(ckpt::rle_decode(data, rec.size, (u8*)f.data, f.bytes_used)) throw CheckpointException();
+                break;
+            default: throw CheckpointException();
+        }
+
+        f.pl    = rec.pl;
+        f.rwx   = rec.rwx;
+        f.dirty = (rec.enc != ckpt::enc_clean);
+    }
+
+    for(size_t i = 0; i < pt.size(); i += sizeof(ckpt::PageRecord))
+    {
+        ckpt::PageRecord rec;
+        std::memcpy(&rec, pt.data() + i, sizeof(rec));
+        pagetable[rec.vaddr] = { rec.frameno, rec.present, rec.pl, rec.rwx };
+    }
+
+    util::log(LOG_MM_MAPPED, "MMU_:   Restored ", dec_u<0>, pt.size() / sizeof(ckpt::PageRecord), " pages, ",
+        ft.size() / sizeof(ckpt::FrameRecord), " frames.");
+}
+
 // void* malloc(size_t size) { return nullptr; }
 // void free(void* ptr) { };
 // void* calloc(size_t cnt, size_t size) { return memset(nullptr, 0, size*cnt); }
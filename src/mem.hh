@@ -10,7 +10,9 @@
 #define SIM_MEM_H
 
 #include "sim.hh"
+#include "checkpoint.hh"
 #include "conf.hh"
+#include "config.hh"
 #include "util.hh"
 
 #include <tuple>
@@ -32,6 +34,7 @@ namespace MM
         i8          pl;
         u8          rwx;        
         u8          ext;        // page references external memory
+        u8          dirty;      // written through the MMU since it was mapped
         string      name;       // page description, section, ..
     }; // PageFrame
 
@@ -83,6 +86,9 @@ namespace MM
 
     const std::string memref_mode_str[5] = { ("0"), ("r"), ("w"), ("b"), ("+") };
 
+    // declared in MM so util::log finds it through ADL
+    std::ostream& operator<<(std::ostream& os, const MemoryRef& mr);
+
     struct MemoryRequest
     {
         MemoryRef* mref      = nullptr; // careful, store reference might be gone from ROB
@@ -109,10 +115,12 @@ namespace MM
 class MemoryManager
 {
     public:
-    MemoryManager(Simulator::SimulatorState& state);
+    MemoryManager(Simulator::SimulatorState& state, const MemConfig& cfg);
     ~MemoryManager();
     u8 refresh();
+    u8 drain();
     u8 clear_bufs();
+    u8 cancel_load(MM::MemoryRef* mref);
     u8 active();
 
     MM::PageFrame&      map_frame(u64 paddr, i8 pl, u8 rwx, string name);
@@ -136,6 +144,8 @@ class MemoryManager
 
     u8    get(MM::MemoryRequest& req, u8 rx);
     u8    put(MM::MemoryRequest& req);
+    // functional access without load/store buffers, same checks as get/put
+    u8    access(MM::MemoryRequest& req, u8 rwx);
 
     template<typename T> std::pair<T, u64> read(u64 vaddr, u8 rx);
     template<typename T> T                 readT(u64 vaddr, u8 rx);
@@ -144,6 +154,10 @@ class MemoryManager
     template<typename T> void              write(u64 vaddr, T val);
     void                                   write(u64 vaddr, void* data, size_t len);
 
+    // page table and dirty frames, buffered stores are included
+    void  save(ckpt::Writer& w, u8 compress);
+    void  load(const ckpt::Reader& r);
+
     private:
     std::map<u64, MM::PageTableEntry> pagetable; // unified page table
     std::map<u64, MM::PageFrame>      mem;       // "lazy" memory
@@ -152,6 +166,7 @@ class MemoryManager
     std::deque<MM::StoreRequest>      stbuf;     // all requests in the store buffer *must* be executed
 
     Simulator::SimulatorState&        state;
+    const MemConfig                   cfg;
 }; // MemoryManager
 
 // memory operator overloads
@@ -0,0 +1,152 @@
+// o3 RISC simulator
+//
+// command line client
+// - read arguments
+// - run a single simulation or a sweep
+// - print results
+//
+// Lukas Heine 2021
+
+#include <cstdlib>
+#include <new>
+
+#include "o3.hh"
+#include "sweep.hh"
+#include "simpoint.hh"
+#include "smarts.hh"
+
+#if COUNT_ALLOCS
+// global new is replaced to count heap traffic of the pipeline
+// x64 decode must not allocate in the steady state, the run fails if it does
+static thread_local u64 heap_allocs   = 0;
+static thread_local u64 decode_allocs = 0;
+
+void* operator new(std::size_t size)
+{
+    heap_allocs++;
+    decode_allocs += util::in_decode;
+    if(void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+#endif // COUNT_ALLOCS
+
+// single simulation with summary
+static int simulate(const opts& myopts, const SimConfig& cfg)
+{
+    // log args
+    util::log(LOG_SIM_INIT, "Simulator started with args:" );
+    util::log(LOG_SIM_INIT, "        loglevel:   ", +myopts.loglevel);  
+    util::log(LOG_SIM_INIT, "        frontend:   ", ((myopts.frontend == x64) ? "x64" : "RISC"));
+    util::log(LOG_SIM_INIT, "        predictor:  ", +myopts.bpred);
+    util::log(LOG_SIM_INIT, "        max cycles: ", myopts.cycles);
+    util::log(LOG_SIM_INIT, "Parameters:\n", config::readable(cfg).str());
+
+    Simulator sim(myopts, cfg);
+    if(!myopts.ckpt_load.empty()) sim.load_checkpoint(myopts.ckpt_load);
+    if(myopts.ff_insts || myopts.ff_pc) sim.fast_forward(myopts.ff_insts ? myopts.ff_insts : UINT64_MAX, myopts.ff_pc);
+
+    timespec start, end;
+    if(myopts.time) clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+#if COUNT_ALLOCS
+    const u64 warm         = sim.run(std::min<u64>(myopts.cycles, ALLOC_WARMUP));
+    const u64 allocs_start = heap_allocs, decode_start = decode_allocs;
+    sim.run(myopts.cycles - warm);
+#else
+    sim.run(myopts.cycles);
+#endif // COUNT_ALLOCS
+    if(myopts.time) clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+#if COUNT_ALLOCS
+    const u64 allocs  = heap_allocs - allocs_start;
+    const u64 dallocs = decode_allocs - decode_start;
+#endif // COUNT_ALLOCS
+
+    if(!myopts.ckpt_save.empty()) sim.save_checkpoint(myopts.ckpt_save, myopts.ckpt_compress);
+    if(sim.tracer) sim.tracer->close();
+
+    const SimStats st = sim.stats();
+
+    util::log_always(H2LINE);
+    util::log_always("Simulator exited after ", dec_u<0>, st.cycles, " cycles ", "with rip ", hex_u<64>,
+        sim.rip(), ".");
+
+
+    util::log_always("\n", HLINE, sim.frontend->summary().str(), HLINE, "\n");
+
+
+    // move these to ::summary()?
+    util::log_always("Committed uops: ", dec_u<0>, st.uops, ". IPC: ", 
+        ((f32)st.uops / (f32)st.cycles));
+    util::log_always("Committed mops: ", dec_u<0>, st.mops, ". IPC: ", 
+        ((f32)st.mops / (f32)st.cycles));
+    if(st.ff_mops) util::log_always("Fast-forwarded: ", dec_u<0>, st.ff_mops, " mops, ", st.ff_uops, " uops.");
+    util::log_always("Flushes:        ", dec_u<0>, st.flushes);
+    util::log_always("Mispredicts:    ", dec_u<0>, st.mispredicts, ". Squashed uops: ", st.squashed,
+        ". Avg penalty: ", (st.mispredicts ? ((f32)st.mp_cycles / (f32)st.mispredicts) : 0),
+        " cycles");
+    util::log_always("Eliminated:     ", dec_u<0>, st.moves_eliminated, " moves, ", st.zero_idioms,
+        " zeroing idioms.");
+    util::log_always("Predictor:      ", sim.frontend->bp->name(), ". MPKI: ",
+        (st.mops ? ((f32)st.mispredicts * 1000 / (f32)st.mops) : 0),
+        ". Indirect MPKI: ",
+        (st.mops ? ((f32)st.ind_mispredicts * 1000 / (f32)st.mops) : 0));
+    if(std::string bps = sim.frontend->bp->summary().str(); !bps.empty()) util::log_always(bps);
+    if(sim.frontend->ras) util::log_always(sim.frontend->ras->summary().str());
+    util::log_always(sim.frontend->ftq_summary().str());
+    if(sim.tracer) util::log_always("Trace:          ", dec_u<0>, sim.tracer->records, " records, ",
+        sim.tracer->written, " bytes written, ", sim.tracer->raw, " encoded.");
+
+#if COUNT_ALLOCS
+    util::log_always("Heap allocs:    ", dec_u<0>, allocs, " while simulating. Per mop: ",
+        (st.mops ? ((f32)allocs / (f32)st.mops) : 0), ". In decode: ", dallocs, ".");
+#endif // COUNT_ALLOCS
+
+    if(st.exception) util::log_always("Core exception: ", getExceptNum(st.exception), " ",
+        exception_str[getExceptNum(st.exception)], ", EC ", hex_u<16>, getExceptEC(st.exception), ".");
+
+    if(myopts.time)
+    {
+        timespec res;
+        util::timediff(&res, &start, &end);
+        util::log_always("time ", res.tv_sec, ".", dec_u_lf<6>, res.tv_nsec/1000, "s");
+    }
+
+    // std::cout << "\n";
+    // for(u16 i = 0; i < 512; i++)
+    //     std::cout << hex_u<8> << +sim.stack[i] << (i % 32 == 31 ? "\n" : " ");
+
+    util::log_always(H2LINE);
+
+#if COUNT_ALLOCS
+    // log messages may allocate, runs with logging are not held to it
+    if(dallocs && !myopts.loglevel)
+        util::abort("x64 decode made ", dec_u<0>, dallocs, " heap allocations after ", ALLOC_WARMUP,
+            " cycles, it has to make none.");
+#endif // COUNT_ALLOCS
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+    opts      myopts;
+    SimConfig cfg;
+    try { if(util::parseargs(argc, argv, &myopts, &cfg)) util::abort("Parsing args failed."); }
+    catch(const std::exception& e) { util::abort(e.what()); }
+
+    // the library only throws, errors end the client here
+    util::Logger   log = { myopts.loglevel, &std::cout };
+    util::LogScope scope(log);
+    try
+    {
+        if(!myopts.sweep.empty()) return sweep::run(myopts, cfg);
+        if(myopts.sp_k || !myopts.bbv.empty()) return simpoint::run(myopts, cfg);
+        return myopts.sm_period ? smarts::run(myopts, cfg) : simulate(myopts, cfg);
+    }
+    catch(const ConfigException& e)   { util::abort(e.what()); }
+    catch(const FileException& e)     { util::abort(e.what()); }
+    catch(const SamplingException& e) { util::abort(e.what()); }
+    catch(const std::exception& e)    { util::abort("Simulation failed: ", e.what()); }
+    return EXIT_FAILURE;
+}
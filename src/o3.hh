@@ -0,0 +1,28 @@
+// o3 RISC simulator
+//
+// library interface
+// - Simulator, SimStats (sim.hh)
+// - SimConfig, presets (config.hh)
+// - ArchRegFile (core/core.hh)
+// - BBV profiling, sampled simulation (simpoint.hh)
+// - systematic sampling (smarts.hh)
+// - commit trace writer and reader (trace.hh)
+//
+// Lukas Heine 2021
+
+#ifndef SIM_O3_H
+#define SIM_O3_H
+
+#include "sim.hh"
+#include "config.hh"
+#include "util.hh"
+#include "mem.hh"
+#include "simpoint.hh"
+#include "smarts.hh"
+#include "trace.hh"
+
+#include "frontend/frontend.hh"
+#include "frontend/x64.hh"
+#include "core/core.hh"
+
+#endif // SIM_O3_H
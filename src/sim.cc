@@ -1,32 +1,37 @@
 // o3 RISC simulator
 //
-// main functions and startup
-// - read arguments
-// - prepare memory, simulator
-// - start pipeline
-// - get results
+// simulator
+// - prepare memory, load code or ELF
+// - run pipeline
+// - stats and architectural state
 //
 // Lukas Heine 2021
 
-#ifdef simtest
-#include <gtest/gtest.h>
-#endif // simtest
+#include <cstdlib>
+#include <cstring>
+#include <elf.h>
+#include <fstream>
+#include <iterator>
 
 #include "sim.hh"
 #include "types.hh"
 #include "util.hh"
 
 #include "mem.hh"
+#include "trace.hh"
 #include "frontend/frontend.hh"
 #include "frontend/x64.hh"
 #include "core/core.hh"
 
-u8 loglevel;
-
-Simulator::Simulator(opts& myopts)
+Simulator::Simulator(const opts& myopts, const SimConfig& cfg, std::ostream& log)
+    : logger{ myopts.loglevel, &log }, cfg(cfg), fe_id(myopts.frontend)
 {
-    if(myopts.frontend != x64 && (myopts.code.size() % 16))
-        util::abort("Machine code length is not a multiple of 16 bytes.");
+    util::LogScope scope(logger);
+
+    // latches and tables are sized from cfg below
+    config::validate(cfg);
+    if(!myopts.elf.empty() && myopts.frontend != x64) throw InvalidArgumentException();
+    if(myopts.elf.empty() && myopts.frontend != x64 && (myopts.code.size() % 16)) throw InvalidArgumentException();
 
     state = 
     {   
@@ -37,52 +42,147 @@ Simulator::Simulator(opts& myopts)
         0, 0,                      // refetch ip, enabled
         ex_NONE,                   // exception
         0, 0, 0,                   // events
+        0, 0, 0, 0,                // mispredict events
+        0, 0,                      // eliminated at rename
+        0, 0,                      // fast-forwarded
         nullptr                    // arf
     };
 
-    mmu       = new MemoryManager(state);
-    uqueue    = new LatchQueue<uop>(UQUEUE_SIZE + FETCH_WIDTH);
-    state.arf = new ArchRegFile();
+    mmu       = std::make_unique<MemoryManager>(state, cfg.mem);
+    uqueue    = std::make_unique<LatchQueue<uop>>(cfg.fe.uqueue_size + cfg.fe.fetch_width);
+    arf       = std::make_unique<ArchRegFile>();
+    state.arf = arf.get();
     
     switch(myopts.frontend)
     {
         case x64:
-            frontend = new x64Frontend(*mmu, uqueue, state);
+            if(myopts.replay.empty())
+                frontend = std::make_unique<x64Frontend>(*mmu, uqueue.get(), state, cfg.fe, myopts.bpred,
+                    myopts.ittage, myopts.loop);
             state.arf->gp[to_ureg(reg64_sp)].write<u64>(STACK_START + STACK_SIZE); // init stack pointer
             break;
 
         default:
-            frontend = new RiscFrontend(*mmu, uqueue, state);   
+            if(myopts.replay.empty())
+                frontend = std::make_unique<RiscFrontend>(*mmu, uqueue.get(), state, cfg.fe, myopts.bpred,
+                    myopts.ittage, myopts.loop);
             // todo register convention?
             break;
     }
-    core      = new Core(uqueue, state, *mmu, *frontend);
-
-    state.arf->cc.write<u64>(0);
-    state.arf->ip.write<u64>(MM_USER_START);
-    frontend->set_fetchaddr(MM_USER_START);
+    // the workload is still mapped, replayed uops execute on it
+    if(!myopts.replay.empty())
+        frontend = std::make_unique<TraceFrontend>(*mmu, uqueue.get(), state, cfg.fe, myopts.replay, myopts.frontend,
+            myopts.bpred, myopts.ittage, myopts.loop);
+    core      = std::make_unique<Core>(uqueue.get(), state, *mmu, *frontend, cfg.core);
 
-    {   // map entire code
-        auto frames = mmu->mmap_frames(MM_USER_START, myopts.code.data(), myopts.code.size(), pl_user, (MM::p_r | MM::p_x),
-            ".text");
-    
-        for(auto frame : frames)
-            mmu->map_page(frame.second, frame.second, 1, pl_user, (MM::p_r | MM::p_x));
+    if(!myopts.trace.empty())
+    {
+        tracer       = std::make_unique<trace::Writer>(myopts.trace, myopts.trace_codec, myopts.frontend);
+        core->tracer = tracer.get();
     }
 
-    stack = (u8*) aligned_alloc(PAGE_SIZE, STACK_SIZE);
+    stack.reset((u8*) aligned_alloc(PAGE_SIZE, STACK_SIZE));
+    if(!stack) throw AllocationFailedException();
     for(u16 i = 0; i < STACK_SIZE; i++)
-        stack[i] = (u8)i;
+        stack.get()[i] = (u8)i;
 
     {   // map stack
-        auto frames = mmu->mmap_frames(STACK_START, stack, STACK_SIZE, pl_user, (MM::p_r | MM::p_w), ".data");
+        auto frames = mmu->mmap_frames(STACK_START, stack.get(), STACK_SIZE, pl_user, (MM::p_r | MM::p_w), ".data");
         for(auto frame : frames)
             mmu->map_page(frame.second, frame.second, 1, pl_user, (MM::p_r | MM::p_w));
     }
+
+    u64 entry = MM_USER_START;
+    if(!myopts.elf.empty()) entry = map_elf(myopts.elf);
+    else
+    {   // map entire code
+        image.push_back(myopts.code);
+        map_image(MM_USER_START, (MM::p_r | MM::p_x), ".text");
+    }
+
+    state.in_flight = { entry };
+    state.arf->cc.write<u64>(0);
+    state.arf->ip.write<u64>(entry);
+    frontend->set_fetchaddr(entry);
+}
+
+// tear down in dependency order while the logger is still bound, frames of code and stack are unmapped first
+Simulator::~Simulator()
+{
+    util::LogScope scope(logger);
+
+    core.reset();
+    frontend.reset();
+    mmu.reset();
+}
+
+// map the last image buffer at vaddr (page aligned), vaddr == paddr
+void Simulator::map_image(u64 vaddr, u8 rwx, const string& name)
+{
+    auto frames = mmu->mmap_frames(vaddr, image.back().data(), image.back().size(), pl_user, rwx, name);
+    for(auto frame : frames)
+        mmu->map_page(frame.second, frame.second, 1, pl_user, rwx);
+}
+
+// map the PT_LOAD segments of an x64 executable, returns the entry point
+// PIEs are placed at MM_USER_START without applying relocations, there is no dynamic loader
+u64 Simulator::map_elf(const string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if(!file) throw InvalidElfException();
+    const vector<u8> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    Elf64_Ehdr eh;
+    if(bytes.size() < sizeof(eh)) throw InvalidElfException();
+    std::memcpy(&eh, bytes.data(), sizeof(eh));
+
+    if(std::memcmp(eh.e_ident, ELFMAG, SELFMAG) || (eh.e_ident[EI_CLASS] != ELFCLASS64) ||
+        (eh.e_ident[EI_DATA] != ELFDATA2LSB) || (eh.e_machine != EM_X86_64) ||
+        ((eh.e_type != ET_EXEC) && (eh.e_type != ET_DYN)) || (eh.e_phentsize != sizeof(Elf64_Phdr)) ||
+        (eh.e_phoff + (u64)eh.e_phnum * sizeof(Elf64_Phdr) > bytes.size()))
+        throw InvalidElfException();
+
+    const u64 base = (eh.e_type == ET_DYN) ? MM_USER_START : 0;
+
+    // mapped ranges, segments must not share pages with each other or the stack
+    vector<pair<u64, u64>> used = { { STACK_START, STACK_START + STACK_SIZE } };
+
+    for(u16 i = 0; i < eh.e_phnum; i++)
+    {
+        Elf64_Phdr ph;
+        std::memcpy(&ph, bytes.data() + eh.e_phoff + i * sizeof(ph), sizeof(ph));
+        if((ph.p_type != PT_LOAD) || !ph.p_memsz) continue;
+
+        const u64 vaddr = base + ph.p_vaddr;
+        const u64 start = pageFloor(vaddr);
+        const u64 end   = pageCeil(vaddr + ph.p_memsz - 1);
+        if((ph.p_filesz > ph.p_memsz) || (ph.p_offset + ph.p_filesz > bytes.size()) || (vaddr < MM_USER_START) ||
+            (end > VADDR_LIMIT) || (end <= start))
+            throw InvalidElfException();
+
+        for(auto& r : used)
+            if((start < r.second) && (r.first < end)) throw InvalidElfException();
+        used.push_back({ start, end });
+
+        // file contents, the rest (bss) stays zero
+        image.emplace_back(pageOffs(vaddr) + ph.p_memsz, 0);
+        std::memcpy(image.back().data() + pageOffs(vaddr), bytes.data() + ph.p_offset, ph.p_filesz);
+
+        u8 rwx = ((ph.p_flags & PF_R) ? MM::p_r : 0) | ((ph.p_flags & PF_W) ? MM::p_w : 0) |
+                 ((ph.p_flags & PF_X) ? MM::p_x : 0);
+        map_image(start, rwx, (ph.p_flags & PF_X) ? ".text" : ".data");
+
+        util::log(LOG_MM_MAPPED, "ELF segment v.", hex_u<64>, vaddr, " (", dec_u<0>, ph.p_memsz, " bytes) mapped.");
+    }
+
+    if(image.empty()) throw InvalidElfException();
+    return base + eh.e_entry;
 }
 
 u16 Simulator::cycle()
 {
+    util::LogScope scope(logger);
+
     // util::log(LOG_STATE_PRE, state.state_readable(8).str());
     // util::log(LOG_STATE_PRE, frontend.state_readable(8).str());
     // util::log(LOG_STATE_PRE, core.state_readable(8).str());
@@ -93,7 +193,145 @@ u16 Simulator::cycle()
     // util::log(LOG_STATE_POST, state.state_readable(8).str());
 
     // execute pending stores even when fe or core are inactive
-    return state.active | mmu->active();
+    status = state.active | mmu->active();
+    return status;
+}
+
+// advance one cycle, logger has to be bound
+u16 Simulator::step()
+{
+    state.cycle++;
+    util::log(1, H2LINE, "\nEntering cycle ", dec_u<0>, state.cycle, ".");
+    util::log(1, "RIP ", hex_u<64>, state.arf->ip.read<u64>());
+    return cycle();
+}
+
+// cycle until the pipeline and memory are idle, at most cycles times, returns the simulated cycles
+u64 Simulator::run(u64 cycles)
+{
+    util::LogScope scope(logger);
+
+    u64 start = state.cycle;
+    for(;!done() && (state.cycle - start < cycles);)
+        step();
+    return state.cycle - start;
+}
+
+// switch to functional mode, the pipeline is drained and refetches from the reached rip afterwards
+u64 Simulator::fast_forward(u64 insts, u64 pc, simpoint::Profiler* prof)
+{
+    util::LogScope scope(logger);
+    if(done() || state.exception) return 0;
+
+    u64 n  = core->fast_forward(insts, pc ? pc : UINT64_MAX, prof);
+    status = state.active | mmu->active();
+
+    util::log(LOG_SIM_INIT, "Fast-forwarded ", dec_u<0>, n, " instructions to rip ", hex_u<64>, rip(), ".");
+    return n;
+}
+
+u64 Simulator::rip() const
+{
+    return arf->ip.read<u64>();
+}
+
+const ArchRegFile& Simulator::regs() const
+{
+    return *arf;
+}
+
+// copy simulated memory, returns the bytes read, committed stores still in the store buffer are not visible
+u64 Simulator::read_mem(u64 vaddr, void* data, size_t len)
+{
+    util::LogScope scope(logger);
+    return mmu->read(vaddr, data, len, MM::p_r).second;
+}
+
+void Simulator::save_checkpoint(const string& path, u8 compress)
+{
+    util::LogScope scope(logger);
+
+    ckpt::Writer w;
+    std::ostream& st = w.section(ckpt::sec_state);
+    for(u64 v : { state.cycle, (u64)state.active, (u64)state.ring, state.exception, state.commited_micro,
+            state.commited_macro, state.flushes, state.mispredicts, state.squashed, state.mp_cycles,
+            state.ind_mispredicts, state.moves_eliminated, state.zero_idioms, state.ff_micro, state.ff_macro })
+        ckpt::put(st, v);
+
+    ckpt::put(w.section(ckpt::sec_arf), *arf);
+    mmu->save(w, compress);
+    frontend->bp->save(w.section(ckpt::sec_bp));
+    if(frontend->ras) frontend->ras->save(w.section(ckpt::sec_ras));
+
+    ckpt::Header hdr = {};
+    hdr.frontend = fe_id;
+    strncpy(hdr.bp, frontend->bp->name(), sizeof(hdr.bp) - 1);
+    w.write(path, hdr);
+
+    util::log(LOG_SIM_INIT, "Checkpoint ", path, " saved at cycle ", dec_u<0>, state.cycle, ", rip ", hex_u<64>,
+        rip(), ".");
+}
+
+void Simulator::load_checkpoint(const string& path)
+{
+    util::LogScope scope(logger);
+    if(state.cycle) throw InvalidArgumentException();
+
+    ckpt::Reader r(path);
+    if((r.header().frontend != fe_id) || strncmp(r.header().bp, frontend->bp->name(), sizeof(r.header().bp)))
+        throw CheckpointException();
+
+    std::istringstream st = r.stream(ckpt::sec_state);
+    u64 active, ring;
+    for(u64* v : { &state.cycle, &active, &ring, &state.exception, &state.commited_micro, &state.commited_macro,
+            &state.flushes, &state.mispredicts, &state.squashed, &state.mp_cycles, &state.ind_mispredicts,
+            &state.moves_eliminated, &state.zero_idioms, &state.ff_micro, &state.ff_macro })
+        ckpt::get(st, *v);
+    state.active = active;
+    state.ring   = ring;
+
+    if(r.section(ckpt::sec_arf).size() != sizeof(ArchRegFile)) throw CheckpointException();
+    std::memcpy((void*)arf.get(), r.section(ckpt::sec_arf).data(), sizeof(ArchRegFile));
+
+    mmu->load(r);
+    {
+        std::istringstream bp = r.stream(ckpt::sec_bp);
+        frontend->bp->load(bp);
+    }
+    if(frontend->ras)
+    {
+        std::istringstream ras = r.stream(ckpt::sec_ras);
+        frontend->ras->load(ras);
+    }
+
+    // empty pipeline, fetch resumes at the committed rip
+    state.in_flight = { rip() };
+    state.seq_addrs.clear();
+    frontend->set_fetchaddr(rip());
+    status = state.active | mmu->active();
+
+    util::log(LOG_SIM_INIT, "Checkpoint ", path, " restored at cycle ", dec_u<0>, state.cycle, ", rip ", hex_u<64>,
+        rip(), ".");
+}
+
+SimStats Simulator::stats() const
+{
+    return
+    {
+        state.cycle,
+        state.commited_micro,
+        state.commited_macro,
+        state.flushes,
+        state.mispredicts,
+        state.ind_mispredicts,
+        state.squashed,
+        state.mp_cycles,
+        state.moves_eliminated,
+        state.zero_idioms,
+        state.exception,
+        state.ff_micro,
+        state.ff_macro,
+    };
 }
 
 // set cpuid_regs depending on rax
@@ -157,75 +395,61 @@ std::stringstream RiscFrontend::summary()
     return ss;
 }
 
-// extract mapped x64 registers form the arf
-std::stringstream x64Frontend::summary()
+// architectural state and replay counters
+std::stringstream TraceFrontend::summary()
 {
     std::stringstream ss; ss << "\n";
 
-    for(u8 i = 0; i <= reg64_gsbase; i++)
-        ss << std::setw(4) << std::left << std::setfill(' ') << x64gp_str[i] << " " << hex_u<REGCLS_0_SIZE*8>
-           << state.arf->gp[to_ureg(i)].read<u64>() << (i % 4 == 3 ? "\n" : " ");
+    ss << "ARF GP:\n" << state.arf_readable(0).str();
+    ss << "cc:  " << hex_u<64> << state.arf->cc.read<u64>();
 
-    ss << "rflags " << hex_u<64> << state.arf->cc.read<u64>();
+    ss << "\n\nReplayed mops:    " << dec_u<0> << replayed_mops
+       << "\nReplayed uops:    " << dec_u<0> << replayed_uops
+       << "\nWrong path:       " << dec_u<0> << stall_cycles << " cycles stalled, " << dec_u<0> << penalties
+       << " redirects penalized"
+       << "\nTrace end:        " << (ended ? "reached" : "not reached");
 
     ss << "\n";
     return ss;
 }
 
-
-int main(int argc, char** argv)
+// extract mapped x64 registers form the arf
+std::stringstream x64Frontend::summary()
 {
-    opts myopts;
-    if(util::parseargs(argc, argv, &myopts)) util::abort("Parsing args failed.");
+    std::stringstream ss; ss << "\n";
 
-    // log args
-    util::log(LOG_SIM_INIT, "Simulator started with args:" );
-    util::log(LOG_SIM_INIT, "        loglevel:   ", +loglevel);  
-    util::log(LOG_SIM_INIT, "        frontend:   ", ((myopts.frontend == x64) ? "x64" : "RISC"));
-    util::log(LOG_SIM_INIT, "        max cycles: ", MAX_CYCLES, "\n");
+    for(u8 i = 0; i <= reg64_gsbase; i++)
+        ss << std::setw(4) << std::left << std::setfill(' ') << x64gp_str[i] << " " << hex_u<REGCLS_0_SIZE*8>
+           << state.arf->gp[to_ureg(i)].read<u64>() << (i % 4 == 3 ? "\n" : " ");
 
-    Simulator sim = Simulator(myopts);
+    ss << "rflags " << hex_u<64> << state.arf->cc.read<u64>();
 
-    timespec start, end;
-    if(myopts.time) clock_gettime(CLOCK_MONOTONIC_RAW, &start);
-    for(;sim.state.cycle < MAX_CYCLES;)
+    ss << "\n\nFetch cycles:     " << dec_u<0> << fetch_cycles
+       << "\nDecoded mops:     " << dec_u<0> << decoded_mops
+       << "\nDecoded uops:     " << dec_u<0> << decoded_uops << " (fused domain "
+       << dec_u<0> << (decoded_uops - macro_fused - micro_fused) << ")"
+       << "\nMacro fused:      " << dec_u<0> << macro_fused
+       << "\nMicro fused:      " << dec_u<0> << micro_fused
+       << "\nMSROM ops:        " << dec_u<0> << msrom_ops
+       << "\nLSD locks:        " << dec_u<0> << lsd_locks
+       << "\nLSD uops:         " << dec_u<0> << lsd_uops;
+
+    u64 groups = 0, slots = 0;
+    for(u8 i = 0; i < decode_groups.size(); i++)
     {
-        sim.state.cycle++;
-        util::log(1, H2LINE, "\nEntering cycle ", dec_u<0>, sim.state.cycle, ".");
-        util::log(1, "RIP ", hex_u<64>, sim.state.arf->ip.read<u64>());
-        if(!sim.cycle()) break;
+        groups += decode_groups[i];
+        slots  += i * decode_groups[i];
     }
-    if(myopts.time) clock_gettime(CLOCK_MONOTONIC_RAW, &end);
-
-    util::log_always(H2LINE);
-    util::log_always("Simulator exited after ", dec_u<0>, sim.state.cycle, " cycles ", "with rip ", hex_u<64>,
-        sim.state.arf->ip.read<u64>(), ".");
-
-
-    util::log_always("\n", HLINE, sim.frontend->summary().str(), HLINE, "\n");
-
 
-    // move these to ::summary()?
-    util::log_always("Committed uops: ", dec_u<0>, sim.state.commited_micro, ". IPC: ", 
-        ((f32)sim.state.commited_micro / (f32)sim.state.cycle));
-    util::log_always("Committed mops: ", dec_u<0>, sim.state.commited_macro, ". IPC: ", 
-        ((f32)sim.state.commited_macro / (f32)sim.state.cycle));
-    util::log_always("Flushes:        ", dec_u<0>, sim.state.flushes);
+    ss << "\nDecode slots:     " << dec_u<0> << slots << " / " << dec_u<0> << groups * ds.width << " ("
+       << (groups ? (f32)slots * 100 / (f32)(groups * ds.width) : 0) << "%)\nDecode groups:   ";
+    for(u8 i = 0; i < decode_groups.size(); i++)
+        ss << " " << dec_u<0> << +i << ": " << dec_u<0> << decode_groups[i];
 
-    if(sim.state.exception) util::log_always("Core exception: ", getExceptNum(sim.state.exception), " ",
-        exception_str[getExceptNum(sim.state.exception)], ", EC ", hex_u<16>, getExceptEC(sim.state.exception), ".");
+    ss << "\nDecode stalls:   ";
+    for(u8 i = dst_empty; i < dst_max; i++)
+        ss << " " << decode_stall_str[i] << ": " << dec_u<0> << decode_stalls[i];
 
-    if(myopts.time)
-    {
-        timespec res;
-        util::timediff(&res, &start, &end);
-        util::log_always("time ", res.tv_sec, ".", dec_u_lf<6>, res.tv_nsec/1000, "s");
-    }
-
-    // std::cout << "\n";
-    // for(u16 i = 0; i < 512; i++)
-    //     std::cout << hex_u<8> << +sim.stack[i] << (i % 32 == 31 ? "\n" : " ");
-
-    util::log_always(H2LINE);
-    return EXIT_SUCCESS;
+    ss << "\n";
+    return ss;
 }
@@ -8,10 +8,13 @@
 #define SIM_MAIN_H
 
 #include <deque>
+#include <memory>
+#include <utility>
 
 #include "util.hh"
 #include "types.hh"
 #include "conf.hh"
+#include "config.hh"
 
 // #include "core/cconf.hh"
 
@@ -19,8 +22,8 @@ class MemoryManager;
 class Frontend;
 class Core;
 class ArchRegFile;
-
-u8 map_elf();
+namespace simpoint { struct Profiler; }
+namespace trace { class Writer; }
 
 typedef enum
 {
@@ -83,11 +86,59 @@ namespace cpuid
     void cpuid(cpuid_regs& cr, u64 rax);
 }; // cpuid
 
+// counters of a simulation, see SimulatorState
+struct SimStats
+{
+    u64 cycles;
+    u64 uops;                     // committed
+    u64 mops;                     // committed
+    u64 flushes;
+    u64 mispredicts;
+    u64 ind_mispredicts;
+    u64 squashed;
+    u64 mp_cycles;
+    u64 moves_eliminated;
+    u64 zero_idioms;
+    u64 exception;                // exception status, 0 if none
+    u64 ff_uops;                  // executed in functional mode, not part of uops/mops
+    u64 ff_mops;
+}; // SimStats
+
+// memory from aligned_alloc
+struct FreeDeleter
+{
+    void operator()(void* p) const { std::free(p); }
+}; // FreeDeleter
+
+// owns all of its components, instances are independent and can run on different threads
 class Simulator
 {
     public:
-    Simulator(opts& myopts);
+    Simulator(const opts& myopts, const SimConfig& cfg, std::ostream& log = std::cout);
+    ~Simulator();
+    Simulator(const Simulator&) = delete;             // components keep references to state
+    Simulator& operator=(const Simulator&) = delete;
+
     u16 cycle();
+    // cycle until idle, at most cycles times, returns the simulated cycles
+    u64 run(u64 cycles);
+    // same as run, but stop after the first cycle for which stop(*this) is true
+    template<class F> u64 run_until(F stop, u64 cycles = MAX_CYCLES);
+    // execute functionally without timing until insts instructions retired or rip == pc (0: none)
+    // the predictors are trained on the way, prof collects BBVs if set, returns the executed instructions
+    u64 fast_forward(u64 insts, u64 pc = 0, simpoint::Profiler* prof = nullptr);
+    // pipeline and memory are idle
+    bool done() const { return !status; };
+
+    SimStats           stats() const;
+    u64                rip() const;
+    const ArchRegFile& regs() const;
+    u64                read_mem(u64 vaddr, void* data, size_t len);
+
+    // architectural state, memory, predictor tables and counters
+    // restore expects a fresh simulator of the same workload, frontend and predictor
+    void save_checkpoint(const string& path, u8 compress = 0);
+    void load_checkpoint(const string& path);
 
     // cpuid::cpuid_regs cpuid;
 
@@ -106,6 +157,14 @@ class Simulator
         u64 commited_micro;
         u64 commited_macro;
         u64 flushes;
+        u64 mispredicts;              // mispredicted branches
+        u64 squashed;                 // uops removed from the ROB by mispredict recovery
+        u64 mp_cycles;                // cycles from alloc to resolution of mispredicted branches
+        u64 ind_mispredicts;          // mispredicted indirect branches
+        u64 moves_eliminated;         // moves renamed to their source registers
+        u64 zero_idioms;              // zeroing idioms executed at rename
+        u64 ff_micro;                 // executed in functional mode
+        u64 ff_macro;
 
         // std::map<u16, u64> used_uops;
 
@@ -118,12 +177,25 @@ class Simulator
         std::stringstream       state_readable(u8 max);
     } state; // SimulatorState
 
-    LatchQueue<uop>*    uqueue;
-    MemoryManager*      mmu;
-    Frontend*           frontend;
-    Core*               core;
-
-    u8*                 stack;
+    util::Logger                        logger;   // bound to the calling thread inside the simulator
+    const SimConfig                     cfg;
+    std::unique_ptr<u8, FreeDeleter>    stack;    // mapped as .data
+
+    std::unique_ptr<MemoryManager>      mmu;
+    std::unique_ptr<LatchQueue<uop>>    uqueue;
+    std::unique_ptr<ArchRegFile>        arf;      // state.arf
+    std::unique_ptr<Frontend>           frontend;
+    std::unique_ptr<Core>               core;
+    std::unique_ptr<trace::Writer>      tracer;   // opts.trace, closed on destruction if not before
+
+    private:
+    u16  step();
+    void map_image(u64 vaddr, u8 rwx, const string& name);
+    u64  map_elf(const string& path);
+
+    vector<vector<u8>>                  image;    // mapped code or ELF segments
+    const u8                            fe_id;    // frontends
+    u16                                 status = fe_active | core_active; // last cycle() result
 }; // Simulator
 
 struct NotImplementedException : public SimulatorException
@@ -138,7 +210,27 @@ struct InvalidArgumentException : public SimulatorException
     {   return "invalid function argument(s)."; }
 }; // InvalidArgumentException
 
+// files that can't be read or written
+struct FileException : public MessageException
+{
+    using MessageException::MessageException;
+}; // FileException
+
+// sampled runs without enough instructions for a result
+struct SamplingException : public MessageException
+{
+    using MessageException::MessageException;
+}; // SamplingException
+
+struct InvalidElfException : public SimulatorException
+{
+    const char* what () const throw ()
+    {   return "invalid or unsupported ELF file."; }
+}; // InvalidElfException
+
 template<u8 N>
 std::ostream operator<<(std::ostream& os, const ArchRegFile& arf);
 
+#include "sim.tt"
+
 #endif
\ No newline at end of file
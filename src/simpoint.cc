@@ -0,0 +1,295 @@
+// o3 RISC simulator
+//
+// sampled simulation
+// - BBV output
+// - random projection and k-means
+// - checkpointed detailed runs
+// - weighted results
+//
+// Lukas Heine 2021
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <thread>
+
+#include "simpoint.hh"
+#include "sim.hh"
+#include "util.hh"
+
+namespace simpoint
+{
+
+typedef std::array<f64, SP_DIMS> Vec;
+
+void write_bbv(std::ostream& os, const vector<BBV>& bbvs)
+{
+    std::unordered_map<u64, u64> ids;
+    for(const BBV& bbv : bbvs)
+    {
+        // sorted by id so equal intervals print equal lines
+        vector<pair<u64, u64>> line;
+        for(auto& [rip, count] : bbv)
+        {
+            auto id = ids.try_emplace(rip, ids.size() + 1).first->second;
+            line.push_back({ id, count });
+        }
+        std::sort(line.begin(), line.end());
+
+        os << "T";
+        for(auto& [id, count] : line) os << ":" << id << ":" << count << " ";
+        os << "\n";
+    }
+}
+
+// splitmix64
+static u64 mix(u64 x)
+{
+    x += 0x9e3779b97f4a7c15;
+    x  = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x  = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+static f64 dist(const Vec& a, const Vec& b)
+{
+    f64 d = 0;
+    for(u32 i = 0; i < SP_DIMS; i++) d += (a[i] - b[i]) * (a[i] - b[i]);
+    return d;
+}
+
+// normalized BBV times a random matrix, the column of a block only depends on its rip
+static Vec project(const BBV& bbv, u64 seed)
+{
+    Vec v = { 0 };
+    u64 total = 0;
+    for(auto& [rip, count] : bbv) total += count;
+
+    for(auto& [rip, count] : bbv)
+        for(u32 i = 0; i < SP_DIMS; i++)
+        {
+            f64 r = (f64)(mix(rip ^ mix(seed + i)) >> 11) / (f64)(1ull << 53); // [0, 1)
+            v[i] += (2 * r - 1) * count / total;
+        }
+    return v;
+}
+
+// one k-means run with k-means++ seeding, returns the cluster of every point and the squared error
+static f64 kmeans(const vector<Vec>& x, u32 k, u64 seed, vector<u32>& assign)
+{
+    std::mt19937_64 rng(seed);
+    vector<Vec>     c;
+    vector<f64>     d(x.size(), std::numeric_limits<f64>::max());
+
+    c.push_back(x[rng() % x.size()]);
+    for(; c.size() < k;)
+    {
+        for(u64 i = 0; i < x.size(); i++) d[i] = std::min(d[i], dist(x[i], c.back()));
+        std::discrete_distribution<u64> pick(d.begin(), d.end());
+        c.push_back(x[pick(rng)]);
+    }
+
+    assign.assign(x.size(), 0);
+    f64 sse = 0;
+    for(u32 iter = 0; iter < SP_ITERS; iter++)
+    {
+        u8 changed = 0;
+        sse = 0;
+        for(u64 i = 0; i < x.size(); i++)
+        {
+            u32 best = 0;
+            for(u32 j = 1; j < k; j++)
+                if(dist(x[i], c[j]) < dist(x[i], c[best])) best = j;
+            changed  |= (best != assign[i]);
+            assign[i] = best;
+            sse      += dist(x[i], c[best]);
+        }
+        if(iter && !changed) break;
+
+        // empty clusters keep their centroid
+        vector<Vec> sum(k, Vec{ 0 });
+        vector<u64> size(k, 0);
+        for(u64 i = 0; i < x.size(); i++)
+        {
+            for(u32 j = 0; j < SP_DIMS; j++) sum[assign[i]][j] += x[i][j];
+            size[assign[i]]++;
+        }
+        for(u32 j = 0; j < k; j++)
+            if(size[j])
+                for(u32 l = 0; l < SP_DIMS; l++) c[j][l] = sum[j][l] / size[j];
+    }
+
+    return sse;
+}
+
+vector<Point> cluster(const vector<BBV>& bbvs, u32 k, u64 seed)
+{
+    if(bbvs.empty()) return {};
+    k = std::clamp<u64>(k, 1, bbvs.size());
+
+    vector<Vec> x;
+    for(const BBV& bbv : bbvs) x.push_back(project(bbv, seed));
+
+    vector<u32> assign, best;
+    f64         best_sse = std::numeric_limits<f64>::max();
+    for(u32 r = 0; r < SP_RUNS; r++)
+    {
+        f64 sse = kmeans(x, k, mix(seed + r), assign);
+        if(sse < best_sse)
+        {
+            best_sse = sse;
+            best     = assign;
+        }
+    }
+
+    // the interval closest to the centroid represents its cluster
+    vector<Point> points;
+    for(u32 j = 0; j < k; j++)
+    {
+        Vec c    = { 0 };
+        u64 size = 0;
+        for(u64 i = 0; i < x.size(); i++)
+            if(best[i] == j)
+            {
+                for(u32 l = 0; l < SP_DIMS; l++) c[l] += x[i][l];
+                size++;
+            }
+        if(!size) continue;
+        for(u32 l = 0; l < SP_DIMS; l++) c[l] /= size;
+
+        u64 rep = UINT64_MAX;
+        for(u64 i = 0; i < x.size(); i++)
+            if(best[i] == j && (rep == UINT64_MAX || dist(x[i], c) < dist(x[rep], c))) rep = i;
+        points.push_back({ rep, (f64)size / x.size() });
+    }
+
+    std::sort(points.begin(), points.end(), [](const Point& a, const Point& b) { return a.interval < b.interval; });
+    return points;
+}
+
+// detailed run of one interval from its checkpoint
+static Result run_point(const opts& base, const SimConfig& cfg, const Point& p, const string& path)
+{
+    Result       r = { p, {}, "" };
+    std::ostream sink(nullptr);
+
+    try
+    {
+        Simulator sim(base, cfg, sink);
+        sim.load_checkpoint(path);
+
+        const SimStats start = sim.stats();
+        sim.run_until([&](const Simulator& s) { return s.stats().mops - start.mops >= base.sp_interval; },
+            base.cycles);
+
+        r.stats              = sim.stats();
+        r.stats.cycles      -= start.cycles;
+        r.stats.uops        -= start.uops;
+        r.stats.mops        -= start.mops;
+        r.stats.mispredicts -= start.mispredicts;
+        r.stats.flushes     -= start.flushes;
+    }
+    catch(const std::exception& e) { r.error = e.what(); }
+
+    return r;
+}
+
+static string ckpt_path(const string& prefix, const Point& p)
+{
+    return prefix + "." + std::to_string(p.interval) + ".ck";
+}
+
+int run(const opts& base, const SimConfig& cfg)
+{
+    if(!base.trace.empty()) throw ConfigException("Traces can't be written for simulation points.");
+
+    std::ostream sink(nullptr);
+    Profiler     prof(base.sp_interval);
+
+    // profile in functional mode
+    {
+        Simulator sim(base, cfg, sink);
+        if(!base.ckpt_load.empty()) sim.load_checkpoint(base.ckpt_load);
+        sim.fast_forward(UINT64_MAX, 0, &prof);
+    }
+    util::log(LOG_SIM_INIT, "Profiled ", dec_u<0>, prof.bbvs.size(), " intervals of ", base.sp_interval,
+        " instructions.");
+    if(prof.bbvs.empty())
+        throw SamplingException("Workload retires less than one interval of ", base.sp_interval, " instructions.");
+
+    if(!base.bbv.empty())
+    {
+        std::ofstream file(base.bbv);
+        if(!file) throw FileException("BBV file ", base.bbv, " could not be opened.");
+        write_bbv(file, prof.bbvs);
+    }
+    if(!base.sp_k) return EXIT_SUCCESS; // profile only
+
+    const vector<Point> points = cluster(prof.bbvs, base.sp_k);
+
+    // checkpoint the start of every point, points are in program order
+    const string prefix = base.ckpt_save.empty() ? "simpoint" : base.ckpt_save;
+    {
+        Simulator sim(base, cfg, sink);
+        if(!base.ckpt_load.empty()) sim.load_checkpoint(base.ckpt_load);
+
+        u64 at = 0;
+        for(const Point& p : points)
+        {
+            at += sim.fast_forward(p.interval * base.sp_interval - at);
+            sim.save_checkpoint(ckpt_path(prefix, p), base.ckpt_compress);
+        }
+    }
+
+    u32 threads = base.jobs ? base.jobs : std::thread::hardware_concurrency();
+    threads = std::clamp<u64>(threads, 1, points.size());
+
+    util::log(LOG_SIM_INIT, dec_u<0>, points.size(), " simulation points on ", threads, " threads.");
+
+    vector<Result>   res(points.size());
+    std::atomic<u64> next = 0;
+    auto worker = [&]()
+    {
+        for(u64 i; (i = next++) < points.size();)
+            res[i] = run_point(base, cfg, points[i], ckpt_path(prefix, points[i]));
+    };
+
+    vector<std::thread> pool;
+    for(u32 i = 0; i < threads; i++) pool.emplace_back(worker);
+    for(std::thread& t : pool) t.join();
+
+    std::ofstream file;
+    if(!base.out.empty())
+    {
+        file.open(base.out);
+        if(!file) throw FileException("Simulation point output ", base.out, " could not be opened.");
+        file << "interval,weight,cycles,uops,mops,ipc,mispredicts,error\n";
+    }
+
+    // CPI is averaged, intervals have the same number of instructions
+    f64 cpi = 0, weight = 0;
+    for(const Result& r : res)
+    {
+        f64 ipc = r.stats.cycles ? (f64)r.stats.mops / r.stats.cycles : 0;
+        util::log_always("Interval ", dec_u<0>, r.point.interval, ": weight ", r.point.weight, ", ",
+            r.stats.cycles, " cycles, IPC ", ipc, (r.error.empty() ? "" : ", failed: "), r.error);
+        if(file.is_open())
+            file << r.point.interval << "," << r.point.weight << "," << r.stats.cycles << "," << r.stats.uops << ","
+                 << r.stats.mops << "," << ipc << "," << r.stats.mispredicts << ",\"" << r.error << "\"\n";
+
+        if(!r.error.empty() || !r.stats.mops) continue;
+        cpi    += r.point.weight * r.stats.cycles / r.stats.mops;
+        weight += r.point.weight;
+    }
+
+    if(!weight) throw SamplingException("No simulation point completed.");
+    util::log_always("Weighted IPC: ", (weight / cpi), " from ", dec_u<0>, res.size(), " of ",
+        prof.bbvs.size(), " intervals (", (weight * 100), "% of the workload).");
+
+    return (weight < 1.0 - 1e-9) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+} // simpoint
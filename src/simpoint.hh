@@ -0,0 +1,80 @@
+// o3 RISC simulator
+//
+// sampled simulation
+// - basic block vectors
+// - k-means clustering
+// - simulation points
+//
+// Lukas Heine 2021
+
+#ifndef SIM_SIMPOINT_H
+#define SIM_SIMPOINT_H
+
+#include <unordered_map>
+
+#include "types.hh"
+#include "config.hh"
+#include "sim.hh"
+
+namespace simpoint
+{
+    // executed instructions per basic block, blocks are keyed by the rip of the branch ending them
+    typedef std::unordered_map<u64, u64> BBV;
+
+    // collects a BBV for every interval instructions retired in functional mode
+    struct Profiler
+    {
+        u64         interval;
+        u64         block = 0;  // instructions since the last branch
+        u64         count = 0;  // instructions in the current interval
+        BBV         cur;
+        vector<BBV> bbvs;       // complete intervals, a trailing partial one is dropped
+
+        Profiler(u64 interval) : interval(interval) {};
+
+        void retire(u64 rip, u8 branch)
+        {
+            block++;
+            count++;
+
+            // blocks end at their branch, interval boundaries split them
+            if(branch || (count == interval))
+            {
+                cur[rip] += block;
+                block     = 0;
+            }
+            if(count == interval)
+            {
+                bbvs.push_back(std::move(cur));
+                cur   = BBV();
+                count = 0;
+            }
+        };
+    }; // Profiler
+
+    // representative interval of a cluster
+    struct Point
+    {
+        u64 interval;   // index, starts at interval * length instructions
+        f64 weight;     // share of all intervals in its cluster
+    }; // Point
+
+    struct Result
+    {
+        Point       point;
+        SimStats    stats;      // detailed run of the interval
+        string      error;      // simulator exception, empty on success
+    }; // Result
+
+    // SimPoint .bb format, "T:id:count :id:count .." per interval, ids in order of appearance
+    void          write_bbv(std::ostream& os, const vector<BBV>& bbvs);
+    // k-means on randomly projected, normalized BBVs, deterministic for a given seed
+    vector<Point> cluster(const vector<BBV>& bbvs, u32 k, u64 seed = 0);
+
+    // profile base.sp_interval sized intervals, cluster them into base.sp_k points,
+    // checkpoint the start of every point and simulate them in detail on base.jobs threads
+    // only the BBVs are written if base.sp_k is 0
+    int           run(const opts& base, const SimConfig& cfg);
+} // simpoint
+
+#endif // SIM_SIMPOINT_H
@@ -0,0 +1,102 @@
+// o3 RISC simulator
+//
+// systematic sampling
+// - sampling loop
+// - CPI estimate
+// - per window output
+//
+// Lukas Heine 2021
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include "smarts.hh"
+#include "util.hh"
+#include "core/uops.hh"
+
+namespace smarts
+{
+
+Estimate estimate(const vector<Sample>& samples, f64 z, f64 target)
+{
+    Estimate e = {};
+    e.n = samples.size();
+    if(!e.n) return e;
+
+    for(const Sample& s : samples) e.cpi += (f64)s.cycles / s.mops;
+    e.cpi /= e.n;
+
+    f64 var = 0;
+    for(const Sample& s : samples) var += std::pow((f64)s.cycles / s.mops - e.cpi, 2);
+    e.stddev = (e.n > 1) ? std::sqrt(var / (e.n - 1)) : 0;
+
+    e.cv     = e.cpi ? e.stddev / e.cpi : 0;
+    e.half   = z * e.stddev / std::sqrt(e.n);
+    e.error  = z * e.cv / std::sqrt(e.n);
+    e.needed = std::ceil(std::pow(z * e.cv / target, 2));
+    return e;
+}
+
+int run(const opts& base, const SimConfig& cfg)
+{
+    std::ostream sink(nullptr);
+    Simulator    sim(base, cfg, sink);
+
+    if(!base.ckpt_load.empty()) sim.load_checkpoint(base.ckpt_load);
+    if(base.ff_insts || base.ff_pc) sim.fast_forward(base.ff_insts ? base.ff_insts : UINT64_MAX, base.ff_pc);
+
+    // switching to functional mode drops the uncommitted part of the pipeline, switching back refills it
+    const u64      skip = base.sm_period - base.sm_warm - base.sm_unit;
+    vector<Sample> samples;
+    for(; !sim.done();)
+    {
+        if(skip) sim.fast_forward(skip);
+
+        const u64 warm = sim.stats().mops + base.sm_warm;
+        sim.run_until([&](const Simulator& s) { return s.stats().mops >= warm; }, base.cycles);
+
+        const SimStats start = sim.stats();
+        sim.run_until([&](const Simulator& s) { return s.stats().mops - start.mops >= base.sm_unit; }, base.cycles);
+        const SimStats end = sim.stats();
+
+        // the workload ended or the cycle limit was hit inside the window
+        if(end.mops - start.mops < base.sm_unit) break;
+        samples.push_back({ start.ff_mops + start.mops, end.cycles - start.cycles, end.mops - start.mops });
+    }
+
+    const SimStats st    = sim.stats();
+    const u64      total = st.ff_mops + st.mops;
+    if(st.exception) util::log_always("Core exception: ", getExceptNum(st.exception), " ",
+        exception_str[getExceptNum(st.exception)], ".");
+    if(samples.size() < 2)
+        throw SamplingException("Workload retires less than two sampling periods of ", base.sm_period,
+            " instructions.");
+
+    if(!base.out.empty())
+    {
+        std::ofstream file(base.out);
+        if(!file) throw FileException("Sample output ", base.out, " could not be opened.");
+        file << "start,cycles,mops,cpi\n";
+        for(const Sample& s : samples)
+            file << s.start << "," << s.cycles << "," << s.mops << "," << (f64)s.cycles / s.mops << "\n";
+    }
+
+    const Estimate e = estimate(samples, SM_Z, base.sm_error);
+    util::log_always("Sampled ", dec_u<0>, e.n, " windows of ", base.sm_unit, " instructions every ",
+        base.sm_period, ", ", st.mops, " of ", total, " instructions detailed.");
+    util::log_always("CPI: ", e.cpi, " +- ", e.half, " (", (e.error * 100), "% at ", SM_Z, " sigma), IPC ",
+        (1 / e.cpi), ", CV ", e.cv, ".");
+
+    // same variation with more windows over the same workload
+    if(e.error > base.sm_error)
+    {
+        u64 period = std::max(total / std::max<u64>(e.needed, 1), base.sm_warm + base.sm_unit);
+        util::log_always("Target error of ", (base.sm_error * 100), "% not met, ", dec_u<0>, e.needed,
+            " windows needed: --smarts ", period, ".");
+    }
+
+    return EXIT_SUCCESS;
+}
+
+} // smarts
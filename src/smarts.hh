@@ -0,0 +1,46 @@
+// o3 RISC simulator
+//
+// systematic sampling
+// - functional and detailed warming
+// - measurement windows
+// - confidence intervals
+//
+// Lukas Heine 2021
+
+#ifndef SIM_SMARTS_H
+#define SIM_SMARTS_H
+
+#include "types.hh"
+#include "config.hh"
+#include "sim.hh"
+
+namespace smarts
+{
+    // one detailed measurement window
+    struct Sample
+    {
+        u64 start;      // retired instructions before the window, functional and detailed
+        u64 cycles;
+        u64 mops;       // at least the unit size, commit may overshoot it
+    }; // Sample
+
+    // mean CPI of all windows and its confidence interval
+    struct Estimate
+    {
+        u64 n;
+        f64 cpi;
+        f64 stddev;     // of the per window CPI
+        f64 cv;         // coefficient of variation
+        f64 half;       // half width of the confidence interval
+        f64 error;      // half / cpi
+        u64 needed;     // windows for the target error with the same variation
+    }; // Estimate
+
+    // z: standard deviations of the confidence interval, target: relative error
+    Estimate estimate(const vector<Sample>& samples, f64 z, f64 target);
+
+    // every base.sm_period instructions: fast-forward, warm base.sm_warm and measure base.sm_unit instructions
+    int      run(const opts& base, const SimConfig& cfg);
+} // smarts
+
+#endif // SIM_SMARTS_H
@@ -0,0 +1,264 @@
+// o3 RISC simulator
+//
+// parameter sweeps
+// - grid file parser
+// - job expansion
+// - thread pool
+// - csv/json output
+//
+// Lukas Heine 2021
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <thread>
+
+#include "sweep.hh"
+#include "sim.hh"
+#include "util.hh"
+#include "frontend/bp.hh"
+
+namespace sweep
+{
+
+Grid load(const string& path)
+{
+    std::ifstream file(path);
+    if(!file) throw FileException("Sweep file ", path, " could not be opened.");
+
+    Grid grid;
+    u32  ln = 0;
+    for(string line; std::getline(file, line);)
+    {
+        ln++;
+        line = line.substr(0, line.find('#'));
+
+        size_t eq = line.find('=');
+        if(line.find_first_not_of(" \t\r") == string::npos) continue;
+        if(eq == string::npos) throw ConfigException(path, ":", ln, ": expected \"key = values\".");
+
+        std::stringstream ks(line.substr(0, eq)), vs(line.substr(eq + 1));
+        string key;
+        ks >> key;
+
+        vector<string> values;
+        for(string v; vs >> v;) values.push_back(v);
+        if(key.empty() || values.empty()) throw ConfigException(path, ":", ln, ": expected \"key = values\".");
+
+        if(key == "workload")
+        {
+            for(const string& w : values)
+            {
+                grid.workloads.push_back(w);
+                grid.code.push_back(util::load_code(w));
+            }
+            continue;
+        }
+
+        for(const Axis& a : grid.axes)
+            if(a.key == key) throw ConfigException(path, ":", ln, ": ", key, " is already set.");
+        grid.axes.push_back({ key, values });
+    }
+
+    if(grid.workloads.empty()) throw ConfigException("Sweep file ", path, " lists no workloads.");
+
+    // presets replace all core parameters, apply them before single overrides
+    std::stable_partition(grid.axes.begin(), grid.axes.end(), [](const Axis& a) { return a.key == "preset"; });
+    return grid;
+}
+
+vector<Job> expand(const Grid& grid, const opts& base, const SimConfig& cfg)
+{
+    vector<Job> jobs;
+    vector<u32> point(grid.axes.size(), 0);
+
+    for(u32 w = 0; w < grid.workloads.size(); w++)
+    {
+        if(base.frontend != x64 && (grid.code[w].size() % 16))
+            throw ConfigException("Machine code length of ", grid.workloads[w], " is not a multiple of 16 bytes.");
+
+        // odometer over all axes
+        std::fill(point.begin(), point.end(), 0);
+        for(u8 done = 0; !done;)
+        {
+            Job job = { w, point, base, cfg };
+            job.myopts.code      = grid.code[w];
+            job.myopts.sweep     = "";
+            job.myopts.loglevel  = 0;
+            job.myopts.ckpt_save = "";
+            job.myopts.sp_k      = 0;
+            job.myopts.bbv       = "";
+            job.myopts.sm_period = 0;
+            job.myopts.trace     = "";
+
+            for(u32 i = 0; i < grid.axes.size(); i++)
+            {
+                const string& key = grid.axes[i].key;
+                const string& val = grid.axes[i].values[point[i]];
+
+                if(key == "preset")
+                {
+                    job.cfg.core = config::preset(val).core;
+                    continue;
+                }
+                if(key == "bpred")
+                {
+                    job.myopts.bpred = predictor_id(val);
+                    if(job.myopts.bpred == UINT8_MAX) throw ConfigException("Unknown branch predictor ", val, ".");
+                    continue;
+                }
+                if(config::set(job.cfg, key, val))
+                    throw ConfigException("Invalid sweep parameter \"", key, "=", val, "\".");
+            }
+
+            // invalid points abort here, before any worker is started
+            config::validate(job.cfg);
+            jobs.push_back(std::move(job));
+
+            done = 1;
+            for(u32 i = 0; i < point.size() && done; i++)
+            {
+                if(++point[i] < grid.axes[i].values.size()) done = 0;
+                else point[i] = 0;
+            }
+        }
+    }
+
+    return jobs;
+}
+
+Result run_job(const Job& job)
+{
+    Result       r = {};
+    std::ostream sink(nullptr); // simulator output is discarded
+    timespec     start, end;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    try
+    {
+        Simulator sim(job.myopts, job.cfg, sink);
+        if(!job.myopts.ckpt_load.empty()) sim.load_checkpoint(job.myopts.ckpt_load);
+        if(job.myopts.ff_insts || job.myopts.ff_pc)
+            sim.fast_forward(job.myopts.ff_insts ? job.myopts.ff_insts : UINT64_MAX, job.myopts.ff_pc);
+        sim.run(job.myopts.cycles);
+        r.stats = sim.stats();
+    }
+    catch(const std::exception& e) { r.error = e.what(); }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+
+    r.seconds = (end.tv_sec - start.tv_sec) + (f64)(end.tv_nsec - start.tv_nsec) / 1e9;
+    return r;
+}
+
+// quote csv fields containing separators
+static string csv_field(const string& s)
+{
+    if(s.find_first_of(",\"\n") == string::npos) return s;
+
+    string q = "\"";
+    for(char c : s) q += (c == '"') ? string("\"\"") : string(1, c);
+    return q + "\"";
+}
+
+static string json_str(const string& s)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    string q = "\"";
+    for(char c : s)
+        switch(c)
+        {
+            case '"':  q += "\\\""; break;
+            case '\\': q += "\\\\"; break;
+            case '\n': q += "\\n";  break;
+            case '\r': q += "\\r";  break;
+            case '\t': q += "\\t";  break;
+            default:
+                if((u8)c < 0x20) q += string("\\u00") + hex[(u8)c >> 4] + hex[c & 0xf];
+                else             q += c;
+        }
+    return q + "\"";
+}
+
+static void write_csv(std::ostream& os, const Grid& grid, const vector<Job>& jobs, const vector<Result>& res)
+{
+    os << "workload";
+    for(const Axis& a : grid.axes) os << "," << a.key;
+    os << ",cycles,uops,mops,ipc,mispredicts,mpki,flushes,squashed,moves_eliminated,zero_idioms,exception,seconds,error\n";
+
+    for(u64 i = 0; i < jobs.size(); i++)
+    {
+        const SimStats& r = res[i].stats;
+        os << csv_field(grid.workloads[jobs[i].workload]);
+        for(u32 a = 0; a < grid.axes.size(); a++) os << "," << csv_field(grid.axes[a].values[jobs[i].point[a]]);
+        os << "," << r.cycles << "," << r.uops << "," << r.mops
+           << "," << (r.cycles ? (f64)r.uops / r.cycles : 0)
+           << "," << r.mispredicts
+           << "," << (r.mops ? (f64)r.mispredicts * 1000 / r.mops : 0)
+           << "," << r.flushes << "," << r.squashed << "," << r.moves_eliminated << "," << r.zero_idioms
+           << "," << r.exception << "," << res[i].seconds << "," << csv_field(res[i].error) << "\n";
+    }
+}
+
+static void write_json(std::ostream& os, const Grid& grid, const vector<Job>& jobs, const vector<Result>& res)
+{
+    os << "[\n";
+    for(u64 i = 0; i < jobs.size(); i++)
+    {
+        const SimStats& r = res[i].stats;
+        os << "  { \"workload\": " << json_str(grid.workloads[jobs[i].workload]);
+        for(u32 a = 0; a < grid.axes.size(); a++)
+            os << ", " << json_str(grid.axes[a].key) << ": " << json_str(grid.axes[a].values[jobs[i].point[a]]);
+        os << ", \"cycles\": " << r.cycles << ", \"uops\": " << r.uops << ", \"mops\": " << r.mops
+           << ", \"ipc\": " << (r.cycles ? (f64)r.uops / r.cycles : 0)
+           << ", \"mispredicts\": " << r.mispredicts
+           << ", \"mpki\": " << (r.mops ? (f64)r.mispredicts * 1000 / r.mops : 0)
+           << ", \"flushes\": " << r.flushes << ", \"squashed\": " << r.squashed
+           << ", \"moves_eliminated\": " << r.moves_eliminated << ", \"zero_idioms\": " << r.zero_idioms
+           << ", \"exception\": " << r.exception << ", \"seconds\": " << res[i].seconds
+           << ", \"error\": " << json_str(res[i].error) << " }" << ((i + 1 < jobs.size()) ? "," : "") << "\n";
+    }
+    os << "]\n";
+}
+
+int run(const opts& base, const SimConfig& cfg)
+{
+    Grid           grid = load(base.sweep);
+    vector<Job>    jobs = expand(grid, base, cfg);
+    vector<Result> res(jobs.size());
+
+    u32 threads = base.jobs ? base.jobs : std::thread::hardware_concurrency();
+    threads = std::clamp<u64>(threads, 1, jobs.size());
+
+    util::log(LOG_SIM_INIT, "Sweep ", base.sweep, ": ", dec_u<0>, jobs.size(), " runs on ",
+        dec_u<0>, threads, " threads.");
+
+    // workers pull the next job index until the grid is exhausted
+    std::atomic<u64> next = 0;
+    auto worker = [&]()
+    {
+        for(u64 i; (i = next++) < jobs.size();)
+            res[i] = run_job(jobs[i]);
+    };
+
+    vector<std::thread> pool;
+    for(u32 i = 0; i < threads; i++) pool.emplace_back(worker);
+    for(std::thread& t : pool) t.join();
+
+    std::ofstream file;
+    if(!base.out.empty())
+    {
+        file.open(base.out);
+        if(!file) throw FileException("Sweep output ", base.out, " could not be opened.");
+    }
+    std::ostream& os = base.out.empty() ? std::cout : file;
+
+    if(base.out.ends_with(".json")) write_json(os, grid, jobs, res);
+    else                            write_csv(os, grid, jobs, res);
+
+    u64 failed = std::count_if(res.begin(), res.end(), [](const Result& r) { return !r.error.empty(); });
+    if(failed) util::log(LOG_SIM_INIT, dec_u<0>, failed, " runs failed.");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+} // sweep
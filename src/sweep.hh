@@ -0,0 +1,59 @@
+// o3 RISC simulator
+//
+// parameter sweeps
+// - grid files
+// - worker threads
+// - result tables
+//
+// Lukas Heine 2021
+
+#ifndef SIM_SWEEP_H
+#define SIM_SWEEP_H
+
+#include "types.hh"
+#include "config.hh"
+#include "sim.hh"
+
+namespace sweep
+{
+    // one grid axis, values are parameter strings as accepted by config::set
+    struct Axis
+    {
+        string          key;
+        vector<string>  values;
+    }; // Axis
+
+    // "key = v0 v1 ..", workloads are listed with "workload = path ..", '#' starts a comment
+    struct Grid
+    {
+        vector<string>      workloads;
+        vector<vector<u8>>  code;       // machine code per workload
+        vector<Axis>        axes;
+    }; // Grid
+
+    // single point of the grid
+    struct Job
+    {
+        u32             workload;   // index into Grid::workloads
+        vector<u32>     point;      // value index per axis
+        opts            myopts;
+        SimConfig       cfg;
+    }; // Job
+
+    struct Result
+    {
+        SimStats    stats;
+        f64         seconds;
+        string      error;          // simulator exception, empty on success
+    }; // Result
+
+    Grid        load(const string& path);
+    // cartesian product of all axes for every workload, aborts on invalid points
+    vector<Job> expand(const Grid& grid, const opts& base, const SimConfig& cfg);
+    Result      run_job(const Job& job);
+
+    // run the grid in base.sweep on base.jobs threads and write the results to base.out
+    int         run(const opts& base, const SimConfig& cfg);
+} // sweep
+
+#endif // SIM_SWEEP_H
@@ -0,0 +1,136 @@
+// o3 RISC simulator
+//
+// commit trace reader
+// - filters
+// - record listing
+// - summary
+//
+// Lukas Heine 2021
+
+#include <cstdlib>
+
+#include "../cxxopts.hh"
+#include "../trace.hh"
+#include "../core/uops.hh"
+
+typedef enum
+{
+    k_all, k_load, k_store, k_mem, k_branch, k_mispredict,
+} record_kind;
+
+static u8 kind_of(const string& name)
+{
+    const vector<string> names = { "all", "load", "store", "mem", "branch", "mispredict" };
+    for(u8 i = 0; i < names.size(); i++)
+        if(names[i] == name) return i;
+    return UINT8_MAX;
+}
+
+static bool matches(const trace::Record& r, u8 kind)
+{
+    switch(kind)
+    {
+        case k_load:       return r.flags & trace::rf_load;
+        case k_store:      return r.flags & trace::rf_store;
+        case k_mem:        return r.flags & (trace::rf_load | trace::rf_store);
+        case k_branch:     return r.flags & trace::rf_branch;
+        case k_mispredict: return r.flags & trace::rf_mispredict;
+        default:           return true;
+    }
+}
+
+// cycle rip mnemonic destinations [sources] [imm] [memory] [branch]
+static void print(const trace::Record& r)
+{
+    auto info = uopmap.find(r.op.opcode);
+
+    std::cout << dec_u<10> << r.cycle << " " << hex_u<64> << r.rip << " " << str_w<10>
+              << ((info != uopmap.end()) ? info->second.mnemonic : "?") << " r" << dec_u<3> << +r.op.regs[r_rd];
+    if(r.op.control & rc_dest) std::cout << " r" << dec_u<3> << +r.op.regs[r_rc];
+    std::cout << " <-";
+    if(r.op.control & use_ra)  std::cout << " r" << dec_u<3> << +r.op.regs[r_ra];
+    if(r.op.control & use_rb)  std::cout << " r" << dec_u<3> << +r.op.regs[r_rb];
+    if(r.op.control & use_imm) std::cout << " #" << hex_u<64> << r.op.imm;
+
+    if(r.flags & trace::rf_load)  std::cout << " ld " << hex_u<64> << r.vaddr << " " << dec_u<0> << r.size;
+    if(r.flags & trace::rf_store) std::cout << " st " << hex_u<64> << r.vaddr << " " << dec_u<0> << r.size;
+    if(r.flags & trace::rf_branch)
+        std::cout << ((r.flags & trace::rf_taken) ? " T " : " N ") << hex_u<64> << r.vaddr
+                  << ((r.flags & trace::rf_mispredict) ? " mispredicted" : "");
+
+    std::cout << ((r.flags & trace::rf_last) ? "" : " +") << "\n";
+}
+
+int main(int argc, char** argv)
+{
+    cxxopts::Options options("o3trace", "print and filter o3 commit traces");
+    options.add_options()
+        ("file",                "trace file",               cxxopts::value<std::string>()                       )
+        ("n,count",             "print at most n records",  cxxopts::value<u64>()->default_value("0")           )
+        ("from",                "first cycle",              cxxopts::value<u64>()->default_value("0")           )
+        ("to",                  "last cycle",               cxxopts::value<u64>()->default_value(std::to_string(UINT64_MAX)))
+        ("rip",                 "only this macro op address", cxxopts::value<std::string>()                     )
+        ("k,kind",              "all, load, store, mem, branch, mispredict", cxxopts::value<std::string>()->default_value("all"))
+        ("s,summary",           "only print the summary"                                                        )
+        ("h,help",              "print help"                                                                    )
+        ;
+    options.parse_positional({ "file" });
+
+    cxxopts::ParseResult opts;
+    try { opts = options.parse(argc, argv); }
+    catch (cxxopts::OptionParseException& e) { util::abort(e.what()); }
+
+    if(opts.count("help") || !opts.count("file")) { std::cout << options.help() << std::endl; return EXIT_SUCCESS; }
+
+    const u64 count   = opts["count"].as<u64>();
+    const u64 from    = opts["from"].as<u64>();
+    const u64 to      = opts["to"].as<u64>();
+    const u8  kind    = kind_of(opts["kind"].as<std::string>());
+    const u8  summary = opts.count("summary");
+    u64       rip     = 0;
+    if(kind == UINT8_MAX) util::abort("Unknown record kind ", opts["kind"].as<std::string>(), ".");
+    if(opts.count("rip"))
+    {
+        try { rip = std::stoull(opts["rip"].as<std::string>(), nullptr, 0); }
+        catch(const std::exception&) { util::abort("Invalid rip."); }
+    }
+
+    u64 printed = 0, uops = 0, mops = 0, loads = 0, stores = 0, branches = 0, taken = 0, mispredicts = 0;
+    u64 first = UINT64_MAX, last = 0;
+    u8  codec = trace::codec_none;
+    try
+    {
+        trace::Reader reader(opts["file"].as<std::string>());
+        trace::Record r;
+        codec = reader.header.codec;
+        while(reader.next(r))
+        {
+            if((r.cycle < from) || (r.cycle > to) || (rip && r.rip != rip) || !matches(r, kind)) continue;
+
+            uops++;
+            mops        += !!(r.flags & trace::rf_last);
+            loads       += !!(r.flags & trace::rf_load);
+            stores      += !!(r.flags & trace::rf_store);
+            branches    += !!(r.flags & trace::rf_branch);
+            taken       += !!(r.flags & trace::rf_taken);
+            mispredicts += !!(r.flags & trace::rf_mispredict);
+            first        = std::min(first, r.cycle);
+            last         = std::max(last, r.cycle);
+
+            if(!summary && (!count || printed < count))
+            {
+                print(r);
+                printed++;
+            }
+        }
+    }
+    catch(const TraceException& e) { util::abort("Trace ", opts["file"].as<std::string>(), ": ", e.what()); }
+
+    // cycles of sampled runs are not contiguous, IPC is only meaningful for complete runs
+    std::cout << dec_u<0> << uops << " uops, " << mops << " mops in cycles " << (uops ? first : 0) << " to " << last
+              << ", IPC " << ((last > first) ? (f64)uops / (last - first + 1) : 0) << "\n"
+              << loads << " loads, " << stores << " stores, " << branches << " branches, " << taken << " taken, "
+              << mispredicts << " mispredicted, codec " << trace::codec_name(codec) << "\n";
+
+    return EXIT_SUCCESS;
+}
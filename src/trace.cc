@@ -0,0 +1,399 @@
+// o3 RISC simulator
+//
+// commit traces
+// - record encoding
+// - frame codecs
+// - writer thread
+// - reader
+//
+// Lukas Heine 2021
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef with_zstd
+#include <zstd.h>
+#endif
+
+#include "trace.hh"
+
+namespace trace
+{
+
+static void put_var(vector<u8>& b, u64 v)
+{
+    for(; v >= 0x80; v >>= 7) b.push_back((v & 0x7f) | 0x80);
+    b.push_back(v);
+}
+
+// 1 if the varint runs past len
+static u8 get_var(const u8* p, size_t len, size_t& pos, u64& v)
+{
+    v = 0;
+    for(u8 shift = 0; (pos < len) && (shift < 64); shift += 7)
+    {
+        u8 b = p[pos++];
+        v |= (u64)(b & 0x7f) << shift;
+        if(!(b & 0x80)) return 0;
+    }
+    return 1;
+}
+
+// small signed deltas stay small
+static u64 zig(u64 d)   { return (d << 1) ^ (u64)((i64)d >> 63); }
+static u64 unzig(u64 v) { return (v >> 1) ^ (0 - (v & 1)); }
+
+// last.vaddr follows memory records only, branch targets are relative to their rip
+static void encode(vector<u8>& b, const Record& r, Record& last)
+{
+    const u8 mem = r.flags & (rf_load | rf_store);
+
+    b.push_back(r.flags);
+    put_var(b, r.cycle - last.cycle);
+    put_var(b, zig(r.rip - last.rip));
+    put_var(b, r.op.opcode);
+    put_var(b, r.op.control);
+    b.insert(b.end(), r.op.regs, r.op.regs + 4);
+    put_var(b, zig(r.op.imm));
+    if(r.flags & rf_last) put_var(b, zig(r.seq - r.rip));
+    if(mem)
+    {
+        put_var(b, zig(r.vaddr - last.vaddr));
+        put_var(b, r.size);
+    }
+    if(r.flags & rf_branch) put_var(b, zig(r.vaddr - r.rip));
+
+    u64 vaddr = last.vaddr;
+    last      = r;
+    if(!mem) last.vaddr = vaddr;
+}
+
+static u8 decode(const u8* p, size_t len, size_t& pos, Record& r, Record& last)
+{
+    u64 v;
+    r = {};
+
+    if(pos >= len) return 1;
+    r.flags = p[pos++];
+    const u8 mem = r.flags & (rf_load | rf_store);
+
+    if(get_var(p, len, pos, v)) return 1;
+    r.cycle = last.cycle + v;
+    if(get_var(p, len, pos, v)) return 1;
+    r.rip = last.rip + unzig(v);
+    if(get_var(p, len, pos, v)) return 1;
+    r.op.opcode = v;
+    if(get_var(p, len, pos, v)) return 1;
+    r.op.control = v;
+
+    if(len - pos < 4) return 1;
+    std::memcpy(r.op.regs, p + pos, 4);
+    pos += 4;
+    if(get_var(p, len, pos, v)) return 1;
+    r.op.imm = unzig(v);
+    if(r.flags & rf_last)
+    {
+        if(get_var(p, len, pos, v)) return 1;
+        r.seq = r.rip + unzig(v);
+    }
+    if(mem)
+    {
+        if(get_var(p, len, pos, v)) return 1;
+        r.vaddr = last.vaddr + unzig(v);
+        if(get_var(p, len, pos, r.size)) return 1;
+    }
+    if(r.flags & rf_branch)
+    {
+        if(get_var(p, len, pos, v)) return 1;
+        r.vaddr = r.rip + unzig(v);
+    }
+
+    u64 vaddr = last.vaddr;
+    last      = r;
+    if(!mem) last.vaddr = vaddr;
+    return 0;
+}
+
+vector<u8> lz_encode(const u8* data, size_t len)
+{
+    vector<u8>  out;
+    vector<u32> table(1 << TRACE_LZ_BITS, 0); // position + 1 of the last 4 byte sequence with this hash
+    size_t      anchor = 0;
+
+    for(size_t i = 0; i + 4 <= len;)
+    {
+        u32 word;
+        std::memcpy(&word, data + i, 4);
+        u32 h    = (word * 2654435761u) >> (32 - TRACE_LZ_BITS);
+        u32 cand = table[h];
+        table[h] = i + 1;
+
+        if(!cand || std::memcmp(data + cand - 1, data + i, 4))
+        {
+            i++;
+            continue;
+        }
+
+        size_t ref = cand - 1, m = 4;
+        while((i + m < len) && (data[ref + m] == data[i + m])) m++;
+
+        put_var(out, i - anchor);
+        out.insert(out.end(), data + anchor, data + i);
+        put_var(out, m - 3);
+        put_var(out, i - ref);
+        i     += m;
+        anchor = i;
+    }
+
+    put_var(out, len - anchor);
+    out.insert(out.end(), data + anchor, data + len);
+    put_var(out, 0);
+    return out;
+}
+
+u8 lz_decode(const u8* in, size_t inlen, u8* out, size_t len)
+{
+    size_t i = 0, o = 0;
+    for(;;)
+    {
+        u64 lits, m, off;
+        if(get_var(in, inlen, i, lits) || (lits > inlen - i) || (lits > len - o)) return 1;
+        std::memcpy(out + o, in + i, lits);
+        i += lits;
+        o += lits;
+
+        if(get_var(in, inlen, i, m)) return 1;
+        if(!m) break;
+        m += 3;
+
+        if(get_var(in, inlen, i, off) || !off || (off > o) || (m > len - o)) return 1;
+        for(u64 k = 0; k < m; k++, o++) out[o] = out[o - off]; // matches may overlap themselves
+    }
+    return (i != inlen) || (o != len);
+}
+
+u8 codec_id_of(const string& name)
+{
+    if(name == "none") return codec_none;
+    if(name == "lz")   return codec_lz;
+    #ifdef with_zstd
+    if(name == "zstd") return codec_zstd;
+    #endif
+    return UINT8_MAX;
+}
+
+string codec_name(u8 codec)
+{
+    switch(codec)
+    {
+        case codec_none: return "none";
+        case codec_lz:   return "lz";
+        case codec_zstd: return "zstd";
+        default:         return "unknown";
+    }
+}
+
+// stored raw if the codec does not help
+static vector<u8> compress(u8& codec, const vector<u8>& raw)
+{
+    vector<u8> out;
+    switch(codec)
+    {
+        case codec_lz:
+            out = lz_encode(raw.data(), raw.size());
+            break;
+        #ifdef with_zstd
+        case codec_zstd:
+        {
+            out.resize(ZSTD_compressBound(raw.size()));
+            size_t n = ZSTD_compress(out.data(), out.size(), raw.data(), raw.size(), TRACE_ZSTD_LEVEL);
+            out.resize(ZSTD_isError(n) ? raw.size() : n);
+            break;
+        }
+        #endif
+        default:
+            break;
+    }
+
+    if(codec == codec_none || out.size() >= raw.size())
+    {
+        codec = codec_none;
+        return raw;
+    }
+    return out;
+}
+
+// raw frames are not copied
+static u8 decompress(u8 codec, const u8* in, size_t inlen, vector<u8>& out)
+{
+    switch(codec)
+    {
+        case codec_lz:
+            return lz_decode(in, inlen, out.data(), out.size());
+        #ifdef with_zstd
+        case codec_zstd:
+            return ZSTD_decompress(out.data(), out.size(), in, inlen) != out.size();
+        #endif
+        default:
+            return 1;
+    }
+}
+
+Writer::Writer(const string& path, u8 codec, u8 frontend) :
+    file(path, std::ios::binary | std::ios::trunc), codec(codec)
+{
+    if(!file || (codec >= codec_max) || (codec_id_of(codec_name(codec)) != codec)) throw TraceException();
+
+    Header hdr = { magic, version, codec, frontend, { 0 } };
+    file.write((const char*)&hdr, sizeof(hdr));
+    written = sizeof(hdr);
+
+    front.reserve(TRACE_FRAME + 64);
+    back.reserve(TRACE_FRAME + 64);
+    worker = std::thread(&Writer::work, this);
+}
+
+Writer::~Writer()
+{
+    try { close(); }
+    catch(const TraceException&) { /* reported by close() if called explicitly */ }
+}
+
+void Writer::put(const Record& r)
+{
+    encode(front, r, last);
+    front_records++;
+    records++;
+
+    if(front.size() >= TRACE_FRAME) submit();
+}
+
+// hand the full frame to the worker, deltas restart with the next one
+void Writer::submit()
+{
+    raw += front.size();
+
+    std::unique_lock lock(mtx);
+    cv.wait(lock, [&]() { return back.empty(); });
+    std::swap(front, back);
+    back_records  = front_records;
+    front_records = 0;
+    last          = {};
+    cv.notify_all();
+}
+
+void Writer::work()
+{
+    std::unique_lock lock(mtx);
+    for(;;)
+    {
+        cv.wait(lock, [&]() { return !back.empty() || stop; });
+        if(back.empty()) return;
+
+        // back belongs to the worker until it is cleared
+        lock.unlock();
+        u8               c    = codec;
+        const vector<u8> data = compress(c, back);
+        Frame            f    = { (u32)back.size(), (u32)data.size(), back_records, c, { 0 } };
+        file.write((const char*)&f, sizeof(f));
+        file.write((const char*)data.data(), data.size());
+        written += sizeof(f) + data.size();
+        lock.lock();
+
+        failed |= !file;
+        back.clear();
+        cv.notify_all();
+    }
+}
+
+void Writer::close()
+{
+    if(closed) return;
+    closed = 1;
+
+    if(!front.empty()) submit();
+    {
+        std::lock_guard lock(mtx);
+        stop = 1;
+    }
+    cv.notify_all();
+    worker.join();
+
+    file.close();
+    if(failed || !file) throw TraceException();
+}
+
+Reader::Reader(const string& path) : base(nullptr), len(0)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) throw TraceException();
+
+    struct stat sb;
+    if(fstat(fd, &sb) || ((size_t)sb.st_size < sizeof(Header)))
+    {
+        close(fd);
+        throw TraceException();
+    }
+
+    len = sb.st_size;
+    void* p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED) throw TraceException();
+    base = (const u8*)p;
+
+    std::memcpy(&header, base, sizeof(header));
+    if((header.magic != magic) || (header.version != version))
+    {
+        munmap((void*)base, len);
+        throw TraceException();
+    }
+    madvise((void*)base, len, MADV_SEQUENTIAL);
+}
+
+Reader::~Reader()
+{
+    munmap((void*)base, len);
+}
+
+u8 Reader::load_frame()
+{
+    Frame f;
+    if(len - offs < sizeof(f)) return 0;
+    std::memcpy(&f, base + offs, sizeof(f));
+    offs += sizeof(f);
+    if((f.codec >= codec_max) || (f.size > len - offs)) throw TraceException();
+
+    if(f.codec == codec_none)
+    {
+        if(f.size != f.raw_size) throw TraceException();
+        data = base + offs;
+    }
+    else
+    {
+        buf.resize(f.raw_size);
+        if(decompress(f.codec, base + offs, f.size, buf)) throw TraceException();
+        data = buf.data();
+    }
+
+    offs   += f.size;
+    size    = f.raw_size;
+    pos     = 0;
+    pending = f.records;
+    last    = {};
+    return 1;
+}
+
+u8 Reader::next(Record& r)
+{
+    while(!pending)
+        if(!load_frame()) return 0;
+
+    if(decode(data, size, pos, r, last)) throw TraceException();
+    pending--;
+    return 1;
+}
+
+} // trace
@@ -0,0 +1,152 @@
+// o3 RISC simulator
+//
+// commit traces
+// - binary file layout
+// - background writer
+// - mapped sequential reader
+//
+// Lukas Heine 2021
+
+#ifndef SIM_TRACE_H
+#define SIM_TRACE_H
+
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include "types.hh"
+#include "util.hh"
+#include "conf.hh"
+
+struct TraceException : public SimulatorException
+{
+    const char* what () const throw ()
+    {   return "invalid trace file or unsupported codec."; }
+}; // TraceException
+
+// Header | (Frame | data)*
+// records are delta encoded against the previous record of the same frame, frames decode independently
+namespace trace
+{
+    const u32 magic   = 0x5254334f; // "O3TR"
+    const u32 version = 2;
+
+    typedef enum
+    {
+        codec_none,
+        codec_lz,       // built-in, see lz_encode
+        codec_zstd,     // only if built with_zstd
+        codec_max,
+    } codec_id;
+
+    typedef enum
+    {
+        rf_load       = 0x01,
+        rf_store      = 0x02,
+        rf_branch     = 0x04,
+        rf_taken      = 0x08,
+        rf_mispredict = 0x10,
+        rf_last       = 0x20, // last uop of its macro op
+    } record_flags;
+
+    // one committed uop
+    struct Record
+    {
+        u64 cycle;      // of the commit
+        u64 rip;        // macro op
+        u64 seq;        // sequential rip of the macro op, rf_last only
+        uop op;         // as decoded, before renaming and execution
+        u8  flags;      // record_flags
+        u64 vaddr;      // memory address or branch target
+        u64 size;       // memory access bytes
+    }; // Record
+
+    struct Header
+    {
+        u32 magic;
+        u32 version;
+        u8  codec;      // requested, frames may still be stored raw
+        u8  frontend;   // frontends, replay has to match it
+        u8  pad[6];
+    }; // Header
+
+    struct Frame
+    {
+        u32 raw_size;   // encoded records
+        u32 size;       // stored bytes following the frame
+        u32 records;
+        u8  codec;
+        u8  pad[3];
+    }; // Frame
+
+    // LZ77 sequences "literals, match length - 3, offset" as varints, match length 0 ends the block
+    vector<u8> lz_encode(const u8* data, size_t len);
+    u8         lz_decode(const u8* in, size_t inlen, u8* out, size_t len);
+
+    u8     codec_id_of(const string& name); // UINT8_MAX if unknown or not built in
+    string codec_name(u8 codec);
+
+    // records are encoded on the simulator thread, full frames are compressed and written by a worker
+    // while the next frame fills (double buffering), put only blocks if the worker is a whole frame behind
+    class Writer
+    {
+        public:
+        Writer(const string& path, u8 codec, u8 frontend);
+        ~Writer();
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+        void put(const Record& r);
+        // write the last frame and join the worker, throws if anything could not be written
+        void close();
+
+        u64  records = 0;
+        u64  raw     = 0;   // encoded bytes
+        u64  written = 0;   // file bytes
+
+        private:
+        void submit();
+        void work();
+
+        std::ofstream           file;
+        u8                      codec;
+        vector<u8>              front, back;    // filling / being written
+        u32                     front_records = 0, back_records = 0;
+        Record                  last = {};
+        u8                      stop = 0, failed = 0, closed = 0;
+        std::mutex              mtx;
+        std::condition_variable cv;
+        std::thread             worker;
+    }; // Writer
+
+    // the file is mapped, raw frames are decoded in place
+    class Reader
+    {
+        public:
+        Reader(const string& path);
+        ~Reader();
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        // 0 at the end of the trace, throws on corrupted frames
+        u8 next(Record& r);
+
+        Header header;
+
+        private:
+        u8 load_frame();
+
+        const u8*     base;
+        size_t        len;
+        size_t        offs    = sizeof(Header); // next frame
+        vector<u8>    buf;                      // decompressed frame
+        const u8*     data    = nullptr;        // current frame
+        size_t        size    = 0;
+        size_t        pos     = 0;
+        u32           pending = 0;              // records left in data
+        Record        last    = {};
+    }; // Reader
+} // trace
+
+#endif // SIM_TRACE_H
@@ -13,6 +13,7 @@
 #include <cstring>
 #include <deque>
 #include <exception>
+#include <iterator>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -71,8 +72,37 @@ struct opts
 {
     // this maps the entire bytecode
     vector<u8> code;
+    string elf;     // x64 executable, mapped instead of code if set
     u8 frontend;
+    u8 bpred;
+    u8 ittage;
+    u8 loop;
     u8 time;
+    u8 loglevel;
+    u64 cycles;     // simulated cycles at most
+    // functional fast-forward before the detailed run
+    u64 ff_insts;   // instructions, 0: none
+    u64 ff_pc;      // or until this rip, 0: none
+    // checkpoints
+    string ckpt_load;   // restored before the run
+    string ckpt_save;   // written after the run
+    u8     ckpt_compress;
+    // commit trace
+    string trace;       // written during the run if set
+    u8     trace_codec; // trace::codec_id
+    string replay;      // commit trace fed to the core instead of the frontend if set
+    // sampled simulation
+    u32    sp_k;        // simulation points, 0: off
+    u64    sp_interval; // instructions per interval
+    string bbv;         // basic block vectors are written here if set
+    u64    sm_period;   // systematic sampling, instructions between windows, 0: off
+    u64    sm_unit;     // measured instructions per window
+    u64    sm_warm;     // detailed warming before every window
+    f64    sm_error;    // target relative error of the CPI
+    // parameter sweep
+    string sweep;   // grid file, empty if a single simulation is run
+    string out;     // result table (.csv or .json), stdout if empty
+    u32    jobs;    // worker threads, 0: host cores
     // ELF
     // Data
 } __attribute__((aligned(16))); // opts
@@ -90,6 +120,7 @@ const uop zero_op = { 0, 0, { 0 }, 0 };
 // hold values until release condition is met
 // values are available at output after latch()
 // use as 'latch': #pushed == #popped, else queue
+// backed by a fixed ring allocated once, elements stay in place until popped
 template<typename T>
 class LatchQueue
 {
@@ -111,22 +142,45 @@ class LatchQueue
     T       get_front(u64 cycle);
     T&      front(u64 cycle);
     void    pop_front();
+    void    pop_back();
 
     T&      at(u64 cycle, u64 index);
 
-    auto begin();
-    auto end();
-
     struct LatchQElem
     {
         u64 cycle;
         T   elem;
     }; // LatchQElem
 
+    // forward iterator over the occupied slots, front to back
+    struct iterator
+    {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = LatchQElem;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = LatchQElem*;
+        using reference         = LatchQElem&;
+
+        LatchQueue* q;
+        size_t      idx;
+
+        LatchQElem& operator*()  const { return q->slot(idx); }
+        LatchQElem* operator->() const { return &q->slot(idx); }
+        iterator&   operator++()       { idx++; return *this; }
+        iterator    operator+(size_t n) const { return { q, idx + n }; }
+        bool        operator==(const iterator& other) const { return idx == other.idx; }
+    }; // iterator
+
+    iterator begin();
+    iterator end();
+
     private:
-    u32                                         max_size;
-    std::deque<LatchQElem>                      queue;
-    typename std::deque<LatchQElem>::iterator   iter_in, iter_out;
+    LatchQElem& slot(size_t index);
+
+    u32                max_size;
+    vector<LatchQElem> ring;     // storage, sized once at construction
+    size_t             head = 0; // slot of the front element
+    size_t             count = 0;
 }; // LatchQueue
 
 struct SimulatorException : public std::exception
@@ -135,6 +189,17 @@ struct SimulatorException : public std::exception
     {   return "unspecified simulator exception."; }
 }; // SimulatorException
 
+// message built like util::log, the library reports errors with these instead of exiting
+struct MessageException : public SimulatorException
+{
+    template<class... T>
+    MessageException(T... str) { std::stringstream ss; (ss << ... << str); msg = ss.str(); }
+    const char* what () const throw ()
+    {   return msg.c_str(); }
+
+    string msg;
+}; // MessageException
+
 struct LatchException : public SimulatorException {};
 
 struct LatchEmptyException : public LatchException
@@ -17,10 +17,32 @@
 #include "util.hh"
 #include "sim.hh"
 #include "core/uops.hh"
+#include "frontend/bp.hh"
+#include "trace.hh"
 
 namespace util
 {
 
+thread_local Logger* logger    = nullptr;
+thread_local u8      in_decode = 0;
+
+// read a machine code file ("a8ef.." with comments, see str2vec)
+vector<u8> load_code(const string& path)
+{
+    std::ifstream infile (path);
+    if(!infile) throw FileException("File ", path, " could not be opened.");
+    std::string mstr;
+    infile.seekg(0, std::ios::end);
+    mstr.resize(infile.tellg());
+    infile.seekg(0, std::ios::beg);
+    infile.read(mstr.data(), mstr.size());
+    infile.close();
+
+    vector<u8> code = util::str2vec(mstr);
+    if(code.empty()) throw FileException("Machine code in ", path, " is not valid.");
+    return code;
+}
+
 // "a8ef.." -> [0xa8, 0xef, ...]
 // see https://stackoverflow.com/a/30606613/9958527
 // man 3 endian
@@ -57,7 +79,7 @@ vector<u8> str2vec(std::string& str)
 }
 
 // parse args to struct
-int parseargs(int argc, char** argv, struct opts* myopts)
+int parseargs(int argc, char** argv, struct opts* myopts, struct SimConfig* cfg)
 {
     // tbd use getopt instead, compile is kinda slow
     // parse options, set vars
@@ -71,65 +93,145 @@ int parseargs(int argc, char** argv, struct opts* myopts)
         ("v,verbose",           "\"-l 7\"",                 cxxopts::value<bool>()->default_value("false")      )
         ("m,mcode",             "machine code",             cxxopts::value<std::string>()                       )
         ("i,infile",            "path to input file",       cxxopts::value<std::string>()                       )
+        ("e,elf",               "x64 ELF executable",       cxxopts::value<std::string>()                       )
         // Data?
         ("t,time",              "measure simulation time"                                                       )
+        ("n,cycles",            "simulate at most n cycles", cxxopts::value<u64>()->default_value(std::to_string(MAX_CYCLES)))
+        ("ff",                  "fast-forward n instructions functionally", cxxopts::value<u64>()->default_value("0"))
+        ("ff-pc",               "fast-forward until rip reaches this address", cxxopts::value<std::string>()    )
+        ("simpoint",            "simulate k representative intervals", cxxopts::value<u32>()->default_value("0"))
+        ("interval",            "instructions per simpoint interval", cxxopts::value<u64>()->default_value(std::to_string(SP_INTERVAL)))
+        ("bbv",                 "write basic block vectors", cxxopts::value<std::string>()                      )
+        ("smarts",              "measure a window every n instructions", cxxopts::value<u64>()->default_value("0"))
+        ("unit",                "measured instructions per window", cxxopts::value<u64>()->default_value(std::to_string(SM_UNIT)))
+        ("warm",                "detailed warming before every window", cxxopts::value<u64>()->default_value(std::to_string(SM_WARM)))
+        ("error",               "target relative CPI error", cxxopts::value<f64>()->default_value(std::to_string(SM_ERROR)))
+        ("load-ckpt",           "restore a checkpoint before running", cxxopts::value<std::string>()            )
+        ("save-ckpt",           "write a checkpoint after running", cxxopts::value<std::string>()               )
+        ("compress",            "compress checkpoint frames"                                                    )
+        ("trace",               "write a binary commit trace", cxxopts::value<std::string>()                    )
+        ("trace-codec",         "trace compression: none, lz, zstd", cxxopts::value<std::string>()->default_value("lz"))
+        ("replay",              "feed the core from a commit trace", cxxopts::value<std::string>()              )
         ("f,frontend",          "select frontend",          cxxopts::value<std::string>()->default_value("risc"))
+        ("b,bpred",             "select branch predictor",  cxxopts::value<std::string>()->default_value("btb") )
+        ("ittage",              "indirect target predictor",cxxopts::value<bool>()->default_value("false")      )
+        ("loop",                "loop predictor",           cxxopts::value<bool>()->default_value("false")      )
+        ("p,preset",            "core preset: default, small, wide", cxxopts::value<std::string>()->default_value("default"))
+        ("c,config",            "config file with key = value lines", cxxopts::value<std::string>()             )
+        ("s,set",               "set parameter, e.g. core.rob_size=256", cxxopts::value<std::string>()          )
+        ("sweep",               "run a parameter grid file", cxxopts::value<std::string>()                      )
+        ("o,out",               "sweep/simpoint results (.csv/.json)", cxxopts::value<std::string>()->default_value("")  )
+        ("j,jobs",              "sweep/simpoint threads, 0: all cores", cxxopts::value<u32>()->default_value("0")        )
         ("h,help",              "print help"                                                                    )
         ;
 
-    #ifdef simtest
-    options.add_options()
-        ("t,test",              "start googletest"                                                              )
-        ;
-    options.allow_unrecognised_options();
-    #endif // simtest
-
     cxxopts::ParseResult opts;
     try { opts = options.parse(argc, argv); }
-    catch (cxxopts::OptionParseException& e) { util::abort(e.what()); }
-
-    #ifdef simtest
-    // this *will* ignore all other flags
-    if(opts.count("test"))
-        { ::testing::InitGoogleTest(&argc, argv); return RUN_ALL_TESTS(); }
-    #endif // simtest
+    catch (cxxopts::OptionParseException& e) { throw ConfigException(e.what()); }
 
     if(opts.count("help") || argc == 1)
         { std::cout << BANNER_STRING << options.help() << std::endl; exit(EXIT_SUCCESS); }
 
     // loglevels
     // 0: nothing   1: ..   2: ..   3: ..   4: ..   5: ..   6: ..   7: everything
-    loglevel = opts["loglv"].as<uint8_t>();
-    if (loglevel > 7 || opts["verbose"].as<bool>()) loglevel = 7;
+    myopts->loglevel = opts["loglv"].as<uint8_t>();
+    if (myopts->loglevel > 7 || opts["verbose"].as<bool>()) myopts->loglevel = 7;
+
+    myopts->time   = opts.count("time");
+    myopts->cycles = opts["cycles"].as<u64>();
 
-    myopts->time = opts.count("time");
+    myopts->ff_insts = opts["ff"].as<u64>();
+    myopts->ff_pc    = 0;
+    if(opts.count("ff-pc"))
+    {
+        try { myopts->ff_pc = std::stoull(opts["ff-pc"].as<std::string>(), nullptr, 0); }
+        catch(const std::exception&) { throw ConfigException("Invalid fast-forward address."); }
+    }
+
+    myopts->sp_k        = opts["simpoint"].as<u32>();
+    myopts->sp_interval = opts["interval"].as<u64>();
+    myopts->bbv         = opts.count("bbv") ? opts["bbv"].as<std::string>() : "";
+    if(!myopts->sp_interval) throw ConfigException("Interval length has to be at least 1.");
+
+    myopts->sm_period = opts["smarts"].as<u64>();
+    myopts->sm_unit   = opts["unit"].as<u64>();
+    myopts->sm_warm   = opts["warm"].as<u64>();
+    myopts->sm_error  = opts["error"].as<f64>();
+    if(!myopts->sm_unit || myopts->sm_error <= 0) throw ConfigException("Unit and target error have to be positive.");
+    if(myopts->sm_period && (myopts->sm_period < myopts->sm_unit + myopts->sm_warm))
+        throw ConfigException("Sampling period has to cover warming and unit.");
+
+    myopts->ckpt_load     = opts.count("load-ckpt") ? opts["load-ckpt"].as<std::string>() : "";
+    myopts->ckpt_save     = opts.count("save-ckpt") ? opts["save-ckpt"].as<std::string>() : "";
+    myopts->ckpt_compress = opts.count("compress");
+
+    myopts->trace       = opts.count("trace") ? opts["trace"].as<std::string>() : "";
+    myopts->trace_codec = trace::codec_id_of(opts["trace-codec"].as<std::string>());
+    if(myopts->trace_codec == UINT8_MAX)
+        throw ConfigException("Unknown or unavailable trace codec ", opts["trace-codec"].as<std::string>(), ".");
+
+    // replays start where the trace does, there is no functional mode to skip ahead
+    myopts->replay = opts.count("replay") ? opts["replay"].as<std::string>() : "";
+    if(!myopts->replay.empty() &&
+        (myopts->ff_insts || myopts->ff_pc || myopts->sp_k || !myopts->bbv.empty() || myopts->sm_period))
+        throw ConfigException("Replays can't fast-forward or sample.");
     
+    // sweeps bring their own workloads
+    myopts->sweep = opts.count("sweep") ? opts["sweep"].as<std::string>() : "";
+    myopts->out   = opts["out"].as<std::string>();
+    myopts->jobs  = opts["jobs"].as<u32>();
+
     // machine code
+    myopts->elf = opts.count("elf") ? opts["elf"].as<std::string>() : "";
     if(!(opts.count("mcode")) && !(opts.count("infile")))
-        util::abort("mcode or infile are required to run. Use -h for help.");
+    {
+        if(myopts->sweep.empty() && myopts->elf.empty())
+            throw ConfigException("mcode, infile or elf are required to run. Use -h for help.");
+    }
     else if(!(opts.count("infile")))
     {
         std::string mstr = opts["mcode"].as<std::string>();
         myopts->code = util::str2vec(mstr);
-        if(myopts->code.empty()) util::abort("Machine code is not valid.");
+        if(myopts->code.empty()) throw ConfigException("Machine code is not valid.");
     }
     else // read from file
-    {
-        std::ifstream infile (opts["infile"].as<std::string>());
-        if(!infile) util::abort("File could not be opened.");
-        std::string mstr;
-        infile.seekg(0, std::ios::end);
-        mstr.resize(infile.tellg());
-        infile.seekg(0, std::ios::beg);
-        infile.read(mstr.data(), mstr.size());
-        infile.close();
-        myopts->code = util::str2vec(mstr);
-        if(myopts->code.empty()) util::abort("Machine code is not valid.");
-    }
+        myopts->code = util::load_code(opts["infile"].as<std::string>());
     
     // frontend select, default to risc
     std::string fstr = opts["frontend"].as<std::string>();
     myopts->frontend = strcmp(fstr.c_str(), "x64") ? risc : x64;
+    if(!myopts->elf.empty() && (myopts->frontend != x64))
+        throw ConfigException("ELF executables require the x64 frontend.");
+    if(!myopts->replay.empty())
+    {
+        try
+        {
+            if(trace::Reader(myopts->replay).header.frontend != myopts->frontend)
+                throw ConfigException("Trace ", myopts->replay, " was recorded with the other frontend.");
+        }
+        catch(const TraceException& e) { throw ConfigException("Trace ", myopts->replay, ": ", e.what()); }
+    }
+
+    // predictor select: simple, btb, tage
+    std::string bstr = opts["bpred"].as<std::string>();
+    myopts->bpred = predictor_id(bstr);
+    if(myopts->bpred == UINT8_MAX) throw ConfigException("Unknown branch predictor ", bstr, ".");
+    myopts->ittage = opts["ittage"].as<bool>();
+    myopts->loop   = opts["loop"].as<bool>();
+
+    // parameters: preset, then config file, then single overrides
+    *cfg = config::preset(opts["preset"].as<std::string>());
+    if(opts.count("config")) config::load(*cfg, opts["config"].as<std::string>());
+    // repeated scalar, vector values would be split at the commas of FU lists
+    for(const cxxopts::KeyValue& arg : opts.arguments())
+        if(arg.key() == "set")
+        {
+            const std::string& kv = arg.value();
+            size_t eq = kv.find('=');
+            if(eq == std::string::npos || config::set(*cfg, kv.substr(0, eq), kv.substr(eq + 1)))
+                throw ConfigException("Invalid parameter \"", kv, "\".");
+        }
+    config::validate(*cfg);
 
     return 0;
 }
@@ -31,7 +31,7 @@
 #define bitmask(n)  (~(((~0ull) << ((n)-1)) << 1))
 #define sx(x, f, t) (((i64)((x) << (8-f)*8) >> (8-f)*8) & bitmask(t*8))
 
-#define outfile     std::cout
+#define outfile     (util::logger ? *util::logger->os : std::cout)
 #define errorfile   std::cerr
 
 #define TODO        throw NotImplementedException()
@@ -40,8 +40,7 @@
 #define H2LINE      "==============================================================================\
 ======================"
 
-// global vars
-extern u8 loglevel;
+struct SimConfig;
 
 // operators and streams
 std::ostream& operator<<(std::ostream& os, const vector<u8>& bytevec);
@@ -87,6 +86,40 @@ std::ostream& str_w(std::ostream& os)
 
 namespace util
 {
+    // log level and sink of a simulator instance
+    struct Logger
+    {
+        u8            level = 0;
+        std::ostream* os    = &std::cout;
+    }; // Logger
+
+    // logger of the simulator active on this thread, nothing below log_always is printed without one
+    extern thread_local Logger* logger;
+
+    // set while x64 uop bundles are built, heap allocations made in it are counted apart (COUNT_ALLOCS)
+    extern thread_local u8 in_decode;
+
+    struct DecodeScope
+    {
+        u8 prev;
+
+        DecodeScope() : prev(in_decode) { in_decode = 1; };
+        ~DecodeScope() { in_decode = prev; };
+        DecodeScope(const DecodeScope&) = delete;
+        DecodeScope& operator=(const DecodeScope&) = delete;
+    }; // DecodeScope
+
+    // bind a logger to the calling thread, the previous one is restored at the end of the scope
+    struct LogScope
+    {
+        Logger* prev;
+
+        LogScope(Logger& l) : prev(logger) { logger = &l; };
+        ~LogScope() { logger = prev; };
+        LogScope(const LogScope&) = delete;
+        LogScope& operator=(const LogScope&) = delete;
+    }; // LogScope
+
     // abort with error message
     template<class... T> inline
     void abort(T... str) { (errorfile << ... << str) << "\n"; exit(EXIT_FAILURE); }
@@ -97,18 +130,25 @@ namespace util
     
     template<class... T> inline
     void log_always(T... str) { (outfile << ... << str) << "\n"; }
+
+    inline bool log_enabled(u8 lv) { (void)(lv); return false; }
 #else
     // log message depending on loglevel
     template<class... T> inline
-    void log(u8 lv, T... str) { if(lv <= loglevel) (outfile << ... << str) << "\n"; }
+    void log(u8 lv, T... str) { if(logger && lv <= logger->level) (*logger->os << ... << str) << "\n"; }
     
     // always log message
     template<class... T> inline
-    void log_always(T ... str) { log(0, str ...); }
+    void log_always(T ... str) { (outfile << ... << str) << "\n"; }
+
+    // guard for log arguments which are expensive to build
+    inline bool log_enabled(u8 lv) { return logger && lv <= logger->level; }
 #endif // nolog
 
     vector<u8> str2vec(string& str);
-    int parseargs(int argc, char** argv, struct opts* opts);
+    // throw FileException / ConfigException
+    vector<u8> load_code(const string& path);
+    int parseargs(int argc, char** argv, struct opts* opts, struct SimConfig* cfg);
 
     // log2
     const std::map<u16, u8> ld
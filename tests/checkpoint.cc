@@ -0,0 +1,118 @@
+// o3 RISC simulator
+//
+// checkpoint tests
+// - frame run length encoding
+// - file layout
+//
+// Lukas Heine 2021
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <random>
+
+#include "../src/checkpoint.hh"
+#include "../src/sim.hh"
+
+// zero runs of every length around the literal/run boundary, separated by random literals
+static vector<u8> frame(u64 seed)
+{
+    std::mt19937_64 rng(seed);
+    vector<u8>      f(PAGE_SIZE, 0);
+
+    for(size_t i = 0; i < f.size();)
+    {
+        i += rng() % 9;
+        for(u64 n = rng() % 5; n && i < f.size(); n--, i++) f[i] = 1 + rng() % 255;
+    }
+    return f;
+}
+
+static void round_trip(const vector<u8>& f)
+{
+    vector<u8> enc = ckpt::rle_encode(f.data(), f.size());
+    vector<u8> dec(f.size(), 0xcc);
+
+    ASSERT_EQ(ckpt::rle_decode(enc.data(), enc.size(), dec.data(), dec.size()), 0);
+    EXPECT_EQ(dec, f);
+}
+
+TEST(Checkpoint, RleRoundTrip)
+{
+    round_trip(vector<u8>(PAGE_SIZE, 0));
+    round_trip(vector<u8>(PAGE_SIZE, 0xa5));
+    round_trip({ 0 });
+    round_trip({ 1, 0, 1, 0, 0, 1 });
+    for(u64 s = 0; s < 64; s++) round_trip(frame(s));
+}
+
+TEST(Checkpoint, RleLongRuns)
+{
+    // runs longer than a u16 count
+    vector<u8> f(3 * UINT16_MAX, 0);
+    f[UINT16_MAX + 7] = 1;
+    std::fill(f.end() - UINT16_MAX - 3, f.end(), 0x5a);
+    round_trip(f);
+}
+
+TEST(Checkpoint, RleRejects)
+{
+    vector<u8> f   = frame(1);
+    vector<u8> enc = ckpt::rle_encode(f.data(), f.size());
+    vector<u8> dec(f.size());
+
+    // too short or too long for the frame, truncated input
+    EXPECT_EQ(ckpt::rle_decode(enc.data(), enc.size(), dec.data(), dec.size() - 1), 1);
+    dec.resize(f.size() + 1);
+    EXPECT_EQ(ckpt::rle_decode(enc.data(), enc.size(), dec.data(), dec.size()), 1);
+    EXPECT_EQ(ckpt::rle_decode(enc.data(), enc.size() - 1, dec.data(), f.size()), 1);
+}
+
+TEST(Checkpoint, FileRoundTrip)
+{
+    const string path = testing::TempDir() + "o3_test.ck";
+
+    ckpt::Header hdr = {};
+    hdr.frontend = x64;
+    std::snprintf(hdr.bp, sizeof(hdr.bp), "tage");
+
+    ckpt::Writer w;
+    u64 counter = 0x0123456789abcdef;
+    ckpt::put(w.section(ckpt::sec_state), counter);
+    w.section(ckpt::sec_pages) << string(3 * PAGE_SIZE + 5, 'p');
+    w.write(path, hdr);
+
+    {
+        ckpt::Reader r(path);
+        EXPECT_EQ(r.header().frontend, x64);
+        EXPECT_STREQ(r.header().bp, "tage");
+
+        u64 read = 0;
+        std::istringstream is = r.stream(ckpt::sec_state);
+        ckpt::get(is, read);
+        EXPECT_EQ(read, counter);
+        EXPECT_THROW(ckpt::get(is, read), CheckpointException);
+
+        // page aligned in the file, so frames can be used in place
+        std::string_view pages = r.section(ckpt::sec_pages);
+        EXPECT_EQ(pages, string(3 * PAGE_SIZE + 5, 'p'));
+        EXPECT_EQ(((uptr)pages.data() - (uptr)&r.header()) % PAGE_SIZE, 0);
+        EXPECT_TRUE(r.section(ckpt::sec_ras).empty());
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST(Checkpoint, RejectsOtherFiles)
+{
+    const string path = testing::TempDir() + "o3_test_bad.ck";
+    {
+        std::ofstream f(path, std::ios::binary);
+        f << string(PAGE_SIZE, 'x');
+    }
+
+    EXPECT_THROW(ckpt::Reader r(path), CheckpointException);
+    EXPECT_THROW(ckpt::Reader r(path + ".missing"), CheckpointException);
+    std::remove(path.c_str());
+}
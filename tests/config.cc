@@ -0,0 +1,80 @@
+// o3 RISC simulator
+//
+// config tests
+// - overrides
+// - validation
+//
+// Lukas Heine 2021
+
+#include <gtest/gtest.h>
+
+#include "../src/config.hh"
+
+TEST(Config, SetScalar)
+{
+    SimConfig cfg = config::preset("default");
+
+    EXPECT_EQ(config::set(cfg, "core.rob_size", "256"), 0);
+    EXPECT_EQ(cfg.core.rob_size, 256);
+    EXPECT_EQ(config::set(cfg, "core.issue_depth", "0x40"), 0);
+    EXPECT_EQ(cfg.core.issue_depth, 64);
+}
+
+TEST(Config, SetFlag)
+{
+    SimConfig cfg = config::preset("default");
+
+    EXPECT_EQ(config::set(cfg, "core.move_elim", "0"), 0);
+    EXPECT_EQ(cfg.core.move_elim, 0);
+    EXPECT_EQ(config::set(cfg, "core.move_elim", "1"), 0);
+    EXPECT_EQ(cfg.core.move_elim, 1);
+    EXPECT_EQ(config::set(cfg, "core.move_elim", "2"), 1);
+}
+
+TEST(Config, SetPortList)
+{
+    SimConfig cfg = config::preset("default");
+
+    EXPECT_EQ(config::set(cfg, "core.port1", "alu, mul,div"), 0);
+    EXPECT_EQ(cfg.core.ports[1], FU(fu_alu) | FU(fu_mul) | FU(fu_div));
+    EXPECT_EQ(config::set(cfg, "core.port1", "alu,fma"), 1);
+}
+
+TEST(Config, SetRejects)
+{
+    SimConfig cfg = config::preset("default");
+    const SimConfig old = cfg;
+
+    EXPECT_EQ(config::set(cfg, "core.no_such_param", "1"), 1);
+    EXPECT_EQ(config::set(cfg, "core.rob_size", ""), 1);
+    EXPECT_EQ(config::set(cfg, "core.rob_size", "12x"), 1);
+    EXPECT_EQ(config::set(cfg, "core.rob_size", "0x100000000"), 1);
+    EXPECT_EQ(cfg.core, old.core);
+}
+
+TEST(Config, Presets)
+{
+    for(u8 p = 0; p < config::preset_runtime; p++)
+    {
+        SimConfig cfg = config::preset(config::preset_names[p]);
+        EXPECT_EQ(config::match(cfg.core), p);
+        EXPECT_NO_THROW(config::validate(cfg));
+    }
+
+    EXPECT_THROW(config::preset("huge"), ConfigException);
+}
+
+TEST(Config, Validate)
+{
+    SimConfig cfg = config::preset("default");
+    ASSERT_EQ(config::set(cfg, "core.rob_size", "0"), 0);
+    EXPECT_THROW(config::validate(cfg), ConfigException);
+
+    cfg = config::preset("default");
+    ASSERT_EQ(config::set(cfg, "core.gp_rnreg", std::to_string(REGCLS_0_CNT)), 0);
+    EXPECT_THROW(config::validate(cfg), ConfigException);
+
+    cfg = config::preset("default");
+    ASSERT_EQ(config::set(cfg, "core.br_checkpoints", "256"), 0);
+    EXPECT_THROW(config::validate(cfg), ConfigException);
+}
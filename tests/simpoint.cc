@@ -0,0 +1,88 @@
+// o3 RISC simulator
+//
+// simulation point tests
+// - basic block vectors
+// - clustering
+//
+// Lukas Heine 2021
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+#include "../src/simpoint.hh"
+
+// three phases, each loops over its own blocks
+static vector<simpoint::BBV> phases(u64 n)
+{
+    vector<simpoint::BBV> bbvs;
+    for(u64 i = 0; i < n; i++)
+    {
+        const u64 p = (i / 4) % 3;
+        simpoint::BBV bbv;
+        for(u64 b = 0; b < 4; b++) bbv[0x1000 * (p + 1) + b * 0x10] = 100 + (i % 4) + b;
+        bbvs.push_back(bbv);
+    }
+    return bbvs;
+}
+
+TEST(Simpoint, Profiler)
+{
+    simpoint::Profiler p(4);
+    for(u64 i = 0; i < 10; i++) p.retire(0x100 + i, !(i % 3));
+
+    // two complete intervals, blocks split at the boundary
+    ASSERT_EQ(p.bbvs.size(), 2);
+    EXPECT_EQ(p.bbvs[0].at(0x100), 1);
+    EXPECT_EQ(p.bbvs[0].at(0x103), 3);
+    EXPECT_EQ(p.bbvs[1].at(0x106), 3);
+    EXPECT_EQ(p.bbvs[1].at(0x107), 1);
+}
+
+TEST(Simpoint, ClusterDeterministic)
+{
+    const vector<simpoint::BBV> bbvs = phases(60);
+
+    const vector<simpoint::Point> a = simpoint::cluster(bbvs, 3, 5);
+    const vector<simpoint::Point> b = simpoint::cluster(bbvs, 3, 5);
+    ASSERT_EQ(a.size(), b.size());
+    for(u64 i = 0; i < a.size(); i++)
+    {
+        EXPECT_EQ(a[i].interval, b[i].interval);
+        EXPECT_EQ(a[i].weight, b[i].weight);
+    }
+}
+
+TEST(Simpoint, ClusterPhases)
+{
+    const vector<simpoint::BBV>   bbvs = phases(60);
+    const vector<simpoint::Point> pts  = simpoint::cluster(bbvs, 3);
+
+    // one point per phase, weights cover all intervals
+    ASSERT_EQ(pts.size(), 3);
+    f64 sum = 0;
+    u8  seen = 0;
+    for(const simpoint::Point& p : pts)
+    {
+        sum  += p.weight;
+        seen |= 1 << ((p.interval / 4) % 3);
+        EXPECT_DOUBLE_EQ(p.weight, 1.0 / 3);
+    }
+    EXPECT_DOUBLE_EQ(sum, 1);
+    EXPECT_EQ(seen, 7);
+
+    EXPECT_TRUE(simpoint::cluster({}, 3).empty());
+    EXPECT_EQ(simpoint::cluster(phases(2), 8).size(), 2);
+}
+
+TEST(Simpoint, WriteBBV)
+{
+    std::stringstream ss;
+    simpoint::write_bbv(ss, { { { 0x10, 5 } }, { { 0x20, 2 }, { 0x10, 1 } } });
+
+    string l0, l1;
+    std::getline(ss, l0);
+    std::getline(ss, l1);
+    EXPECT_EQ(l0, "T:1:5 ");
+    EXPECT_EQ(l1, "T:1:1 :2:2 ");
+}
@@ -0,0 +1,43 @@
+// o3 RISC simulator
+//
+// systematic sampling tests
+// - CPI estimate and confidence
+//
+// Lukas Heine 2021
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+#include "../src/smarts.hh"
+
+TEST(Smarts, Constant)
+{
+    const smarts::Estimate e = smarts::estimate({ { 0, 2000, 1000 }, { 5000, 4000, 2000 }, { 9000, 1000, 500 } }, 3, 0.03);
+
+    EXPECT_EQ(e.n, 3);
+    EXPECT_DOUBLE_EQ(e.cpi, 2);
+    EXPECT_DOUBLE_EQ(e.stddev, 0);
+    EXPECT_DOUBLE_EQ(e.half, 0);
+    EXPECT_EQ(e.needed, 0);
+}
+
+TEST(Smarts, Interval)
+{
+    // per window CPI 1, 2, 3
+    const smarts::Estimate e = smarts::estimate({ { 0, 1000, 1000 }, { 0, 2000, 1000 }, { 0, 3000, 1000 } }, 2, 0.1);
+
+    EXPECT_DOUBLE_EQ(e.cpi, 2);
+    EXPECT_DOUBLE_EQ(e.stddev, 1);
+    EXPECT_DOUBLE_EQ(e.cv, 0.5);
+    EXPECT_DOUBLE_EQ(e.half, 2 / std::sqrt(3.0));
+    EXPECT_DOUBLE_EQ(e.error, e.half / e.cpi);
+    EXPECT_EQ(e.needed, 100);
+}
+
+TEST(Smarts, Empty)
+{
+    const smarts::Estimate e = smarts::estimate({}, 3, 0.03);
+    EXPECT_EQ(e.n, 0);
+    EXPECT_EQ(e.cpi, 0);
+}
@@ -0,0 +1,159 @@
+// o3 RISC simulator
+//
+// commit trace tests
+// - built-in codec
+// - writer / reader round trip
+//
+// Lukas Heine 2021
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+#include "../src/trace.hh"
+#include "../src/sim.hh"
+
+static void round_trip(const vector<u8>& data)
+{
+    vector<u8> enc = trace::lz_encode(data.data(), data.size());
+    vector<u8> dec(data.size(), 0xcc);
+
+    ASSERT_EQ(trace::lz_decode(enc.data(), enc.size(), dec.data(), dec.size()), 0);
+    EXPECT_EQ(dec, data);
+}
+
+TEST(Trace, LzRoundTrip)
+{
+    std::mt19937_64 rng(7);
+
+    round_trip({});
+    round_trip({ 1, 2, 3 });
+    round_trip(vector<u8>(100000, 0));
+
+    // incompressible
+    vector<u8> noise(65536);
+    for(u8& b : noise) b = rng();
+    round_trip(noise);
+
+    // repeated records with small changes, overlapping matches
+    vector<u8> recs;
+    for(u32 i = 0; i < 20000; i++)
+        for(u8 b : { (u8)0x21, (u8)(i & 0x7f), (u8)0x10, (u8)0x40, (u8)(rng() % 3), (u8)0 }) recs.push_back(b);
+    round_trip(recs);
+
+    vector<u8> enc = trace::lz_encode(recs.data(), recs.size());
+    EXPECT_LT(enc.size(), recs.size() / 2);
+}
+
+TEST(Trace, LzRejects)
+{
+    vector<u8> data(4096);
+    for(size_t i = 0; i < data.size(); i++) data[i] = i % 251;
+
+    vector<u8> enc = trace::lz_encode(data.data(), data.size());
+    vector<u8> dec(data.size());
+
+    EXPECT_EQ(trace::lz_decode(enc.data(), enc.size() - 1, dec.data(), dec.size()), 1);
+    EXPECT_EQ(trace::lz_decode(enc.data(), enc.size(), dec.data(), dec.size() - 1), 1);
+}
+
+// loads, stores and branches of a loop with every field used
+static vector<trace::Record> records(u64 n)
+{
+    std::mt19937_64       rng(3);
+    vector<trace::Record> rs;
+    u64                   cycle = 0;
+
+    for(u64 i = 0; i < n; i++)
+    {
+        trace::Record r = {};
+        r.cycle = (cycle += rng() % 4);
+        r.rip   = 0x401000 + (i % 37) * 4;
+        r.op    = { (u16)(0x1010 + i % 3), (u16)(0x0181 | (i & 0x0f)), { (u8)(i % 16), 2, 0, (u8)(i % 7) },
+                    (i % 5) ? (u64)(i * 8) : (u64)-8 };
+
+        switch(i % 4)
+        {
+            case 0: r.flags = trace::rf_load;  r.vaddr = 0x7ff000 + rng() % 4096; r.size = 8; break;
+            case 1: r.flags = trace::rf_store; r.vaddr = 0x600000 - i;            r.size = 4; break;
+            case 2:
+                r.flags = trace::rf_branch | ((i % 3) ? trace::rf_taken : 0) | ((i % 11) ? 0 : trace::rf_mispredict);
+                r.vaddr = 0x401000;
+                break;
+        }
+        if(i % 2)
+        {
+            r.flags |= trace::rf_last;
+            r.seq    = r.rip + 1 + i % 15;
+        }
+        rs.push_back(r);
+    }
+    return rs;
+}
+
+static void file_round_trip(u8 codec)
+{
+    const string path = testing::TempDir() + "o3_test_" + trace::codec_name(codec) + ".tr";
+
+    // several frames
+    const vector<trace::Record> rs = records(3 * TRACE_FRAME / 16);
+    {
+        trace::Writer w(path, codec, x64);
+        for(const trace::Record& r : rs) w.put(r);
+        w.close();
+        EXPECT_EQ(w.records, rs.size());
+    }
+
+    trace::Reader r(path);
+    EXPECT_EQ(r.header.codec, codec);
+    EXPECT_EQ(r.header.frontend, x64);
+
+    trace::Record rec;
+    for(const trace::Record& want : rs)
+    {
+        ASSERT_EQ(r.next(rec), 1);
+        EXPECT_EQ(rec.cycle, want.cycle);
+        EXPECT_EQ(rec.rip, want.rip);
+        EXPECT_EQ(rec.seq, want.seq);
+        EXPECT_EQ(rec.flags, want.flags);
+        EXPECT_EQ(rec.vaddr, want.vaddr);
+        EXPECT_EQ(rec.size, want.size);
+        EXPECT_EQ(rec.op.opcode, want.op.opcode);
+        EXPECT_EQ(rec.op.control, want.op.control);
+        EXPECT_EQ(rec.op.imm, want.op.imm);
+        EXPECT_EQ(std::memcmp(rec.op.regs, want.op.regs, 4), 0);
+    }
+    EXPECT_EQ(r.next(rec), 0);
+
+    std::remove(path.c_str());
+}
+
+TEST(Trace, FileRoundTrip)
+{
+    file_round_trip(trace::codec_none);
+    file_round_trip(trace::codec_lz);
+    #ifdef with_zstd
+    file_round_trip(trace::codec_zstd);
+    #endif
+}
+
+TEST(Trace, Codecs)
+{
+    EXPECT_EQ(trace::codec_id_of("lz"), trace::codec_lz);
+    EXPECT_EQ(trace::codec_id_of(trace::codec_name(trace::codec_none)), trace::codec_none);
+    EXPECT_EQ(trace::codec_id_of("gzip"), UINT8_MAX);
+}
+
+TEST(Trace, RejectsOtherFiles)
+{
+    const string path = testing::TempDir() + "o3_test_bad.tr";
+    {
+        std::ofstream f(path, std::ios::binary);
+        f << string(64, 'x');
+    }
+
+    EXPECT_THROW(trace::Reader r(path), TraceException);
+    std::remove(path.c_str());
+}